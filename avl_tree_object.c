@@ -168,72 +168,93 @@ avl_lookup_engine (avl_tree_t *tree,
     return NULL;
 }
 
+/*
+ * Lockless search used when the tree allows optimistic reads.
+ * Writers may be changing the tree while we walk it so we may get
+ * lost, but we never touch freed memory (removed nodes are retired,
+ * not freed) and the walk is bounded in length.  The caller decides
+ * whether the result can be trusted and re-tries if not.
+ */
+#define AVL_MAX_OPTIMISTIC_DEPTH        64
+
+static void *
+avl_optimistic_lookup (avl_tree_t *tree, void *searched,
+        boolean *found)
+{
+    avl_node_t *node = tree->root_node;
+    void *user_data;
+    int res, depth = 0;
+
+    while (node && (depth++ < AVL_MAX_OPTIMISTIC_DEPTH)) {
+        user_data = node->user_data;
+        res = (tree->cmpf)(searched, user_data);
+        if (res == 0) {
+            *found = true;
+            return user_data;
+        }
+        node = (res < 0) ? node->left : node->right;
+    }
+    *found = false;
+    return NULL;
+}
+
+/*
+ * In an intrusive tree the nodes belong to the user data,
+ * so they are never allocated or freed by the tree.
+ */
 static inline void
 free_avl_node (avl_tree_t *tree, avl_node_t *node)
 {
-    MEM_MONITOR_FREE(node);
+    if (tree->node_offset < 0) OBJ_MEMORY_FREE(tree, node);
     tree->n--;
 }
 
 static inline avl_node_t *
 new_avl_node (avl_tree_t *tree, void *user_data)
 {
-    avl_node_t *node = MEM_MONITOR_ALLOC(tree, sizeof(avl_node_t));
-
-    if (node) {
-        node->left_visited = node->right_visited = false;
-        node->parent = node->left = node->right = NULL;
-        node->balance = 0;
-        node->user_data = user_data;
-        tree->n++;
-    }
-    return node;
+    return
+        (tree->node_offset >= 0) ?
+            (avl_node_t*) ((byte*) user_data + tree->node_offset) :
+            MEM_MONITOR_ALLOC(tree, sizeof(avl_node_t));
 }
 
-static int 
-thread_unsafe_avl_tree_insert (avl_tree_t *tree,
-    void *data,
-    void **present_data,
-    boolean overwrite_if_present)
+/*
+ * Intrusive trees only, the node embedded in 'user_data'
+ * takes the place of 'old' in the tree.
+ */
+static void
+replace_avl_node (avl_tree_t *tree, avl_node_t *old, void *user_data)
 {
-    avl_node_t *found, *parent, *unbalanced, *node;
-    int is_left;
-
-    /* assume the entry is not present initially */
-    safe_pointer_set(present_data, NULL);
-
-    /*
-     * some kind of traversal is already happening on the tree,
-     * so any kind of access which may change the tree is
-     * not allowed
-     */
-    if (tree->should_not_be_modified) {
-        insertion_failed(tree);
-        return EBUSY;
-    }
+    avl_node_t *node = (avl_node_t*) ((byte*) user_data + tree->node_offset);
 
-    found = avl_lookup_engine(tree, data,
-                &parent, &unbalanced, &is_left);
-
-    if (found) {
-        safe_pointer_set(present_data, found->user_data);
-        if (overwrite_if_present) {
-            found->user_data = data;
-            insertion_succeeded(tree);
-        }
-        return 0;
+    *node = *old;
+    node->user_data = user_data;
+    if (node->parent) {
+        set_child(node, node->parent, node->parent->left == old);
+    } else {
+        tree->root_node = node;
     }
+    if (node->left) node->left->parent = node;
+    if (node->right) node->right->parent = node;
+}
 
-    /* get a new node */
-    node = new_avl_node(tree, data);
-    if (NULL == node) {
-        insertion_failed(tree);
-        return ENOMEM;
-    }
+/*
+ * Links 'node' as the child of 'parent' found by the lookup and
+ * restores the balance from it up to 'unbalanced'.
+ */
+PUBLIC void
+avl_tree_link_node (avl_tree_t *tree, avl_node_t *node, void *user_data,
+        avl_node_t *parent, avl_node_t *unbalanced, int is_left)
+{
+    node->left_visited = node->right_visited = false;
+    node->parent = node->left = node->right = NULL;
+    node->balance = 0;
+    node->user_data = user_data;
+    tree->n++;
 
     if (!parent) {
         tree->root_node = node;
-        return 0;
+        return;
     }
 
     node->parent = parent;
@@ -312,42 +333,71 @@ thread_unsafe_avl_tree_insert (avl_tree_t *tree,
             break;
         }
     }
-    insertion_succeeded(tree);
-    return 0;
 }
 
 static int 
-thread_unsafe_avl_tree_remove (avl_tree_t *tree,
-        void *data_to_be_removed,
-        void **actual_data_removed)
+thread_unsafe_avl_tree_insert (avl_tree_t *tree,
+    void *data,
+    void **present_data,
+    boolean overwrite_if_present)
 {
-    avl_node_t *node, *to_be_deleted;
-    avl_node_t *parent, *unbalanced;
-    avl_node_t *left;
-    avl_node_t *right;
-    avl_node_t *next;
+    avl_node_t *found, *parent, *unbalanced, *node;
     int is_left;
 
-    safe_pointer_set(actual_data_removed, NULL);
+    /* assume the entry is not present initially */
+    safe_pointer_set(present_data, NULL);
 
-    /* being traversed, cannot access */
+    /*
+     * some kind of traversal is already happening on the tree,
+     * so any kind of access which may change the tree is
+     * not allowed
+     */
     if (tree->should_not_be_modified) {
-        deletion_failed(tree);
+        insertion_failed(tree);
         return EBUSY;
     }
 
-    /* find the matching node first */
-    node = avl_lookup_engine(tree, data_to_be_removed,
-            &parent, &unbalanced, &is_left);
+    found = avl_lookup_engine(tree, data,
+                &parent, &unbalanced, &is_left);
 
-    /* not there */
-    if (!node) {
-        deletion_failed(tree);
-        return ENODATA;
+    if (found) {
+        safe_pointer_set(present_data, found->user_data);
+        if (overwrite_if_present) {
+            if (tree->node_offset >= 0) {
+                replace_avl_node(tree, found, data);
+            } else {
+                found->user_data = data;
+            }
+            insertion_succeeded(tree);
+        }
+        return 0;
     }
 
-    /* if we are here, we found it */
-    safe_pointer_set(actual_data_removed, node->user_data);
+    /* get a new node */
+    node = new_avl_node(tree, data);
+    if (NULL == node) {
+        insertion_failed(tree);
+        return ENOMEM;
+    }
+
+    avl_tree_link_node(tree, node, data, parent, unbalanced, is_left);
+    insertion_succeeded(tree);
+    return 0;
+}
+
+/*
+ * Takes 'node' out of the tree and re-balances it.  The node is
+ * freed unless the tree is intrusive.
+ */
+PUBLIC void
+avl_tree_unlink_node (avl_tree_t *tree, avl_node_t *node)
+{
+    avl_node_t *to_be_deleted;
+    avl_node_t *parent;
+    avl_node_t *left;
+    avl_node_t *right;
+    avl_node_t *next;
+    int is_left = 0;
 
     /* cache it for later freeing */
     to_be_deleted = node;
@@ -487,6 +537,37 @@ END_OF_DELETE:
     } else {
         assert(tree->root_node != NULL);
     }
+}
+
+static int 
+thread_unsafe_avl_tree_remove (avl_tree_t *tree,
+        void *data_to_be_removed,
+        void **actual_data_removed)
+{
+    avl_node_t *node, *parent, *unbalanced;
+    int is_left;
+
+    safe_pointer_set(actual_data_removed, NULL);
+
+    /* being traversed, cannot access */
+    if (tree->should_not_be_modified) {
+        deletion_failed(tree);
+        return EBUSY;
+    }
+
+    /* find the matching node first */
+    node = avl_lookup_engine(tree, data_to_be_removed,
+            &parent, &unbalanced, &is_left);
+
+    /* not there */
+    if (!node) {
+        deletion_failed(tree);
+        return ENODATA;
+    }
+
+    /* if we are here, we found it */
+    safe_pointer_set(actual_data_removed, node->user_data);
+    avl_tree_unlink_node(tree, node);
     deletion_succeeded(tree);
     return 0;
 }
@@ -648,13 +729,32 @@ avl_tree_init (avl_tree_t *tree,
         boolean enable_statistics,
         object_comparer cmpf,
         mem_monitor_t *parent_mem_monitor)
+{
+    return
+        avl_tree_init_intrusive(tree, make_it_thread_safe,
+            enable_statistics, cmpf, -1, parent_mem_monitor);
+}
+
+PUBLIC int
+avl_tree_init_intrusive (avl_tree_t *tree,
+        boolean make_it_thread_safe,
+        boolean enable_statistics,
+        object_comparer cmpf,
+        int node_offset,
+        mem_monitor_t *parent_mem_monitor)
 {
     if (NULL == cmpf) return EINVAL;
+
+    /* an optimistic reader could still be on a node the user freed */
+    if ((node_offset >= 0) && (make_it_thread_safe == LOCK_TYPE_SEQLOCK)) {
+        return EINVAL;
+    }
     MEM_MONITOR_SETUP(tree);
     LOCK_SETUP(tree);
     STATISTICS_SETUP(tree);
 
     reset_stats(tree);
+    tree->node_offset = node_offset;
     tree->cmpf = cmpf;
     tree->n = 0;
     tree->root_node = NULL;
@@ -710,6 +810,21 @@ avl_tree_search (avl_tree_t *tree,
     int failed;
     avl_node_t *parent, *unbalanced, *node;
     int is_left;
+    unsigned int sequence;
+    boolean found;
+    void *user_data;
+
+    if (OBJ_OPTIMISTIC_READS(tree)) {
+        do {
+            sequence = lock_obj_optimistic_read_begin(tree->lock);
+            user_data = avl_optimistic_lookup(tree, data_to_be_searched,
+                            &found);
+        } while (!lock_obj_optimistic_read_end(tree->lock, sequence));
+        safe_pointer_set(present_data, user_data);
+        search_stats_update(tree, !found);
+        return
+            found ? 0 : ENODATA;
+    }
 
     OBJ_READ_LOCK(tree);
     node = avl_lookup_engine(tree, data_to_be_searched, 
@@ -743,6 +858,23 @@ avl_tree_remove (avl_tree_t *tree,
     return failed;
 }
 
+PUBLIC int
+avl_tree_remove_retire (avl_tree_t *tree,
+        void *data_to_be_removed,
+        destruction_handler_t dh, void *extra_arg)
+{
+    void *removed;
+    int failed;
+
+    if (NULL == dh) return EINVAL;
+    OBJ_WRITE_LOCK(tree);
+    failed = thread_unsafe_avl_tree_remove(tree,
+                data_to_be_removed, &removed);
+    if (0 == failed) OBJ_DATA_RETIRE(tree, removed, dh, extra_arg);
+    OBJ_WRITE_UNLOCK(tree);
+    return failed;
+}
+
 /**************************** Traverse ***************************************/
 
 PUBLIC int
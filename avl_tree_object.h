@@ -33,6 +33,7 @@ extern "C" {
 
 #include <errno.h>
 #include <assert.h>
+#include <stddef.h>
 
 #include "common.h"
 #include "mem_monitor_object.h"
@@ -61,6 +62,7 @@ typedef struct avl_tree_s {
     avl_node_t *root_node;
     object_comparer cmpf;
     bool should_not_be_modified;
+    int node_offset;
     int n;
 
 } avl_tree_t;
@@ -76,6 +78,27 @@ avl_tree_init (avl_tree_t *tree,
         object_comparer cmpf,
         mem_monitor_t *parent_mem_monitor);
 
+/*
+ * Intrusive version of the tree.  The user data embeds an avl_node_t
+ * at 'node_offset' (AVL_NODE_OFFSET) bytes from its start, which the
+ * tree uses as its node.  Inserts & removes then never allocate or
+ * free anything and a comparison touches the same cache line as the
+ * node it is comparing against.  All other calls are the same as for
+ * the normal tree.  The user data must stay put while in the tree and
+ * must not be inserted into another tree using the same embedded
+ * node.  Since the tree does not own its nodes, it cannot be made
+ * thread safe with LOCK_TYPE_SEQLOCK.
+ */
+#define AVL_NODE_OFFSET(type, member)   ((int) offsetof(type, member))
+
+extern int
+avl_tree_init_intrusive (avl_tree_t *tree,
+        boolean make_it_thread_safe,
+        boolean enable_statistics,
+        object_comparer cmpf,
+        int node_offset,
+        mem_monitor_t *parent_mem_monitor);
+
 extern void
 avl_tree_debug_set_level (int level);
 
@@ -101,6 +124,34 @@ avl_tree_remove (avl_tree_t *tree,
         void *data_to_be_removed,
         void **data_actually_removed);
 
+/*
+ * Removes the data and disposes of what was actually removed by
+ * calling 'dh' with it & 'extra_arg'.  If the tree allows optimistic
+ * searches (LOCK_TYPE_SEQLOCK), 'dh' is called only once no search can
+ * still be looking at the data, so removed data of such a tree must
+ * be freed this way and never after a plain 'avl_tree_remove'.
+ */
+extern int
+avl_tree_remove_retire (avl_tree_t *tree,
+        void *data_to_be_removed,
+        destruction_handler_t dh, void *extra_arg);
+
+/*
+ * Building blocks for trees which do their own (typed, inlined)
+ * lookups, see typed_objects.h.  The caller holds the write lock.
+ * 'avl_tree_link_node' links 'node' carrying 'user_data' where
+ * a failed lookup ended ('parent', 'is_left'), re-balancing the tree
+ * up to 'unbalanced', the last node with a non zero balance seen
+ * on the way down.  'avl_tree_unlink_node' takes 'node' out of the
+ * tree, freeing it unless the tree is intrusive.
+ */
+extern void
+avl_tree_link_node (avl_tree_t *tree, avl_node_t *node, void *user_data,
+        avl_node_t *parent, avl_node_t *unbalanced, int is_left);
+
+extern void
+avl_tree_unlink_node (avl_tree_t *tree, avl_node_t *node);
+
 /*
  * Morris traverses the tree down from the specified 'root' parameter.
  * If 'root' is NULL, the entire tree will be traversed.
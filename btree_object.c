@@ -0,0 +1,793 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#include "btree_object.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * default values for btree object debugging
+ */
+static debug_module_block_t btree_debug = {
+
+    .lock = NULL,
+    .level = ERROR_DEBUG_LEVEL,
+    .module_name = "BTREE_MODULE",
+    .drf = NULL
+};
+
+/* a non root node must never have fewer than these */
+#define LEAF_MIN                (BTREE_LEAF_SLOTS / 2)
+#define INNER_MIN               (BTREE_INNER_KEYS / 2)
+
+/*
+ * the inner nodes visited on the way down to a leaf and which
+ * child was taken in each of them, root first.
+ */
+typedef struct btree_path_s {
+
+    btree_node_t *node;
+    int index;
+
+} btree_path_t;
+
+static inline btree_node_t *
+new_btree_node (btree_t *tree, boolean is_leaf)
+{
+    btree_node_t *node =
+        mem_monitor_allocate_aligned(tree->mem_mon_p,
+            sizeof(btree_node_t), CACHE_LINE_SIZE);
+
+    if (node) {
+        node->is_leaf = is_leaf;
+        node->n = 0;
+        node->u.leaf.next = NULL;
+    }
+    return node;
+}
+
+static inline void
+free_btree_node (btree_t *tree, btree_node_t *node)
+{
+    mem_monitor_free_aligned(tree->mem_mon_p, node, sizeof(btree_node_t));
+}
+
+/*
+ * index of the first user data in the leaf which is equal to
+ * or bigger than 'searched'.
+ */
+static inline int
+leaf_position (btree_t *tree, btree_node_t *leaf,
+        void *searched, boolean *found)
+{
+    int lo = 0, hi = leaf->n, mid, res;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        res = (tree->cmpf)(searched, leaf->u.leaf.data[mid]);
+        if (res == 0) {
+            *found = true;
+            return mid;
+        }
+        if (res < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    *found = false;
+    return lo;
+}
+
+/*
+ * index of the child 'searched' would be under.  If it is equal
+ * to a separator, that separator is the one just before the child.
+ */
+static inline int
+inner_position (btree_t *tree, btree_node_t *inner,
+        void *searched, boolean *exact)
+{
+    int lo = 0, hi = inner->n, mid, res;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        res = (tree->cmpf)(searched, inner->u.inner.keys[mid]);
+        if (res == 0) {
+            *exact = true;
+            return mid + 1;
+        }
+        if (res < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    *exact = false;
+    return lo;
+}
+
+/*
+ * Walks down to the leaf which has or should have 'searched' in it.
+ * If 'path' is not NULL, the inner nodes visited are recorded in it.
+ * If 'separator' is not NULL, it records the inner node & key index
+ * of a separator equal to 'searched' (node is NULL if there is none).
+ * Must not be called on an empty tree.
+ */
+static btree_node_t *
+btree_lookup_engine (btree_t *tree, void *searched,
+        btree_path_t *path, btree_path_t *separator,
+        int *position, boolean *found)
+{
+    btree_node_t *node = tree->root_node;
+    boolean exact;
+    int level = 0, index;
+
+    if (separator) separator->node = NULL;
+    while (!node->is_leaf) {
+        index = inner_position(tree, node, searched, &exact);
+        if (exact && separator) {
+            separator->node = node;
+            separator->index = index - 1;
+        }
+        if (path) {
+            path[level].node = node;
+            path[level].index = index;
+        }
+        level++;
+        node = node->u.inner.children[index];
+    }
+    *position = leaf_position(tree, node, searched, found);
+    return node;
+}
+
+static inline void
+leaf_insert_at (btree_node_t *leaf, int index, void *data)
+{
+    memmove(&leaf->u.leaf.data[index + 1], &leaf->u.leaf.data[index],
+        (leaf->n - index) * sizeof(void*));
+    leaf->u.leaf.data[index] = data;
+    leaf->n++;
+}
+
+static inline void
+leaf_remove_at (btree_node_t *leaf, int index)
+{
+    leaf->n--;
+    memmove(&leaf->u.leaf.data[index], &leaf->u.leaf.data[index + 1],
+        (leaf->n - index) * sizeof(void*));
+}
+
+static inline void
+inner_insert_at (btree_node_t *inner, int index,
+        void *key, btree_node_t *child)
+{
+    memmove(&inner->u.inner.keys[index + 1], &inner->u.inner.keys[index],
+        (inner->n - index) * sizeof(void*));
+    memmove(&inner->u.inner.children[index + 2],
+        &inner->u.inner.children[index + 1],
+        (inner->n - index) * sizeof(btree_node_t*));
+    inner->u.inner.keys[index] = key;
+    inner->u.inner.children[index + 1] = child;
+    inner->n++;
+}
+
+/*
+ * removes the separator at 'index' together with the child to its right
+ */
+static inline void
+inner_remove_at (btree_node_t *inner, int index)
+{
+    inner->n--;
+    memmove(&inner->u.inner.keys[index], &inner->u.inner.keys[index + 1],
+        (inner->n - index) * sizeof(void*));
+    memmove(&inner->u.inner.children[index + 1],
+        &inner->u.inner.children[index + 2],
+        (inner->n - index) * sizeof(btree_node_t*));
+}
+
+/*
+ * Splits a full leaf into 'leaf' & the empty 'right' while inserting
+ * 'data' at 'index'.  Returns the separator for the parent.
+ */
+static void *
+leaf_split (btree_node_t *leaf, btree_node_t *right,
+        int index, void *data)
+{
+    int half = (BTREE_LEAF_SLOTS + 1) / 2;
+    int from = (index < half) ? half - 1 : half;
+
+    right->is_leaf = true;
+    right->n = leaf->n - from;
+    memcpy(right->u.leaf.data, &leaf->u.leaf.data[from],
+        right->n * sizeof(void*));
+    leaf->n = from;
+    if (index < half) {
+        leaf_insert_at(leaf, index, data);
+    } else {
+        leaf_insert_at(right, index - half, data);
+    }
+    right->u.leaf.next = leaf->u.leaf.next;
+    leaf->u.leaf.next = right;
+    return right->u.leaf.data[0];
+}
+
+/*
+ * Splits a full inner node into 'inner' & the empty 'right' while
+ * inserting 'key' & its right hand side 'child' at 'index'.
+ * Returns the key which moves up into the parent.
+ */
+static void *
+inner_split (btree_node_t *inner, btree_node_t *right,
+        int index, void *key, btree_node_t *child)
+{
+    void *keys [BTREE_INNER_KEYS + 1];
+    btree_node_t *children [BTREE_INNER_KEYS + 2];
+    int half = (BTREE_INNER_KEYS + 1) / 2;
+    int n = inner->n;
+
+    memcpy(keys, inner->u.inner.keys, index * sizeof(void*));
+    keys[index] = key;
+    memcpy(&keys[index + 1], &inner->u.inner.keys[index],
+        (n - index) * sizeof(void*));
+    memcpy(children, inner->u.inner.children,
+        (index + 1) * sizeof(btree_node_t*));
+    children[index + 1] = child;
+    memcpy(&children[index + 2], &inner->u.inner.children[index + 1],
+        (n - index) * sizeof(btree_node_t*));
+
+    inner->n = half;
+    memcpy(inner->u.inner.keys, keys, half * sizeof(void*));
+    memcpy(inner->u.inner.children, children,
+        (half + 1) * sizeof(btree_node_t*));
+
+    right->is_leaf = false;
+    right->n = n - half;
+    memcpy(right->u.inner.keys, &keys[half + 1], right->n * sizeof(void*));
+    memcpy(right->u.inner.children, &children[half + 1],
+        (right->n + 1) * sizeof(btree_node_t*));
+
+    return keys[half];
+}
+
+static int
+thread_unsafe_btree_insert (btree_t *tree,
+        void *data,
+        void **present_data,
+        boolean overwrite_if_present)
+{
+    btree_path_t path [BTREE_MAX_DEPTH], separator;
+    btree_node_t *spare [BTREE_MAX_DEPTH + 2];
+    btree_node_t *leaf, *node, *root;
+    int level, index, needed, i;
+    boolean found;
+    void *key;
+
+    /* assume the entry is not present initially */
+    safe_pointer_set(present_data, NULL);
+
+    /* being traversed, cannot be modified */
+    if (tree->should_not_be_modified) {
+        insertion_failed(tree);
+        return EBUSY;
+    }
+
+    if (NULL == tree->root_node) {
+        leaf = new_btree_node(tree, true);
+        if (NULL == leaf) {
+            insertion_failed(tree);
+            return ENOMEM;
+        }
+        leaf->u.leaf.data[0] = data;
+        leaf->n = 1;
+        tree->root_node = tree->first_leaf = leaf;
+        tree->height = 0;
+        tree->n = 1;
+        insertion_succeeded(tree);
+        return 0;
+    }
+
+    leaf = btree_lookup_engine(tree, data, path, &separator,
+                &index, &found);
+
+    if (found) {
+        safe_pointer_set(present_data, leaf->u.leaf.data[index]);
+        if (overwrite_if_present) {
+            leaf->u.leaf.data[index] = data;
+
+            /* a separator must never refer to the replaced data */
+            if (separator.node) {
+                separator.node->u.inner.keys[separator.index] = data;
+            }
+            insertion_succeeded(tree);
+        }
+        return 0;
+    }
+
+    if (leaf->n < BTREE_LEAF_SLOTS) {
+        leaf_insert_at(leaf, index, data);
+        tree->n++;
+        insertion_succeeded(tree);
+        return 0;
+    }
+
+    /*
+     * Get every node all the splits will need before changing
+     * anything, so that running out of memory leaves the tree intact.
+     */
+    needed = 1;
+    for (level = tree->height - 1; level >= 0; level--) {
+        if (path[level].node->n < BTREE_INNER_KEYS) break;
+        needed++;
+    }
+    if (level < 0) needed++;
+    if (tree->height + 2 > BTREE_MAX_DEPTH) {
+        insertion_failed(tree);
+        return ENOSPC;
+    }
+    for (i = 0; i < needed; i++) {
+        spare[i] = new_btree_node(tree, false);
+        if (NULL == spare[i]) {
+            while (i--) free_btree_node(tree, spare[i]);
+            insertion_failed(tree);
+            return ENOMEM;
+        }
+    }
+
+    node = spare[--needed];
+    key = leaf_split(leaf, node, index, data);
+    for (level = tree->height - 1; level >= 0; level--) {
+        index = path[level].index;
+        if (path[level].node->n < BTREE_INNER_KEYS) {
+            inner_insert_at(path[level].node, index, key, node);
+            node = NULL;
+            break;
+        }
+        key = inner_split(path[level].node, spare[--needed],
+                index, key, node);
+        node = spare[needed];
+    }
+
+    /* the root itself split, tree grows one level */
+    if (node) {
+        root = spare[--needed];
+        root->n = 1;
+        root->u.inner.keys[0] = key;
+        root->u.inner.children[0] = tree->root_node;
+        root->u.inner.children[1] = node;
+        tree->root_node = root;
+        tree->height++;
+    }
+    assert(needed == 0);
+    tree->n++;
+    insertion_succeeded(tree);
+    return 0;
+}
+
+/*
+ * 'node' (child 'index' of 'parent') is short of one, take the
+ * last entry of its left sibling.
+ */
+static void
+borrow_from_left (btree_node_t *parent, int index,
+        btree_node_t *left, btree_node_t *node)
+{
+    if (node->is_leaf) {
+        leaf_insert_at(node, 0, left->u.leaf.data[left->n - 1]);
+        left->n--;
+        parent->u.inner.keys[index - 1] = node->u.leaf.data[0];
+        return;
+    }
+    memmove(&node->u.inner.keys[1], node->u.inner.keys,
+        node->n * sizeof(void*));
+    memmove(&node->u.inner.children[1], node->u.inner.children,
+        (node->n + 1) * sizeof(btree_node_t*));
+    node->u.inner.keys[0] = parent->u.inner.keys[index - 1];
+    node->u.inner.children[0] = left->u.inner.children[left->n];
+    node->n++;
+    parent->u.inner.keys[index - 1] = left->u.inner.keys[left->n - 1];
+    left->n--;
+}
+
+/*
+ * 'node' (child 'index' of 'parent') is short of one, take the
+ * first entry of its right sibling.
+ */
+static void
+borrow_from_right (btree_node_t *parent, int index,
+        btree_node_t *node, btree_node_t *right)
+{
+    if (node->is_leaf) {
+        node->u.leaf.data[node->n++] = right->u.leaf.data[0];
+        leaf_remove_at(right, 0);
+        parent->u.inner.keys[index] = right->u.leaf.data[0];
+        return;
+    }
+    node->u.inner.keys[node->n] = parent->u.inner.keys[index];
+    node->u.inner.children[node->n + 1] = right->u.inner.children[0];
+    node->n++;
+    parent->u.inner.keys[index] = right->u.inner.keys[0];
+    right->n--;
+    memmove(right->u.inner.keys, &right->u.inner.keys[1],
+        right->n * sizeof(void*));
+    memmove(right->u.inner.children, &right->u.inner.children[1],
+        (right->n + 1) * sizeof(btree_node_t*));
+}
+
+/*
+ * merges child 'index + 1' of 'parent' into child 'index'
+ */
+static void
+merge_children (btree_t *tree, btree_node_t *parent, int index)
+{
+    btree_node_t *left = parent->u.inner.children[index];
+    btree_node_t *right = parent->u.inner.children[index + 1];
+
+    if (left->is_leaf) {
+        memcpy(&left->u.leaf.data[left->n], right->u.leaf.data,
+            right->n * sizeof(void*));
+        left->n += right->n;
+        left->u.leaf.next = right->u.leaf.next;
+    } else {
+        left->u.inner.keys[left->n] = parent->u.inner.keys[index];
+        memcpy(&left->u.inner.keys[left->n + 1], right->u.inner.keys,
+            right->n * sizeof(void*));
+        memcpy(&left->u.inner.children[left->n + 1],
+            right->u.inner.children,
+            (right->n + 1) * sizeof(btree_node_t*));
+        left->n += right->n + 1;
+    }
+    inner_remove_at(parent, index);
+    free_btree_node(tree, right);
+}
+
+/*
+ * 'node' has just lost an entry, restore the minimum occupancy
+ * all the way up to the root, following the recorded 'path'.
+ */
+static void
+btree_rebalance (btree_t *tree, btree_path_t *path, btree_node_t *node)
+{
+    btree_node_t *parent, *sibling;
+    int level, index, min;
+
+    for (level = tree->height - 1; level >= 0; level--) {
+        min = node->is_leaf ? LEAF_MIN : INNER_MIN;
+        if (node->n >= min) return;
+        parent = path[level].node;
+        index = path[level].index;
+        if (index > 0) {
+            sibling = parent->u.inner.children[index - 1];
+            if (sibling->n > min) {
+                borrow_from_left(parent, index, sibling, node);
+                return;
+            }
+        }
+        if (index < parent->n) {
+            sibling = parent->u.inner.children[index + 1];
+            if (sibling->n > min) {
+                borrow_from_right(parent, index, node, sibling);
+                return;
+            }
+        }
+        merge_children(tree, parent, index > 0 ? index - 1 : index);
+        node = parent;
+    }
+
+    /* root is allowed to go below the minimum but not to empty */
+    node = tree->root_node;
+    if (node->n > 0) return;
+    if (node->is_leaf) {
+        tree->root_node = tree->first_leaf = NULL;
+    } else {
+        tree->root_node = node->u.inner.children[0];
+        tree->height--;
+    }
+    free_btree_node(tree, node);
+}
+
+/*
+ * The smallest user data of a subtree is also its separator in
+ * an ancestor.  Once it is removed, that separator must be replaced
+ * by the new smallest one since the old user data may be freed.
+ */
+static void
+btree_replace_separator (btree_t *tree, void *removed)
+{
+    btree_node_t *node = tree->root_node;
+    btree_node_t *child;
+    boolean exact;
+    int index;
+
+    while (!node->is_leaf) {
+        index = inner_position(tree, node, removed, &exact);
+        child = node->u.inner.children[index];
+        if (exact) {
+            while (!child->is_leaf) child = child->u.inner.children[0];
+            node->u.inner.keys[index - 1] = child->u.leaf.data[0];
+            return;
+        }
+        node = child;
+    }
+}
+
+static int
+thread_unsafe_btree_remove (btree_t *tree,
+        void *data_to_be_removed,
+        void **actual_data_removed)
+{
+    btree_path_t path [BTREE_MAX_DEPTH];
+    btree_node_t *leaf;
+    boolean found;
+    int index;
+
+    safe_pointer_set(actual_data_removed, NULL);
+
+    /* being traversed, cannot access */
+    if (tree->should_not_be_modified) {
+        deletion_failed(tree);
+        return EBUSY;
+    }
+
+    if (NULL == tree->root_node) {
+        deletion_failed(tree);
+        return ENODATA;
+    }
+    leaf = btree_lookup_engine(tree, data_to_be_removed, path, NULL,
+                &index, &found);
+    if (!found) {
+        deletion_failed(tree);
+        return ENODATA;
+    }
+
+    safe_pointer_set(actual_data_removed, leaf->u.leaf.data[index]);
+    leaf_remove_at(leaf, index);
+    tree->n--;
+    btree_rebalance(tree, path, leaf);
+    if ((0 == index) && tree->root_node) {
+        btree_replace_separator(tree, data_to_be_removed);
+    }
+    deletion_succeeded(tree);
+    return 0;
+}
+
+static int
+thread_unsafe_btree_traverse (btree_t *tree, void *from,
+        traverse_function_pointer tfn,
+        void *p0, void *p1, void *p2, void *p3)
+{
+    btree_node_t *leaf;
+    boolean found;
+    int index = 0, failed = 0;
+
+    if (NULL == tree->root_node) return 0;
+    if (from) {
+        leaf = btree_lookup_engine(tree, from, NULL, NULL,
+                    &index, &found);
+    } else {
+        leaf = tree->first_leaf;
+    }
+
+    /*
+     * in case the traversal function attempts to
+     * change the tree from under us
+     */
+    tree->should_not_be_modified = true;
+    while (leaf && !failed) {
+        if (leaf->u.leaf.next) __builtin_prefetch(leaf->u.leaf.next);
+        for (; (index < leaf->n) && !failed; index++) {
+            failed = tfn(tree, leaf, leaf->u.leaf.data[index],
+                        p0, p1, p2, p3);
+        }
+        leaf = leaf->u.leaf.next;
+        index = 0;
+    }
+    tree->should_not_be_modified = false;
+    return failed;
+}
+
+static int
+thread_unsafe_btree_destroy (btree_t *tree, btree_node_t *node,
+        destruction_handler_t dh_fptr, void *extra_arg)
+{
+    int i, delete_count = 0;
+
+    if (node->is_leaf) {
+        if (dh_fptr) {
+            for (i = 0; i < node->n; i++) {
+                dh_fptr(node->u.leaf.data[i], extra_arg);
+            }
+        }
+        delete_count = node->n;
+    } else {
+        for (i = 0; i <= node->n; i++) {
+            delete_count += thread_unsafe_btree_destroy(tree,
+                                node->u.inner.children[i],
+                                dh_fptr, extra_arg);
+        }
+    }
+    free_btree_node(tree, node);
+    return delete_count;
+}
+
+/**************************** Initialize *************************************/
+
+PUBLIC int
+btree_init (btree_t *tree,
+        boolean make_it_thread_safe,
+        boolean enable_statistics,
+        object_comparer cmpf,
+        mem_monitor_t *parent_mem_monitor)
+{
+    if (NULL == cmpf) return EINVAL;
+    MEM_MONITOR_SETUP(tree);
+    LOCK_SETUP(tree);
+    STATISTICS_SETUP(tree);
+
+    reset_stats(tree);
+    tree->cmpf = cmpf;
+    tree->n = 0;
+    tree->height = 0;
+    tree->root_node = tree->first_leaf = NULL;
+    tree->should_not_be_modified = false;
+
+    OBJ_WRITE_UNLOCK(tree);
+
+    return 0;
+}
+
+PUBLIC void
+btree_debug_set_level (int level)
+{
+    debug_module_block_set_level(&btree_debug, level);
+}
+
+PUBLIC void
+btree_debug_set_module_name (char *name)
+{
+    debug_module_block_set_module_name(&btree_debug, name);
+}
+
+PUBLIC void
+btree_debug_set_reporting_function (debug_reporting_function drf)
+{
+    debug_module_block_set_reporting_function(&btree_debug, drf);
+}
+
+/**************************** Insert *****************************************/
+
+PUBLIC int
+btree_insert (btree_t *tree,
+        void *data,
+        void **present_data,
+        boolean overwrite_if_present)
+{
+    int failed;
+
+    OBJ_WRITE_LOCK(tree);
+    failed = thread_unsafe_btree_insert(tree,
+                data, present_data, overwrite_if_present);
+    OBJ_WRITE_UNLOCK(tree);
+    return failed;
+}
+
+/**************************** Search *****************************************/
+
+PUBLIC int
+btree_search (btree_t *tree,
+        void *data_to_be_searched,
+        void **present_data)
+{
+    btree_node_t *leaf = NULL;
+    boolean found = false;
+    int index = 0, failed;
+
+    OBJ_READ_LOCK(tree);
+    if (tree->root_node) {
+        leaf = btree_lookup_engine(tree, data_to_be_searched, NULL, NULL,
+                    &index, &found);
+    }
+    if (found) {
+        safe_pointer_set(present_data, leaf->u.leaf.data[index]);
+        search_succeeded(tree);
+        failed = 0;
+    } else {
+        safe_pointer_set(present_data, NULL);
+        search_failed(tree);
+        failed = ENODATA;
+    }
+    OBJ_READ_UNLOCK(tree);
+    return failed;
+}
+
+/**************************** Remove *****************************************/
+
+PUBLIC int
+btree_remove (btree_t *tree,
+        void *data_to_be_removed,
+        void **actual_data_removed)
+{
+    int failed;
+
+    OBJ_WRITE_LOCK(tree);
+    failed = thread_unsafe_btree_remove(tree,
+                data_to_be_removed, actual_data_removed);
+    OBJ_WRITE_UNLOCK(tree);
+    return failed;
+}
+
+/**************************** Traverse ***************************************/
+
+PUBLIC int
+btree_traverse (btree_t *tree, void *from,
+        traverse_function_pointer tfn,
+        void *p0, void *p1, void *p2, void *p3)
+{
+    int failed;
+
+    OBJ_READ_LOCK(tree);
+    failed = thread_unsafe_btree_traverse(tree, from,
+                tfn, p0, p1, p2, p3);
+    OBJ_READ_UNLOCK(tree);
+    return failed;
+}
+
+/**************************** Destroy ****************************************/
+
+PUBLIC void
+btree_destroy (btree_t *tree,
+        destruction_handler_t dh_fptr, void *extra_arg)
+{
+    int old_count, deleted = 0;
+
+    OBJ_WRITE_LOCK(tree);
+    old_count = tree->n;
+    tree->should_not_be_modified = true;
+    if (tree->root_node) {
+        deleted = thread_unsafe_btree_destroy(tree, tree->root_node,
+                        dh_fptr, extra_arg);
+    }
+    assert(old_count == deleted);
+    tree->root_node = tree->first_leaf = NULL;
+    tree->cmpf = NULL;
+    OBJ_WRITE_UNLOCK(tree);
+    LOCK_OBJ_DESTROY(tree);
+    memset(tree, 0, sizeof(btree_t));
+}
+
+#ifdef __cplusplus
+} // extern C
+#endif
@@ -0,0 +1,185 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#ifndef __BTREE_OBJECT_H__
+#define __BTREE_OBJECT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <assert.h>
+
+#include "common.h"
+#include "mem_monitor_object.h"
+#include "lock_object.h"
+#include "debug_framework.h"
+
+/*
+ * A B+tree storing the same user data pointers as the avl tree, with
+ * the same object_comparer contract.  All user data lives in the
+ * leaves, which are linked left to right for in order scans.  The
+ * inner nodes hold separators only, each of which is the smallest
+ * user data of the subtree to its right (hence always a live user
+ * data and safe to pass to the comparer).
+ *
+ * Every node is exactly BTREE_NODE_SIZE bytes, starts on a cache line
+ * and packs as many pointers as it can, so a search touches a few
+ * cache lines per level instead of one node per comparison.
+ */
+#ifndef BTREE_NODE_SIZE
+#define BTREE_NODE_SIZE         (4 * CACHE_LINE_SIZE)
+#endif /* BTREE_NODE_SIZE */
+
+#define BTREE_NODE_HEADER       (2 * sizeof(void*))
+
+#define BTREE_LEAF_SLOTS \
+    ((int) ((BTREE_NODE_SIZE - BTREE_NODE_HEADER) / sizeof(void*)))
+
+#define BTREE_INNER_KEYS \
+    ((int) ((BTREE_NODE_SIZE - BTREE_NODE_HEADER) / (2 * sizeof(void*))))
+
+/* deep enough for any tree which can fit into memory */
+#define BTREE_MAX_DEPTH         32
+
+typedef struct btree_node_s btree_node_t;
+
+struct btree_node_s {
+
+    short is_leaf;
+    short n;
+
+    union {
+
+        struct {
+            btree_node_t *next;
+            void *data [BTREE_LEAF_SLOTS];
+        } leaf;
+
+        struct {
+            void *keys [BTREE_INNER_KEYS];
+            btree_node_t *children [BTREE_INNER_KEYS + 1];
+        } inner;
+
+    } u;
+};
+
+typedef struct btree_s {
+
+    MEM_MON_VARIABLES;
+    LOCK_VARIABLES;
+    STATISTICS_VARIABLES;
+
+    btree_node_t *root_node;
+    btree_node_t *first_leaf;
+    object_comparer cmpf;
+    bool should_not_be_modified;
+    int height;
+    int n;
+
+} btree_t;
+
+static inline int
+btree_size (btree_t *tree)
+{ return tree->n; }
+
+extern int
+btree_init (btree_t *tree,
+        boolean make_it_thread_safe,
+        boolean enable_statistics,
+        object_comparer cmpf,
+        mem_monitor_t *parent_mem_monitor);
+
+extern void
+btree_debug_set_level (int level);
+
+extern void
+btree_debug_set_module_name (char *name);
+
+extern void
+btree_debug_set_reporting_function (debug_reporting_function drf);
+
+extern int
+btree_insert (btree_t *tree,
+        void *data_to_be_inserted,
+        void **present_data,
+        boolean overwrite_if_present);
+
+extern int
+btree_search (btree_t *tree,
+        void *data_to_be_searched,
+        void **present_data);
+
+extern int
+btree_remove (btree_t *tree,
+        void *data_to_be_removed,
+        void **data_actually_removed);
+
+/*
+ * Calls 'tfn' for every user data in ascending order, simply walking
+ * the linked leaves.  If 'from' is NULL, the entire tree is traversed,
+ * otherwise the traversal starts at the first user data which compares
+ * equal to or bigger than 'from'.  The parameters passed into the
+ * traversal function are the same as the avl tree's:
+ *
+ *  param0: tree
+ *  param1: leaf node holding the user data
+ *  param2: user data pointer
+ *  param3..6: p0, p1, p2, p3
+ *
+ * The function should return 0 to continue and non zero (error code)
+ * to stop the traversal, which is then returned.
+ */
+extern int
+btree_traverse (btree_t *tree, void *from,
+        traverse_function_pointer tfn,
+        void *p0, void *p1, void *p2, void *p3);
+
+/*
+ * Same semantics as 'avl_tree_destroy'.  Only the contents of the
+ * object are destroyed, calling 'dcbf' (if not NULL) for every user
+ * data with 'extra_arg'.  The object must be re-initialized to be
+ * used again.
+ */
+extern void
+btree_destroy (btree_t *tree,
+        destruction_handler_t dcbf, void *extra_arg);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif // __BTREE_OBJECT_H__
@@ -0,0 +1,292 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#include "buffer_chain.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* how many segments the segments array starts with */
+#define INITIAL_SEGMENTS        8
+
+/*
+ * the chain may write into a buffer only if nobody else
+ * (including another segment of the same chain) refers to it.
+ */
+static inline boolean
+buffer_writable (byte *buffer)
+{
+    return
+        1 == buffer_of(buffer)->refcount;
+}
+
+/*
+ * make sure there is room for one more segment
+ */
+static int
+buffer_chain_make_room (buffer_chain_t *chain)
+{
+    buffer_segment_t *segments;
+    int max_segments;
+
+    if (chain->n_segments < chain->max_segments) return 0;
+    max_segments = chain->max_segments ?
+        2 * chain->max_segments : INITIAL_SEGMENTS;
+    segments = MEM_MONITOR_REALLOC(chain->bmp, chain->segments,
+                    max_segments * sizeof(buffer_segment_t));
+    if (NULL == segments) return ENOMEM;
+    chain->segments = segments;
+    chain->max_segments = max_segments;
+
+    return 0;
+}
+
+/*
+ * the room for the segment must already have been made
+ */
+static inline void
+buffer_chain_add_segment (buffer_chain_t *chain,
+    byte *buffer, int offset, int length)
+{
+    buffer_segment_t *segp = &chain->segments[chain->n_segments];
+
+    segp->buffer = buffer;
+    segp->offset = offset;
+    segp->length = length;
+    (chain->n_segments)++;
+    chain->length += length;
+}
+
+PUBLIC int
+buffer_chain_init (buffer_chain_t *chain, buffer_manager_t *bmp)
+{
+    memset(chain, 0, sizeof(buffer_chain_t));
+    chain->bmp = bmp;
+
+    return 0;
+}
+
+PUBLIC int
+buffer_chain_append (buffer_chain_t *chain, void *data, int length)
+{
+    buffer_segment_t *last;
+    byte *src = data;
+    byte *buffer;
+    int n;
+
+    /* first use up whatever room is left at the end of the last segment */
+    if (chain->n_segments) {
+        last = &chain->segments[chain->n_segments - 1];
+        if (buffer_writable(last->buffer)) {
+            n = buffer_capacity(last->buffer) - last->offset - last->length;
+            if (n > length) n = length;
+            if (n > 0) {
+                memcpy(last->buffer + last->offset + last->length, src, n);
+                last->length += n;
+                chain->length += n;
+                src += n;
+                length -= n;
+            }
+        }
+    }
+
+    /* then keep adding new buffers, as big as possible */
+    while (length > 0) {
+        if (buffer_chain_make_room(chain)) return ENOMEM;
+        n = length < chain->bmp->max_size ? length : chain->bmp->max_size;
+        buffer = buffer_allocate(chain->bmp, n);
+        if (NULL == buffer) return ENOMEM;
+        n = length < buffer_capacity(buffer) ? length : buffer_capacity(buffer);
+        memcpy(buffer, src, n);
+        buffer_chain_add_segment(chain, buffer, 0, n);
+        src += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+PUBLIC int
+buffer_chain_append_buffer (buffer_chain_t *chain,
+    void *buffer, int offset, int length)
+{
+    if ((offset < 0) || (length < 0) ||
+        (offset + length > buffer_capacity(buffer))) {
+            return EINVAL;
+    }
+    if (0 == length) return 0;
+    if (buffer_chain_make_room(chain)) return ENOMEM;
+    buffer_get(buffer);
+    buffer_chain_add_segment(chain, buffer, offset, length);
+
+    return 0;
+}
+
+PUBLIC int
+buffer_chain_prepend (buffer_chain_t *chain, void *header, int length)
+{
+    buffer_segment_t *first;
+    byte *buffer;
+    int offset;
+
+    if ((length < 0) || (length > chain->bmp->max_size)) return EINVAL;
+    if (0 == length) return 0;
+
+    /* fits in front of the first segment */
+    if (chain->n_segments) {
+        first = &chain->segments[0];
+        if ((first->offset >= length) && buffer_writable(first->buffer)) {
+            first->offset -= length;
+            first->length += length;
+            memcpy(first->buffer + first->offset, header, length);
+            chain->length += length;
+            return 0;
+        }
+    }
+
+    /* does not, needs a new segment, filled from its end */
+    if (buffer_chain_make_room(chain)) return ENOMEM;
+    buffer = buffer_allocate(chain->bmp, length);
+    if (NULL == buffer) return ENOMEM;
+    offset = buffer_capacity(buffer) - length;
+    memcpy(buffer + offset, header, length);
+    memmove(&chain->segments[1], &chain->segments[0],
+        chain->n_segments * sizeof(buffer_segment_t));
+    chain->segments[0].buffer = buffer;
+    chain->segments[0].offset = offset;
+    chain->segments[0].length = length;
+    (chain->n_segments)++;
+    chain->length += length;
+
+    return 0;
+}
+
+/*
+ * The bytes are gathered into the first segment if its buffer is not
+ * shared & has enough room, otherwise into a brand new buffer which
+ * then replaces the first segment.  Segments which get completely
+ * pulled up are then removed from the chain.
+ */
+PUBLIC void *
+buffer_chain_pullup (buffer_chain_t *chain, int length)
+{
+    buffer_segment_t *first, *segp;
+    byte *buffer;
+    int s, n;
+
+    if ((length <= 0) || (length > chain->length) ||
+        (length > chain->bmp->max_size)) {
+            return null;
+    }
+    first = &chain->segments[0];
+    if (first->length >= length) return first->buffer + first->offset;
+
+    if (!buffer_writable(first->buffer) ||
+        (buffer_capacity(first->buffer) - first->offset < length)) {
+            buffer = buffer_allocate(chain->bmp, length);
+            if (NULL == buffer) return null;
+            memcpy(buffer, first->buffer + first->offset, first->length);
+            buffer_put(first->buffer);
+            first->buffer = buffer;
+            first->offset = 0;
+    }
+
+    s = 1;
+    while (first->length < length) {
+        segp = &chain->segments[s];
+        n = length - first->length;
+        if (n > segp->length) n = segp->length;
+        memcpy(first->buffer + first->offset + first->length,
+            segp->buffer + segp->offset, n);
+        first->length += n;
+        segp->offset += n;
+        segp->length -= n;
+        if (0 == segp->length) {
+            buffer_put(segp->buffer);
+            s++;
+        }
+    }
+    memmove(&chain->segments[1], &chain->segments[s],
+        (chain->n_segments - s) * sizeof(buffer_segment_t));
+    chain->n_segments -= s - 1;
+
+    return first->buffer + first->offset;
+}
+
+PUBLIC int
+buffer_chain_linearize (buffer_chain_t *chain, void *dest)
+{
+    buffer_segment_t *segp;
+    byte *dst = dest;
+    int s;
+
+    for (s = 0; s < chain->n_segments; s++) {
+        segp = &chain->segments[s];
+        memcpy(dst, segp->buffer + segp->offset, segp->length);
+        dst += segp->length;
+    }
+    return chain->length;
+}
+
+PUBLIC int
+buffer_chain_iovec (buffer_chain_t *chain, struct iovec iov [], int max_iov)
+{
+    int s;
+
+    for (s = 0; (s < chain->n_segments) && (s < max_iov); s++) {
+        iov[s].iov_base = chain->segments[s].buffer +
+                            chain->segments[s].offset;
+        iov[s].iov_len = chain->segments[s].length;
+    }
+    return s;
+}
+
+PUBLIC void
+buffer_chain_destroy (buffer_chain_t *chain)
+{
+    int s;
+
+    for (s = 0; s < chain->n_segments; s++) {
+        buffer_put(chain->segments[s].buffer);
+    }
+    MEM_MONITOR_FREE(chain->segments);
+    memset(chain, 0, sizeof(buffer_chain_t));
+}
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
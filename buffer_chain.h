@@ -0,0 +1,167 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#ifndef __BUFFER_CHAIN_H__
+#define __BUFFER_CHAIN_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/uio.h>
+
+#include "buffer_manager.h"
+
+/******************************************************************************
+ *
+ * A buffer chain holds a message which may be much bigger than the
+ * largest pool of a buffer manager (or any other message which is
+ * simply made up of pieces), as a list of segments.  Each segment is
+ * a part of a buffer allocated from the buffer manager.  This is the
+ * same idea as BSD mbuf chains.
+ *
+ * Data can be appended to the end (copied into buffers allocated as
+ * needed or by simply referring to already existing buffers), headers
+ * can be prepended to the front (into the unused space in front of the
+ * first segment if there is enough, or a new segment) and the segments
+ * can be given to 'writev' or 'sendmsg' directly as an iovec array, so
+ * the message never has to be copied into one contiguous block.  When
+ * that is really needed (for example to parse a header which straddles
+ * segments), the first so many bytes can be made contiguous on demand
+ * or the whole message can be copied out.
+ *
+ * Every segment holds a reference to its buffer (see 'buffer_get'), so
+ * the same buffer can be in many chains at the same time.  A buffer
+ * with other references is never written into by the chain.
+ *
+ * A chain itself is NOT thread safe, it is meant to be owned by one
+ * thread at a time.  The buffer manager it uses can of course be
+ * shared.
+ *
+ */
+
+typedef struct buffer_segment_s {
+
+    /* the buffer (as returned by 'buffer_allocate') */
+    byte *buffer;
+
+    /* where in the buffer the data of this segment starts & its length */
+    int offset;
+    int length;
+
+} buffer_segment_t;
+
+typedef struct buffer_chain_s {
+
+    /* buffers are allocated from here */
+    buffer_manager_t *bmp;
+
+    /* the segments, in order, and how many there are & can be */
+    buffer_segment_t *segments;
+    int n_segments;
+    int max_segments;
+
+    /* total bytes in the chain */
+    int length;
+
+} buffer_chain_t;
+
+extern int
+buffer_chain_init (buffer_chain_t *chain, buffer_manager_t *bmp);
+
+/*
+ * Copy 'length' bytes of 'data' to the end of the chain.  Returns 0
+ * or ENOMEM, in which case what could be copied stays in the chain.
+ */
+extern int
+buffer_chain_append (buffer_chain_t *chain, void *data, int length);
+
+/*
+ * Add 'length' bytes starting at 'offset' in an already allocated
+ * 'buffer' to the end of the chain, without copying.  The chain takes
+ * its own reference to the buffer.  Returns 0, EINVAL if the range
+ * does not fit in the buffer or ENOMEM.
+ */
+extern int
+buffer_chain_append_buffer (buffer_chain_t *chain,
+    void *buffer, int offset, int length);
+
+/*
+ * Copy a 'length' bytes long header to the front of the chain.  New
+ * buffers for headers are filled from their end, so that any further
+ * headers can be prepended into the same buffer.  Returns 0, EINVAL
+ * if the header is bigger than the biggest pool or ENOMEM.
+ */
+extern int
+buffer_chain_prepend (buffer_chain_t *chain, void *header, int length);
+
+/*
+ * Make the first 'length' bytes of the chain contiguous and return
+ * a pointer to them.  Returns NULL if the chain is shorter than that,
+ * 'length' is bigger than the biggest pool or memory ran out.  Nothing
+ * is copied if the first segment is already long enough.
+ */
+extern void *
+buffer_chain_pullup (buffer_chain_t *chain, int length);
+
+/*
+ * Copy the whole chain into 'dest', which must be big enough to
+ * hold 'chain->length' bytes.  Returns the number of bytes copied.
+ */
+extern int
+buffer_chain_linearize (buffer_chain_t *chain, void *dest);
+
+/*
+ * Fill 'iov' with the segments of the chain, ready for 'writev' or
+ * 'sendmsg'.  Returns how many entries were filled, which is at most
+ * 'max_iov'.  If it is less than 'chain->n_segments', the rest of the
+ * chain did not fit.
+ */
+extern int
+buffer_chain_iovec (buffer_chain_t *chain, struct iovec iov [], int max_iov);
+
+/*
+ * drop all the references the chain holds & free up its memory.
+ * The chain can be re initialized after this.
+ */
+extern void
+buffer_chain_destroy (buffer_chain_t *chain);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif // __BUFFER_CHAIN_H__
+
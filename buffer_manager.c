@@ -33,6 +33,8 @@
 *******************************************************************************
 ******************************************************************************/
 
+#include <limits.h>
+
 #include "buffer_manager.h"
 
 #ifdef __cplusplus
@@ -46,6 +48,199 @@ static debug_module_block_t buffer_manager_debug = {
     .drf = NULL
 };
 
+/*
+ * Drop a reference and return true if it was the last one.  If it is
+ * the only reference, nobody else can be changing the count so there
+ * is no need for the (relatively expensive) atomic decrement.
+ */
+static inline boolean
+buffer_release (buffer_t *bufp, boolean thread_safe)
+{
+    if ((1 == bufp->refcount) || !thread_safe) {
+        return
+            0 == --(bufp->refcount);
+    }
+    return
+        0 == __sync_sub_and_fetch(&bufp->refcount, 1);
+}
+
+/*
+ * Pop a free buffer off the pool.  If the manager is thread safe, this
+ * is done lock free.  Reading the 'next' of a buffer which another
+ * thread has popped meanwhile is harmless, it is still valid memory
+ * and the compare & swap will then fail since the tag has changed.
+ *
+ * In elastic mode, a trim may release whole blocks, so 'pops' tells
+ * the trimmer that somebody may still be reading a 'next' pointer.
+ */
+static inline buffer_t *
+buffer_pool_pop (buffer_pool_t *poolp, boolean thread_safe)
+{
+    buffer_stack_head_t old_head, new_head;
+    boolean guard;
+    buffer_t *bufp;
+
+    if (!thread_safe) {
+        bufp = BUFFER_HEAD_PTR(poolp->head);
+        if (bufp) poolp->head = BUFFER_HEAD_MAKE(bufp->next, 0);
+        return bufp;
+    }
+    guard = poolp->bmp->elastic;
+    if (guard) __sync_fetch_and_add(&poolp->pops, 1);
+    do {
+        old_head = poolp->head;
+        bufp = BUFFER_HEAD_PTR(old_head);
+        if (NULL == bufp) break;
+        new_head = BUFFER_HEAD_MAKE(bufp->next,
+                        BUFFER_HEAD_TAG(old_head) + 1);
+    } while (!__sync_bool_compare_and_swap(&poolp->head,
+                old_head, new_head));
+    if (guard) __sync_fetch_and_sub(&poolp->pops, 1);
+
+    return bufp;
+}
+
+/*
+ * Pop a run of up to 'n' buffers in one go.  The run is walked before
+ * it is owned, but since the header of a buffer is never touched by
+ * the user, a stale 'next' is still a valid buffer (or NULL) and the
+ * compare & swap will fail anyway if anything changed.
+ */
+static inline int
+buffer_pool_pop_run (buffer_pool_t *poolp, boolean thread_safe,
+        void *ptrs [], int n)
+{
+    buffer_stack_head_t old_head, new_head;
+    boolean guard = thread_safe && poolp->bmp->elastic;
+    buffer_t *first, *last;
+    int i, got = 0;
+
+    if (guard) __sync_fetch_and_add(&poolp->pops, 1);
+    do {
+        old_head = poolp->head;
+        first = last = BUFFER_HEAD_PTR(old_head);
+        if (NULL == first) break;
+        for (got = 1; (got < n) && last->next; got++) {
+            last = last->next;
+            __builtin_prefetch(last->next);
+        }
+        new_head = BUFFER_HEAD_MAKE(last->next,
+                        BUFFER_HEAD_TAG(old_head) + 1);
+        if (!thread_safe) {
+            poolp->head = new_head;
+            break;
+        }
+    } while (!__sync_bool_compare_and_swap(&poolp->head,
+                old_head, new_head));
+    if (guard) __sync_fetch_and_sub(&poolp->pops, 1);
+    if (NULL == first) return 0;
+
+    for (i = 0; i < got; i++) {
+        first->refcount = 1;
+        ptrs[i] = &first->data[0];
+        first = first->next;
+    }
+    return got;
+}
+
+/*
+ * push the chain of buffers 'first' thru 'last' (already
+ * linked by their 'next' pointers) back onto the pool
+ */
+static inline void
+buffer_pool_push (buffer_pool_t *poolp, boolean thread_safe,
+        buffer_t *first, buffer_t *last)
+{
+    buffer_stack_head_t old_head, new_head;
+
+    if (!thread_safe) {
+        last->next = BUFFER_HEAD_PTR(poolp->head);
+        poolp->head = BUFFER_HEAD_MAKE(first, 0);
+        return;
+    }
+    do {
+        old_head = poolp->head;
+        last->next = BUFFER_HEAD_PTR(old_head);
+        new_head = BUFFER_HEAD_MAKE(first, BUFFER_HEAD_TAG(old_head) + 1);
+    } while (!__sync_bool_compare_and_swap(&poolp->head,
+                old_head, new_head));
+}
+
+/*
+ * Allocate another block for the pool, carve it up into buffers and
+ * push them all onto the pool in one go.  Must be called with the
+ * manager locked (or while initializing).
+ *
+ * 0 will be returned if successful, else ENOMEM.
+ */
+static int
+buffer_pool_add_block (buffer_pool_t *poolp)
+{
+    buffer_manager_t *bmp = poolp->bmp;
+    int b, i, n_blocks, total_size;
+    buffer_block_t *blocks;
+    buffer_t *first, *bufp = NULL;  /* shut the compiler up */
+    byte *block, *ptr;
+
+    /* find an unused block slot, or make some more */
+    for (b = 0; b < poolp->n_blocks; b++) {
+        if (NULL == poolp->blocks[b].memory) break;
+    }
+    if (b >= poolp->n_blocks) {
+        n_blocks = poolp->n_blocks ? 2 * poolp->n_blocks : 1;
+        blocks = MEM_MONITOR_ZREALLOC(bmp, poolp->blocks,
+                    n_blocks * sizeof(buffer_block_t));
+        if (NULL == blocks) return ENOMEM;
+        poolp->blocks = blocks;
+        poolp->n_blocks = n_blocks;
+    }
+
+    /* allocate the big block */
+    total_size = poolp->actual_buffer_size * poolp->buffer_count;
+    if (bmp->huge_pages) {
+        block = mem_monitor_allocate_huge(bmp->mem_mon_p, total_size);
+    } else {
+        block = MEM_MONITOR_ALLOC(bmp, total_size);
+    }
+
+    /* cannot proceed if so */
+    if (NULL == block) return ENOMEM;
+    poolp->blocks[b].memory = block;
+
+    /* now partition each buffer in the big block */
+    first = (buffer_t*) block;
+    ptr = block;
+    for (i = 0; i < poolp->buffer_count; i++) {
+        bufp = (buffer_t*) ptr;
+        bufp->poolp = poolp;
+        bufp->refcount = 0;
+        bufp->block = b;
+        ptr += poolp->actual_buffer_size;
+        bufp->next = (buffer_t*) ptr;
+    }
+    poolp->total_buffers += poolp->buffer_count;
+
+    /* the last buffer gets linked to whatever is already free */
+    buffer_pool_push(poolp, bmp->lock != NULL, first, bufp);
+
+    return 0;
+}
+
+static void
+buffer_pool_free_block (buffer_pool_t *poolp, int b)
+{
+    buffer_manager_t *bmp = poolp->bmp;
+
+    if (bmp->huge_pages) {
+        mem_monitor_free_huge(bmp->mem_mon_p, poolp->blocks[b].memory,
+            poolp->actual_buffer_size * poolp->buffer_count);
+    } else {
+        MEM_MONITOR_FREE(poolp->blocks[b].memory);
+    }
+    poolp->blocks[b].memory = NULL;
+    poolp->total_buffers -= poolp->buffer_count;
+}
+
 /*
  * initialize a buffer pool with all its buffers.  Each buffer can hold
  * data of size 'size' and there will be 'count' of these buffers
@@ -57,52 +252,231 @@ static debug_module_block_t buffer_manager_debug = {
  *
  * 0 will be returned if successful, else an error code.
  * The only error which can be returned at this stage is if
- * malloc fails, which will be ENOMEM.
+ * malloc fails, which will be ENOMEM.  The pool is then still
+ * valid but empty (an elastic one may still grow later).
  */
 static int
 buffer_manager_pool_init (buffer_manager_t *bmp,
         int pool_number, size_count_tuple_t *tuple)
 {
-    int size = tuple->size;
-    int count = tuple->count;
-    int i, total_size, aligned_data_size, actual_buffer_size;
-    byte *block, *ptr;
-    buffer_t *bufp = NULL;  /* shut the compiler up */
     buffer_pool_t *poolp = &bmp->pools[pool_number];
 
     /* empty the pool first */
     memset(poolp, 0, sizeof(buffer_pool_t));
 
     /* adjusted sizes */
-    aligned_data_size = (size + 7) & ~7;
-    actual_buffer_size = aligned_data_size + sizeof(buffer_t);
-    total_size = actual_buffer_size * count;
+    poolp->bmp = bmp;
+    poolp->specified_size = tuple->size;
+    poolp->actual_buffer_size = ((tuple->size + 7) & ~7) + sizeof(buffer_t);
+    poolp->buffer_count = tuple->count;
+    poolp->low_watermark = tuple->count;
+    poolp->high_watermark = INT_MAX;
+    poolp->head = BUFFER_HEAD_MAKE(NULL, 0);
+
+    return
+        buffer_pool_add_block(poolp);
+}
 
-    /* allocate the big block for the entire pool and fill fields */
-    block = MEM_MONITOR_ALLOC(bmp, total_size);
-    
-    /* cannot proceed if so */
-    if (NULL == block) return ENOMEM;
+static inline void
+buffer_counter_add (volatile unsigned long long *counter,
+        boolean thread_safe, unsigned long long n)
+{
+    if (thread_safe) {
+        __sync_fetch_and_add(counter, n);
+    } else {
+        *counter += n;
+    }
+}
 
-    /* we are ok, fill the rest */
-    poolp->bmp = bmp;
-    poolp->specified_size = size;
-    poolp->actual_buffer_size = actual_buffer_size;
-    poolp->buffer_count = count;
-    poolp->block = block;
-    poolp->head = (buffer_t*) block;
+/*
+ * Keep track of how many buffers are in use & the peak of that, only
+ * for elastic pools or with telemetry.  'n' buffers were allocated
+ * (or freed if negative).
+ */
+static inline void
+buffer_pool_account (buffer_pool_t *poolp, boolean thread_safe, int n)
+{
+    buffer_manager_t *bmp = poolp->bmp;
+    int in_use, peak;
+
+    if ((0 == n) || !(bmp->elastic || bmp->telemetry)) return;
+    if (bmp->telemetry) {
+        if (n > 0) {
+            buffer_counter_add(&poolp->allocations, thread_safe, n);
+        } else {
+            buffer_counter_add(&poolp->frees, thread_safe, -n);
+        }
+    }
+    if (!thread_safe) {
+        poolp->in_use += n;
+        if (poolp->in_use > poolp->peak_in_use) {
+            poolp->peak_in_use = poolp->in_use;
+        }
+        return;
+    }
+    in_use = __sync_add_and_fetch(&poolp->in_use, n);
+    while ((peak = poolp->peak_in_use) < in_use) {
+        if (__sync_bool_compare_and_swap(&poolp->peak_in_use, peak, in_use)) {
+            break;
+        }
+    }
+}
 
-    /* now partition each buffer in the big block */
-    ptr = block;
-    for (i = 0; i < count; i++) {
-        bufp = (buffer_t*) ptr;
-        bufp->poolp = poolp;
-        ptr += actual_buffer_size;
-        bufp->next = (buffer_t*) ptr;
+/*
+ * An elastic pool ran out of buffers.  Grow it by another block unless
+ * another thread has meanwhile done so (or freed some buffers into it)
+ * or it would go above its high watermark.  Returns 0 if the allocation
+ * should be retried from the same pool.
+ */
+static int
+buffer_pool_grow (buffer_pool_t *poolp)
+{
+    buffer_manager_t *bmp = poolp->bmp;
+    int rc = 0;
+
+    OBJ_WRITE_LOCK(bmp);
+    if (NULL == BUFFER_HEAD_PTR(poolp->head)) {
+        poolp->exhaustions++;
+        if (poolp->total_buffers + poolp->buffer_count >
+                poolp->high_watermark) {
+            rc = ENOSPC;
+        } else {
+            rc = buffer_pool_add_block(poolp);
+            if (0 == rc) poolp->grows++;
+        }
+    }
+    OBJ_WRITE_UNLOCK(bmp);
+
+    return rc;
+}
+
+/*
+ * Same idea as the lock free trimming of chunk_manager.  The whole
+ * stack is taken off, the free buffers of each block are counted, the
+ * blocks which can go are marked (by an 'n_free' of -1), the buffers of
+ * all the other blocks are put back and then the marked blocks are
+ * released.  Must be called with the manager locked.
+ */
+static int
+buffer_pool_trim (buffer_pool_t *poolp)
+{
+    boolean thread_safe = poolp->bmp->lock != NULL;
+    buffer_block_t *blocks = poolp->blocks;
+    buffer_stack_head_t old_head;
+    buffer_t *bufp, *next, *kept, *last_kept;
+    int b, remaining, released = 0;
+
+    old_head = poolp->head;
+    if (thread_safe) {
+        while (!__sync_bool_compare_and_swap(&poolp->head, old_head,
+                    BUFFER_HEAD_MAKE(NULL, BUFFER_HEAD_TAG(old_head) + 1))) {
+            old_head = poolp->head;
+        }
+        while (poolp->pops) sched_yield();
+    } else {
+        poolp->head = BUFFER_HEAD_MAKE(NULL, 0);
     }
 
-    /* last buffer */
-    bufp->next = NULL;
+    for (b = 0; b < poolp->n_blocks; b++) blocks[b].n_free = 0;
+    for (bufp = BUFFER_HEAD_PTR(old_head); bufp; bufp = bufp->next) {
+        blocks[bufp->block].n_free++;
+    }
+
+    remaining = poolp->total_buffers;
+    for (b = 0; b < poolp->n_blocks; b++) {
+        if (blocks[b].memory &&
+            (blocks[b].n_free == poolp->buffer_count) &&
+            (remaining - poolp->buffer_count >= poolp->low_watermark)) {
+                blocks[b].n_free = -1;
+                remaining -= poolp->buffer_count;
+        }
+    }
+
+    kept = last_kept = NULL;
+    for (bufp = BUFFER_HEAD_PTR(old_head); bufp; bufp = next) {
+        next = bufp->next;
+        if (blocks[bufp->block].n_free < 0) continue;
+        bufp->next = kept;
+        kept = bufp;
+        if (NULL == last_kept) last_kept = bufp;
+    }
+    if (kept) buffer_pool_push(poolp, thread_safe, kept, last_kept);
+
+    for (b = 0; b < poolp->n_blocks; b++) {
+        if (blocks[b].n_free < 0) {
+            buffer_pool_free_block(poolp, b);
+            released++;
+        }
+    }
+    poolp->shrinks += released;
+
+    return released;
+}
+
+/*
+ * The smallest size a request must have to fall in the range of pool
+ * 'p' is one more than this.
+ */
+static inline int
+buffer_pool_lower_size (buffer_manager_t *bmp, int p)
+{
+    return
+        p ? bmp->pools[p - 1].specified_size : -1;
+}
+
+/*
+ * the biggest requested size which is recorded in bucket 'b' of pool 'p'
+ */
+static int
+buffer_bucket_max_size (buffer_manager_t *bmp, int p, int b)
+{
+    long long lower = buffer_pool_lower_size(bmp, p);
+    long long width = bmp->pools[p].specified_size - lower;
+
+    return
+        lower + 1 + (((b + 1) * width) - 1) / BUFFER_HISTOGRAM_BUCKETS;
+}
+
+/*
+ * record the request of 'n' buffers of 'size' of which 'failed' could
+ * not be allocated, against the pool whose range the size is in
+ */
+static void
+buffer_record_request (buffer_manager_t *bmp, int size, int n, int failed)
+{
+    boolean thread_safe = bmp->lock != NULL;
+    buffer_pool_t *poolp;
+
+    if (NULL == bmp->size_bucket_table) return;
+    poolp = &bmp->pools[bmp->size_lookup_table[size]];
+    buffer_counter_add(&poolp->histogram[bmp->size_bucket_table[size]],
+        thread_safe, n);
+    if (failed) buffer_counter_add(&poolp->failures, thread_safe, failed);
+}
+
+static int
+buffer_manager_bucket_table_init (buffer_manager_t *bmp)
+{
+    int p, idx;
+    long long lower, width;
+
+    bmp->size_bucket_table = MEM_MONITOR_ALLOC(bmp, bmp->max_size + 1);
+    if (NULL == bmp->size_bucket_table) {
+        ERROR(&buffer_manager_debug,
+            "allocating %d bytes for buffer manager histogram failed\n",
+            bmp->max_size + 1);
+        return ENOMEM;
+    }
+
+    idx = 0;
+    for (p = 0; p < bmp->num_pools; p++) {
+        lower = buffer_pool_lower_size(bmp, p);
+        width = bmp->pools[p].specified_size - lower;
+        for (; idx <= bmp->pools[p].specified_size; idx++) {
+            bmp->size_bucket_table[idx] =
+                ((idx - lower - 1) * BUFFER_HISTOGRAM_BUCKETS) / width;
+        }
+    }
 
     return 0;
 }
@@ -112,11 +486,12 @@ buffer_manager_lookup_table_init (buffer_manager_t *bmp)
 {
     int p, idx;
 
-    bmp->size_lookup_table = MEM_MONITOR_ALLOC(bmp, bmp->max_size);
+    /* sizes 0 thru max_size inclusive */
+    bmp->size_lookup_table = MEM_MONITOR_ALLOC(bmp, bmp->max_size + 1);
     if (NULL == bmp->size_lookup_table) {
         ERROR(&buffer_manager_debug,
             "allocating %d bytes for buffer manager size lookup array failed\n",
-            bmp->max_size);
+            bmp->max_size + 1);
         return ENOMEM;
     }
 
@@ -131,8 +506,8 @@ buffer_manager_lookup_table_init (buffer_manager_t *bmp)
 }
 
 PUBLIC int
-buffer_manager_initialize (buffer_manager_t *bmp,
-        boolean make_it_thread_safe,
+buffer_manager_initialize_options (buffer_manager_t *bmp,
+        boolean make_it_thread_safe, int options,
         size_count_tuple_t tuples [],
         mem_monitor_t *parent_mem_monitor)
 {
@@ -215,6 +590,9 @@ buffer_manager_initialize (buffer_manager_t *bmp,
 
     /* set the total number of available pools */
     bmp->num_pools = pcnt;
+    bmp->huge_pages = (options & BUFFER_MANAGER_HUGE_PAGES) != 0;
+    bmp->elastic = (options & BUFFER_MANAGER_ELASTIC) != 0;
+    bmp->telemetry = (options & BUFFER_MANAGER_TELEMETRY) != 0;
 
     /*
      * set the buffer size of the pool with the largest buffer size, 
@@ -231,28 +609,39 @@ buffer_manager_initialize (buffer_manager_t *bmp,
     }
 
     /* now initialize the size -> pool lookup table for fast allocation */
-    buffer_manager_lookup_table_init(bmp);
+    if ((0 == buffer_manager_lookup_table_init(bmp)) && bmp->telemetry) {
+        buffer_manager_bucket_table_init(bmp);
+    }
 
     OBJ_WRITE_UNLOCK(bmp);
 
     return 0;
 }
 
+PUBLIC int
+buffer_manager_initialize (buffer_manager_t *bmp,
+        boolean make_it_thread_safe,
+        size_count_tuple_t tuples [],
+        mem_monitor_t *parent_mem_monitor)
+{
+    return
+        buffer_manager_initialize_options(bmp, make_it_thread_safe, 0,
+            tuples, parent_mem_monitor);
+}
+
 PUBLIC void*
 buffer_allocate (buffer_manager_t *bmp, int size)
 {
+    boolean thread_safe = bmp->lock != NULL;
     int p;
     buffer_pool_t *poolp;
     buffer_t *bufp;
-    void *data = NULL;
 
     /* no such buffers */
     if ((size < 0) || (size > bmp->max_size)) {
         return NULL;
     }
 
-    OBJ_WRITE_LOCK(bmp);
-
     /*
      * pools are ordered based on size so that if a
      * particular sized pool is exhausted, a buffer is
@@ -261,47 +650,353 @@ buffer_allocate (buffer_manager_t *bmp, int size)
      * lookup table.  However, if the lookup table was not
      * allocated (usually due to malloc failure), then we
      * start from the first pool (0).
+     *
+     * No lock is needed, even if thread safe, since each
+     * pool is lock free by itself.
      */
     p = (bmp->size_lookup_table) ? bmp->size_lookup_table[size] : 0;
     while (p < bmp->num_pools) {
         poolp = &bmp->pools[p];
-        if ((size <= poolp->specified_size) && poolp->head) {
-            bufp = poolp->head;
-            poolp->head = bufp->next;
-            data = &bufp->data[0];
-            break;
+        if (size <= poolp->specified_size) {
+            bufp = buffer_pool_pop(poolp, thread_safe);
+            if (bufp) {
+                bufp->refcount = 1;
+                buffer_pool_account(poolp, thread_safe, 1);
+                if (bmp->telemetry) buffer_record_request(bmp, size, 1, 0);
+                return &bufp->data[0];
+            }
+
+            /* an elastic pool may grow rather than spill over */
+            if (bmp->elastic && (0 == buffer_pool_grow(poolp))) continue;
         }
         p++;
     }
 
-    OBJ_WRITE_UNLOCK(bmp);
-    return data;
+    if (bmp->telemetry) buffer_record_request(bmp, size, 1, 1);
+    return NULL;
+}
+
+PUBLIC int
+buffer_allocate_bulk (buffer_manager_t *bmp, int size, void *ptrs [], int n)
+{
+    boolean thread_safe = bmp->lock != NULL;
+    int p, run, got = 0;
+    buffer_pool_t *poolp;
+
+    if ((size < 0) || (size > bmp->max_size)) return 0;
+
+    /* same as above but whole runs are taken off each pool */
+    p = (bmp->size_lookup_table) ? bmp->size_lookup_table[size] : 0;
+    while ((p < bmp->num_pools) && (got < n)) {
+        poolp = &bmp->pools[p];
+        if (size <= poolp->specified_size) {
+            run = buffer_pool_pop_run(poolp, thread_safe,
+                        &ptrs[got], n - got);
+            buffer_pool_account(poolp, thread_safe, run);
+            got += run;
+            if ((got < n) && bmp->elastic &&
+                (0 == buffer_pool_grow(poolp))) {
+                    continue;
+            }
+        }
+        p++;
+    }
+
+    if (bmp->telemetry) buffer_record_request(bmp, size, n, n - got);
+    return got;
+}
+
+PUBLIC void
+buffer_put (void *ptr)
+{
+    buffer_t *bufp = buffer_of(ptr);
+    boolean thread_safe = bufp->poolp->bmp->lock != NULL;
+
+    if (buffer_release(bufp, thread_safe)) {
+        buffer_pool_account(bufp->poolp, thread_safe, -1);
+        buffer_pool_push(bufp->poolp, thread_safe, bufp, bufp);
+    }
 }
 
 PUBLIC void
 buffer_free (void *ptr)
 {
-    byte *bptr = ((byte*) ptr) - (int) (sizeof(buffer_t));
-    buffer_t *bufp = (buffer_t*) bptr;
+    buffer_put(ptr);
+}
 
-    OBJ_WRITE_LOCK(bufp->poolp->bmp);
-    bufp->next = bufp->poolp->head;
-    bufp->poolp->head = bufp;
-    OBJ_WRITE_UNLOCK(bufp->poolp->bmp);
+PUBLIC void
+buffer_get (void *ptr)
+{
+    buffer_t *bufp = buffer_of(ptr);
+
+    if (bufp->poolp->bmp->lock) {
+        __sync_fetch_and_add(&bufp->refcount, 1);
+    } else {
+        (bufp->refcount)++;
+    }
+}
+
+PUBLIC void *
+buffer_clone (void *ptr)
+{
+    buffer_get(ptr);
+    return ptr;
+}
+
+PUBLIC int
+buffer_slice (void *ptr, int offset, int length, buffer_slice_t *slice)
+{
+    buffer_t *bufp = buffer_of(ptr);
+
+    if ((offset < 0) || (length < 0) ||
+        (offset + length > bufp->poolp->specified_size)) {
+            return EINVAL;
+    }
+    buffer_get(ptr);
+    slice->data = ((byte*) ptr) + offset;
+    slice->length = length;
+    slice->buffer = ptr;
+
+    return 0;
+}
+
+/*
+ * consecutive buffers of the same pool whose last reference is
+ * dropped are linked together and pushed back onto their pool as
+ * one run.
+ */
+PUBLIC void
+buffer_free_bulk (void *ptrs [], int n)
+{
+    buffer_t *first, *last, *bufp;
+    boolean thread_safe;
+    int i = 0, run;
+
+    while (i < n) {
+        bufp = buffer_of(ptrs[i++]);
+        thread_safe = bufp->poolp->bmp->lock != NULL;
+        if (!buffer_release(bufp, thread_safe)) continue;
+        first = last = bufp;
+        for (run = 1; i < n; i++) {
+            if (i + 1 < n) __builtin_prefetch(buffer_of(ptrs[i + 1]), 1);
+            bufp = buffer_of(ptrs[i]);
+            if (bufp->poolp != first->poolp) break;
+            if (!buffer_release(bufp, thread_safe)) continue;
+            last->next = bufp;
+            last = bufp;
+            run++;
+        }
+        buffer_pool_account(first->poolp, thread_safe, -run);
+        buffer_pool_push(first->poolp, thread_safe, first, last);
+    }
+}
+
+PUBLIC int
+buffer_manager_set_watermarks (buffer_manager_t *bmp, int pool,
+        int low_watermark, int high_watermark)
+{
+    if ((pool < 0) || (pool >= bmp->num_pools) ||
+        (low_watermark < 0) || (high_watermark < low_watermark)) {
+            return EINVAL;
+    }
+    OBJ_WRITE_LOCK(bmp);
+    bmp->pools[pool].low_watermark = low_watermark;
+    bmp->pools[pool].high_watermark = high_watermark;
+    OBJ_WRITE_UNLOCK(bmp);
+
+    return 0;
+}
+
+PUBLIC int
+buffer_manager_trim (buffer_manager_t *bmp)
+{
+    int p, released = 0;
+
+    if (!bmp->elastic) return 0;
+    OBJ_WRITE_LOCK(bmp);
+    for (p = 0; p < bmp->num_pools; p++) {
+        released += buffer_pool_trim(&bmp->pools[p]);
+    }
+    OBJ_WRITE_UNLOCK(bmp);
+
+    return released;
+}
+
+PUBLIC int
+buffer_manager_pool_stats (buffer_manager_t *bmp, int pool,
+        buffer_pool_stats_t *stats)
+{
+    buffer_pool_t *poolp;
+    int b;
+
+    if (!bmp->telemetry || (pool < 0) || (pool >= bmp->num_pools)) {
+        return EINVAL;
+    }
+    poolp = &bmp->pools[pool];
+    memset(stats, 0, sizeof(buffer_pool_stats_t));
+    stats->size = poolp->specified_size;
+    stats->total_buffers = poolp->total_buffers;
+    stats->in_use = poolp->in_use;
+    stats->peak_in_use = poolp->peak_in_use;
+    stats->allocations = poolp->allocations;
+    stats->frees = poolp->frees;
+    stats->failures = poolp->failures;
+    for (b = 0; b < BUFFER_HISTOGRAM_BUCKETS; b++) {
+        stats->histogram[b] = poolp->histogram[b];
+        stats->requests += stats->histogram[b];
+        stats->wasted_bytes += stats->histogram[b] *
+            (poolp->specified_size - buffer_bucket_max_size(bmp, pool, b));
+    }
+
+    return 0;
+}
+
+PUBLIC int
+buffer_manager_export_histogram (buffer_manager_t *bmp,
+        buffer_size_sample_t samples [], int max_samples)
+{
+    int p, b, n = 0;
+
+    if (!bmp->telemetry) return 0;
+    for (p = 0; p < bmp->num_pools; p++) {
+        for (b = 0; b < BUFFER_HISTOGRAM_BUCKETS; b++) {
+            if (0 == bmp->pools[p].histogram[b]) continue;
+            if (n >= max_samples) return n;
+            samples[n].size = buffer_bucket_max_size(bmp, p, b);
+            samples[n].count = bmp->pools[p].histogram[b];
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Classic dynamic programming.  'cost [k][j]' is the least number of
+ * bytes wasted when the samples 0 thru j are served by k + 1 pools,
+ * the last of which is of size 'sizes [j]'.  With prefix sums of the
+ * counts & the bytes, the waste of serving samples i thru j by one
+ * pool is found in constant time.
+ */
+PUBLIC int
+buffer_manager_suggest_tuples (buffer_size_sample_t samples [],
+        int n_samples, int n_pools, int total_count,
+        size_count_tuple_t tuples [])
+{
+    int i, j, k, n, size, n_tiers, *sizes = NULL, *choice = NULL;
+    double *counts = NULL, *bytes = NULL, *cost = NULL;
+    double waste, tier_count, total;
+    int rc = 0;
+
+    if ((n_samples < 0) || (n_pools < 1) || (total_count < 1)) {
+        return EINVAL;
+    }
+
+    /* prefix sums are 1 longer than the samples */
+    sizes = malloc((n_samples + 1) * sizeof(int));
+    counts = malloc((n_samples + 1) * sizeof(double));
+    bytes = malloc((n_samples + 1) * sizeof(double));
+    if ((NULL == sizes) || (NULL == counts) || (NULL == bytes)) {
+        rc = ENOMEM;
+        goto DONE;
+    }
+
+    /* drop the empty samples & check the order */
+    counts[0] = bytes[0] = 0;
+    n = 0;
+    for (i = 0; i < n_samples; i++) {
+        if (0 == samples[i].count) continue;
+        size = (samples[i].size < 1) ? 1 : samples[i].size;
+        if (n && (size < sizes[n - 1])) {
+            rc = EINVAL;
+            goto DONE;
+        }
+        if (n && (size == sizes[n - 1])) {
+            counts[n] += samples[i].count;
+            bytes[n] += (double) samples[i].count * size;
+            continue;
+        }
+        sizes[n] = size;
+        counts[n + 1] = counts[n] + samples[i].count;
+        bytes[n + 1] = bytes[n] + (double) samples[i].count * size;
+        n++;
+    }
+    if (0 == n) {
+        rc = EINVAL;
+        goto DONE;
+    }
+
+    n_tiers = (n_pools < n) ? n_pools : n;
+    cost = malloc(n_tiers * n * sizeof(double));
+    choice = malloc(n_tiers * n * sizeof(int));
+    if ((NULL == cost) || (NULL == choice)) {
+        rc = ENOMEM;
+        goto DONE;
+    }
+
+#define WASTE(i, j) \
+    ((sizes[j] * (counts[(j) + 1] - counts[i])) - \
+        (bytes[(j) + 1] - bytes[i]))
+
+    for (j = 0; j < n; j++) {
+        cost[j] = WASTE(0, j);
+        choice[j] = -1;
+    }
+    for (k = 1; k < n_tiers; k++) {
+        for (j = k; j < n; j++) {
+            cost[k*n + j] = -1;
+            for (i = k - 1; i < j; i++) {
+                waste = cost[(k-1)*n + i] + WASTE(i + 1, j);
+                if ((cost[k*n + j] < 0) || (waste < cost[k*n + j])) {
+                    cost[k*n + j] = waste;
+                    choice[k*n + j] = i;
+                }
+            }
+        }
+    }
+
+#undef WASTE
+
+    /* walk back from the biggest size, filling the tuples backwards */
+    total = counts[n];
+    tuples[n_tiers].size = tuples[n_tiers].count = -1;
+    j = n - 1;
+    for (k = n_tiers - 1; k >= 0; k--) {
+        i = choice[k*n + j];
+        tier_count = (counts[j + 1] - counts[i + 1]) * total_count / total;
+        tuples[k].size = sizes[j];
+        tuples[k].count = (tier_count < 1) ? 1 : (int) (tier_count + 0.5);
+        j = i;
+    }
+
+DONE:
+    free(sizes);
+    free(counts);
+    free(bytes);
+    free(cost);
+    free(choice);
+
+    return rc;
 }
 
 PUBLIC void
 buffer_manager_destroy (buffer_manager_t *bmp)
 {
-    int i;
+    int i, b;
     buffer_pool_t *pools = (buffer_pool_t*) bmp->pools;
 
     OBJ_WRITE_LOCK(bmp);
     for (i = 0; i < bmp->num_pools; i++) {
-        MEM_MONITOR_FREE(pools[i].block);
-        memset(&pools[i].block, 0, sizeof(buffer_pool_t));
+        for (b = 0; b < pools[i].n_blocks; b++) {
+            if (pools[i].blocks[b].memory) {
+                buffer_pool_free_block(&pools[i], b);
+            }
+        }
+        if (pools[i].blocks) MEM_MONITOR_FREE(pools[i].blocks);
+        memset(&pools[i], 0, sizeof(buffer_pool_t));
     }
     MEM_MONITOR_FREE(bmp->size_lookup_table);
+    MEM_MONITOR_FREE(bmp->size_bucket_table);
     OBJ_WRITE_UNLOCK(bmp);
     LOCK_OBJ_DESTROY(bmp);
     memset(bmp, 0, sizeof(*bmp));
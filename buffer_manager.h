@@ -82,6 +82,7 @@
 #include "common.h"
 #include "mem_monitor_object.h"
 #include "lock_object.h"
+#include "tagged_head.h"
 #include "debug_framework.h"
 
 #ifdef __cplusplus
@@ -115,6 +116,10 @@ typedef struct buffer_manager_s buffer_manager_t;
  * a very fast free operation to simply re-insert it to the head
  * of the free list of that pool.
  *
+ * 'refcount' is how many references there are to an allocated buffer.
+ * It starts at 1 when the buffer is allocated and the buffer goes back
+ * to its pool only when it drops to 0 (see 'buffer_get' & 'buffer_put').
+ *
  * Note that user does NOT see or need anything before 'data'.
  */
 struct buffer_s {
@@ -125,6 +130,12 @@ struct buffer_s {
     /* next free buffer in the list (used for allocating) */
     buffer_t *next;
 
+    /* how many references are held to this buffer */
+    volatile int refcount;
+
+    /* which block of its pool this buffer was carved from */
+    int block;
+
     /*
      * This is what the user sees, ONLY,
      * an 8 byte aligned buffer of memory
@@ -132,6 +143,34 @@ struct buffer_s {
     unsigned char data [0] __attribute__((aligned(8)));
 };
 
+/*
+ * Head of the free buffers stack of a pool, a pointer and an ABA tag,
+ * shared with the lock free chunk manager (see tagged_head.h)
+ */
+typedef tagged_head_t buffer_stack_head_t;
+
+#define BUFFER_HEAD_PTR(h) \
+    ((buffer_t*) TAGGED_HEAD_PTR(h))
+#define BUFFER_HEAD_TAG(h)          TAGGED_HEAD_TAG(h)
+#define BUFFER_HEAD_MAKE(ptr, tag)  TAGGED_HEAD_MAKE(ptr, tag)
+
+/*
+ * A big block of memory carved up into the buffers of a pool.
+ * 'n_free' is only used while trimming.
+ */
+typedef struct buffer_block_s {
+
+    void *memory;
+    int n_free;
+
+} buffer_block_t;
+
+/*
+ * how many buckets the requested sizes of each pool are recorded into
+ * when telemetry is on
+ */
+#define BUFFER_HISTOGRAM_BUCKETS        16
+
 /*
  * Defines ONE memory pool
  */
@@ -154,21 +193,79 @@ struct buffer_pool_s {
      */
     int actual_buffer_size;
 
-    /* how many buffers this particular pool has */
+    /* how many buffers each block of this pool has */
     int buffer_count;
 
     /*
-     * The entire malloced block for this pool.
-     * When destroying a pool, the entire set of
-     * buffers can be destroyed just by freeing this single
-     * block.  One does not have to free traversing
-     * any lists, one buffer at a time.
+     * The malloced blocks of this pool, each holding 'buffer_count'
+     * buffers.  A pool starts with one block and only elastic pools
+     * ever have more.  Unused slots have a NULL 'memory'.
+     * When destroying a pool, the entire set of buffers can be
+     * destroyed just by freeing the blocks.  One does not have to
+     * free traversing any lists, one buffer at a time.
      */
-    void *block;
+    buffer_block_t *blocks;
+    int n_blocks;
 
-    /* linked list of all the buffers */
-    buffer_t *head;
-};
+    /*
+     * only when elastic; the pool grows a block at a time when it runs
+     * out of buffers, as long as it does not end up having more than
+     * 'high_watermark' buffers.  Trimming releases completely unused
+     * blocks as long as at least 'low_watermark' buffers remain.
+     */
+    int low_watermark;
+    int high_watermark;
+
+    /* how many buffers all the blocks have in total */
+    int total_buffers;
+
+    /*
+     * Statistics, only maintained when elastic (or with telemetry for
+     * 'peak_in_use').  Most buffers in use at the same time, how many
+     * times the pool ran out of buffers, how many blocks it grew by and
+     * how many were trimmed.
+     */
+    int peak_in_use;
+    unsigned long long exhaustions;
+    unsigned long long grows;
+    unsigned long long shrinks;
+
+    /*
+     * Stack of all the free buffers.  If the buffer manager is thread
+     * safe, it is popped & pushed with compare & swap and the manager
+     * lock is never taken, so threads using different pools never
+     * contend with each other.  A popping thread may look at a buffer
+     * another thread has just popped, which is harmless since the tag
+     * takes care of that and the buffer is still valid memory.  Blocks
+     * of elastic pools can go back to the OS though, so there 'pops'
+     * keeps track of how many threads are in the middle of popping and
+     * trimming waits for them.  It is in a cache line of its own (with
+     * the other counters which change at every allocation) so that busy
+     * pools do not slow down their neighbours either.
+     */
+    volatile buffer_stack_head_t head
+        __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile int pops;
+
+    /* how many buffers are in use right now, elastic or telemetry */
+    volatile int in_use;
+
+    /* telemetry only, buffers allocated from & freed back to this pool */
+    volatile unsigned long long allocations;
+    volatile unsigned long long frees;
+
+    /*
+     * Telemetry only.  These are for the requests whose size falls in
+     * this pool's range (above the size of the previous pool), even if
+     * they end up being served by a bigger pool: how many of them could
+     * not be served at all and a histogram of the sizes requested.
+     * The range is split equally between the buckets.
+     */
+    volatile unsigned long long failures
+        __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile unsigned long long histogram [BUFFER_HISTOGRAM_BUCKETS];
+
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
 /*
  * Adjust this to taste, but dont be
@@ -187,6 +284,15 @@ struct buffer_manager_s {
     /* how many pools are in this buffer manager */
     int num_pools;
 
+    /* are pool blocks backed by huge pages */
+    boolean huge_pages;
+
+    /* do pools grow & shrink */
+    boolean elastic;
+
+    /* are allocations recorded */
+    boolean telemetry;
+
     /* the buffer size of the pool with the largest buffer size */
     int max_size;
 
@@ -196,10 +302,31 @@ struct buffer_manager_s {
      */
     byte *size_lookup_table;
 
+    /* same idea, size -> histogram bucket, only with telemetry */
+    byte *size_bucket_table;
+
     /* The array of pools for this memory allocator */
     buffer_pool_t pools [MAX_POOLS];
 };
 
+/*
+ * The header of a buffer, given what 'buffer_allocate' returned
+ */
+static inline buffer_t *
+buffer_of (void *ptr)
+{
+    return
+        (buffer_t*) (((byte*) ptr) - sizeof(buffer_t));
+}
+
+/*
+ * How many bytes of the buffer can actually be used, which may be
+ * more than was asked for, if it came from a bigger pool.
+ */
+static inline int
+buffer_capacity (void *ptr)
+{ return buffer_of(ptr)->poolp->specified_size; }
+
 /*
  * Initialize the buffer pools
  */
@@ -209,12 +336,205 @@ buffer_manager_initialize (buffer_manager_t *bmp,
         size_count_tuple_t tuples [],
         mem_monitor_t *parent_mem_monitor);
 
+/*
+ * Options for 'buffer_manager_initialize_options'.
+ *
+ * HUGE_PAGES backs the big block of each pool by huge pages (see
+ * 'mem_monitor_allocate_huge'), which avoids lots of TLB misses when
+ * the pools are big.  If huge pages are not available, normal pages
+ * are used transparently.
+ *
+ * ELASTIC makes every pool grow by another block of 'count' buffers
+ * (as given in its tuple) whenever it runs out, instead of falling
+ * back to the next bigger pool.  Blocks whose buffers are all unused
+ * are released back to the OS by 'buffer_manager_trim'.  By default a
+ * pool can grow without limits and never shrinks below its original
+ * count, see 'buffer_manager_set_watermarks' to change that.
+ *
+ * TELEMETRY keeps per pool allocation counters and a histogram of the
+ * requested sizes, see 'buffer_manager_pool_stats'.  It costs a few
+ * (atomic if thread safe) increments per allocation & free.
+ */
+#define BUFFER_MANAGER_HUGE_PAGES       0x1
+#define BUFFER_MANAGER_ELASTIC          0x2
+#define BUFFER_MANAGER_TELEMETRY        0x4
+
+extern int
+buffer_manager_initialize_options (buffer_manager_t *bmp,
+        bool make_it_thread_safe, int options,
+        size_count_tuple_t tuples [],
+        mem_monitor_t *parent_mem_monitor);
+
+/*
+ * Allocated buffers are reference counted so that the same data can
+ * be handed to many consumers without being copied.  A freshly
+ * allocated buffer has one reference.  'buffer_free' simply drops a
+ * reference, so a buffer which is never shared behaves exactly like
+ * a plain buffer.
+ */
 extern void *
 buffer_allocate (buffer_manager_t *bmp, int size);
 
 extern void
 buffer_free (void *ptr);
 
+/*
+ * take an extra reference to / drop a reference of an allocated
+ * buffer.  The buffer goes back to its pool when the last reference
+ * is dropped.  If the buffer manager is thread safe, these are atomic.
+ * 'ptr' must be what 'buffer_allocate' returned, not a pointer into
+ * the middle of the buffer.  'buffer_put' is the same as 'buffer_free'.
+ */
+extern void
+buffer_get (void *ptr);
+
+extern void
+buffer_put (void *ptr);
+
+/*
+ * Returns another reference to the very same data, without copying
+ * anything.  Neither the original nor the clone should be written to
+ * while both are in use.  Each must be released with 'buffer_put'.
+ */
+extern void *
+buffer_clone (void *ptr);
+
+/*
+ * A zero copy view of 'length' bytes starting at 'offset' bytes into
+ * an allocated buffer.  The slice holds its own reference to the whole
+ * underlying buffer which must be dropped by 'buffer_slice_put'.
+ */
+typedef struct buffer_slice_s {
+
+    /* where the slice starts & how long it is */
+    void *data;
+    int length;
+
+    /* the buffer the slice is a part of (as returned to the user) */
+    void *buffer;
+
+} buffer_slice_t;
+
+/*
+ * 0 is returned if successful or EINVAL if the range does not fit in
+ * the buffer.  To slice a slice, simply slice its 'buffer' with an
+ * offset relative to it.
+ */
+extern int
+buffer_slice (void *ptr, int offset, int length, buffer_slice_t *slice);
+
+static inline void
+buffer_slice_put (buffer_slice_t *slice)
+{ buffer_put(slice->buffer); }
+
+/*
+ * Allocate up to 'n' buffers of 'size' at once into 'ptrs'.  Whole
+ * runs of buffers are taken off a pool at a time (with a single
+ * compare & swap if thread safe).  Just like 'buffer_allocate',
+ * bigger pools are used if the right sized one runs out.  Returns how
+ * many buffers were actually allocated.
+ */
+extern int
+buffer_allocate_bulk (buffer_manager_t *bmp, int size, void *ptrs [], int n);
+
+/*
+ * Free 'n' buffers at once.  Consecutive buffers belonging to the
+ * same pool are returned to it in one go, so freeing buffers of the
+ * same size together is the fastest.
+ */
+extern void
+buffer_free_bulk (void *ptrs [], int n);
+
+/*
+ * For elastic managers, 'pool' (the index of its tuple at
+ * initialization) will not grow beyond 'high_watermark' buffers and
+ * trimming will not shrink it below 'low_watermark' buffers.  Returns
+ * 0 or EINVAL if the pool does not exist or the watermarks make no
+ * sense.
+ */
+extern int
+buffer_manager_set_watermarks (buffer_manager_t *bmp, int pool,
+        int low_watermark, int high_watermark);
+
+/*
+ * For elastic managers, release the blocks of every pool whose buffers
+ * are all unused back to the OS, respecting the low watermarks.  While
+ * a pool is being trimmed, its allocations wait for it to finish.  Meant
+ * to be called every now & then, for example from a background thread.
+ * Returns the number of blocks released.
+ */
+extern int
+buffer_manager_trim (buffer_manager_t *bmp);
+
+/*
+ * A snapshot of the telemetry of one pool.  'requests' is the total of
+ * the histogram.  'wasted_bytes' is how many bytes (at least) were
+ * allocated but not asked for by those requests, assuming they were
+ * all served by this pool, which is the internal fragmentation.
+ */
+typedef struct buffer_pool_stats_s {
+
+    int size;
+    int total_buffers;
+    int in_use;
+    int peak_in_use;
+    unsigned long long allocations;
+    unsigned long long frees;
+    unsigned long long failures;
+    unsigned long long requests;
+    unsigned long long wasted_bytes;
+    unsigned long long histogram [BUFFER_HISTOGRAM_BUCKETS];
+
+} buffer_pool_stats_t;
+
+/*
+ * Fills in 'stats' for 'pool' (the index of its tuple at
+ * initialization).  Returns 0, or EINVAL if the pool does not exist
+ * or telemetry is not on.  The counters are read while they may be
+ * changing so they may not be exactly consistent with each other.
+ */
+extern int
+buffer_manager_pool_stats (buffer_manager_t *bmp, int pool,
+        buffer_pool_stats_t *stats);
+
+/*
+ * One point of a recorded size histogram; 'count' requests were made
+ * for sizes no bigger than 'size' (& bigger than the previous point).
+ */
+typedef struct buffer_size_sample_s {
+
+    int size;
+    unsigned long long count;
+
+} buffer_size_sample_t;
+
+/*
+ * Export the requested size histogram of all the pools of a manager
+ * with telemetry into 'samples', in increasing order of size.  Empty
+ * buckets are skipped.  Returns how many samples were written, which
+ * is never more than 'max_samples'.
+ */
+extern int
+buffer_manager_export_histogram (buffer_manager_t *bmp,
+        buffer_size_sample_t samples [], int max_samples);
+
+/*
+ * Given a recorded histogram (increasing in size), suggest the tuples
+ * for at most 'n_pools' pools, which serve all of the samples with the
+ * least possible internal fragmentation.  'total_count' buffers are
+ * distributed between the pools in proportion to how many requests
+ * each gets, at least 1 each.  'tuples' must have space for
+ * 'n_pools' + 1 entries and is terminated just like what
+ * 'buffer_manager_initialize' expects.
+ *
+ * Returns 0, EINVAL if the parameters make no sense (including no
+ * samples with a non zero count) or ENOMEM.
+ */
+extern int
+buffer_manager_suggest_tuples (buffer_size_sample_t samples [],
+        int n_samples, int n_pools, int total_count,
+        size_count_tuple_t tuples []);
+
 extern void
 buffer_manager_destroy (buffer_manager_t *bmp);
 
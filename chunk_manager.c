@@ -33,39 +33,41 @@
 *******************************************************************************
 ******************************************************************************/
 
+#include <limits.h>
+
 #include "chunk_manager.h"
 
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /*
- * Variable sized chunk header.
- * Each chunk is added to a linked list (of free chunks) on the
- * main structure.
+ * Chunks carry no header at all.  While a chunk is free, its first
+ * bytes are used to link it into the free lists.  Once allocated, the
+ * whole chunk belongs to the user.
  */
 struct chunk_header_s {
 
-    /*
-     * The chunk group I belong to so that when I am freed up,
-     * I will return to the same group.
-     */
-    chunk_group_t *my_group;
-
     /* next free chunk */
     chunk_header_t *next_chunk_header;
 
-    /*
-     * this is what is returned back to the user and it must
-     * always be 8 bytes aligned, hence the use of long long int.
-     */
-    long long int data [0];
 };
 
 /*
  * Each group has a big memory block which is divided into chunk size
- * sections.  Each chunk is then added to a linked list (of free chunks)
- * on the main structure.
+ * sections.  Each chunk is then added to the linked list of free chunks
+ * of its own group.
+ *
+ * The block is made up of CHUNK_PAGE_SIZE pages, each aligned to
+ * CHUNK_PAGE_SIZE.  Every page starts with a pointer to its group,
+ * followed by as many chunks as fit.  This is how the group of a chunk
+ * is found, by masking the chunk address down to the start of its page.
  */
 struct chunk_group_s {
 
@@ -75,185 +77,893 @@ struct chunk_group_s {
     /* big bulk of the memory, all chunks adjacent in one big block */
     void *chunks_block;
 
-    /* how many free chunks are in this group */
+    /* free chunks of this group & how many there are */
+    chunk_header_t *free_chunks;
     int n_grp_free;
 
-    /* next group in list */
-    chunk_group_t *next_chunk_group;
+    /* the NUMA node the memory of this group is placed on */
+    int node;
+
+    /* which of the group lists of its node this group is on */
+    int list;
+
+    /* neighbours in that list */
+    chunk_group_t *prev_chunk_group, *next_chunk_group;
 
 };
 
+typedef struct chunk_page_s {
+
+    chunk_group_t *my_group;
+
+    /* chunks start here, always 8 bytes aligned */
+    long long int data [0];
+
+} chunk_page_t;
+
+static inline chunk_group_t *
+chunk_group_of (void *chunk)
+{
+    return
+        ((chunk_page_t*)
+            ((unsigned long) chunk & ~((unsigned long) CHUNK_PAGE_SIZE - 1)))
+                ->my_group;
+}
+
+static inline int
+chunk_group_block_size (chunk_manager_t *cmgrp)
+{
+    return
+        cmgrp->pages_per_group * CHUNK_PAGE_SIZE;
+}
+
+static inline void *
+chunk_group_block_allocate (chunk_manager_t *cmgrp)
+{
+    if (cmgrp->huge_pages) {
+        return
+            mem_monitor_allocate_huge(cmgrp->mem_mon_p,
+                chunk_group_block_size(cmgrp));
+    }
+    return
+        mem_monitor_allocate_aligned(cmgrp->mem_mon_p,
+            chunk_group_block_size(cmgrp), CHUNK_PAGE_SIZE);
+}
+
+/*
+ * NUMA node the calling thread is running on.  It is looked up only
+ * every so often since threads rarely move between nodes and even if
+ * they do, nothing breaks, they just use remote memory for a while.
+ */
+#define NUMA_NODE_RECHECK       1024
+
+static __thread int my_numa_node = -1;
+static __thread int numa_node_checks = 0;
+
+static int
+current_numa_node (void)
+{
+    unsigned int cpu, node;
+
+    if ((my_numa_node < 0) || (++numa_node_checks >= NUMA_NODE_RECHECK)) {
+        numa_node_checks = 0;
+        node = 0;
+
+#ifdef __linux__
+        if (syscall(SYS_getcpu, &cpu, &node, NULL)) node = 0;
+#endif
+
+        my_numa_node = node % CHUNK_MAX_NUMA_NODES;
+    }
+    return my_numa_node;
+}
+
+/*
+ * Ask the kernel to place the block on the node.  If that fails, the
+ * block still mostly ends up there since it is about to be first
+ * touched by a thread running on that node.
+ */
+static void
+place_on_numa_node (void *block, int size, int node)
+{
+#ifdef __linux__
+    unsigned long nodemask = 1UL << node;
+
+    (void) syscall(SYS_mbind, block, size, MPOL_PREFERRED,
+                &nodemask, sizeof(nodemask) * 8, MPOL_MF_MOVE);
+#endif
+}
+
+/*
+ * Which group list a group belongs on, given how many of its
+ * chunks are free.  Fuller groups are on lower numbered lists.
+ */
+static inline int
+group_list_of (chunk_manager_t *cmgrp, chunk_group_t *cgp)
+{
+    if (0 == cgp->n_grp_free) return CHUNK_GROUPS_FULL;
+    if (cgp->n_grp_free >= cmgrp->chunks_per_group) return CHUNK_GROUPS_EMPTY;
+    return
+        1 + ((cgp->n_grp_free * CHUNK_FULLNESS_BUCKETS) /
+                cmgrp->chunks_per_group);
+}
+
+static inline void
+group_list_add (chunk_manager_t *cmgrp, chunk_group_t *cgp, int list)
+{
+    chunk_group_t **head = &cmgrp->group_lists[cgp->node][list];
+
+    cgp->list = list;
+    cgp->prev_chunk_group = null;
+    cgp->next_chunk_group = *head;
+    if (*head) (*head)->prev_chunk_group = cgp;
+    *head = cgp;
+    if (CHUNK_GROUPS_EMPTY == list) (cmgrp->n_empty_groups)++;
+}
+
+static inline void
+group_list_remove (chunk_manager_t *cmgrp, chunk_group_t *cgp)
+{
+    if (cgp->prev_chunk_group) {
+        cgp->prev_chunk_group->next_chunk_group = cgp->next_chunk_group;
+    } else {
+        cmgrp->group_lists[cgp->node][cgp->list] = cgp->next_chunk_group;
+    }
+    if (cgp->next_chunk_group) {
+        cgp->next_chunk_group->prev_chunk_group = cgp->prev_chunk_group;
+    }
+    if (CHUNK_GROUPS_EMPTY == cgp->list) (cmgrp->n_empty_groups)--;
+}
+
+/*
+ * The node whose groups an allocation should come from.  In NUMA
+ * mode, this is the node the thread is running on.
+ */
+static inline int
+allocation_node (chunk_manager_t *cmgrp)
+{
+    return
+        cmgrp->numa ? current_numa_node() : 0;
+}
+
+static void
+chunk_group_block_free (chunk_manager_t *cmgrp, void *block)
+{
+    if (cmgrp->huge_pages) {
+        mem_monitor_free_huge(cmgrp->mem_mon_p, block,
+            chunk_group_block_size(cmgrp));
+    } else {
+        mem_monitor_free_aligned(cmgrp->mem_mon_p, block,
+            chunk_group_block_size(cmgrp));
+    }
+}
+
 static int
-chunk_manager_add_group_failed (chunk_manager_t *cmgrp)
+chunk_manager_add_group_failed (chunk_manager_t *cmgrp, int node)
 {
-    byte *bp;
+    byte *page, *bp;
     chunk_header_t *chp;
     chunk_group_t *cgp;
-    int i;
+    int p, i, block_size;
 
     /* allocate chunk group structure itself */
     cgp = MEM_MONITOR_ALLOC(cmgrp, sizeof(chunk_group_t));
     if (NULL == cgp) return ENOMEM;
 
-    /* allocate the big chunk block */
-    cgp->chunks_block = MEM_MONITOR_ALLOC(cmgrp,
-            (cmgrp->actual_chunk_size * cmgrp->chunks_per_group));
+    /* allocate the big chunk block, page aligned */
+    block_size = chunk_group_block_size(cmgrp);
+    cgp->chunks_block = chunk_group_block_allocate(cmgrp);
     if (NULL == cgp->chunks_block) {
         MEM_MONITOR_FREE(cgp);
         return ENOMEM;
     }
+    if (cmgrp->slab &&
+        mem_monitor_register_slab(cgp->chunks_block, block_size,
+            cmgrp->slab)) {
+                chunk_group_block_free(cmgrp, cgp->chunks_block);
+                MEM_MONITOR_FREE(cgp);
+                return ENOMEM;
+    }
+    cgp->node = node;
+    if (cmgrp->numa) place_on_numa_node(cgp->chunks_block, block_size, node);
+    mem_monitor_record(chunk_manager_node_mem_monitor(cmgrp, node),
+        block_size, 1, 0);
 
     /*
-     * run thru the newly allocated block and partition each chunk
-     * and add it to the head of the free chunks list in the main
-     * manager.
+     * run thru every page of the newly allocated block and partition
+     * each chunk and add it to the head of the free chunks list of
+     * the group.
      */
-    bp = cgp->chunks_block;
-    for (i = 0; i < cmgrp->chunks_per_group; i++) {
-        chp = (chunk_header_t*) bp;
-        chp->my_group = cgp;
-        chp->next_chunk_header = cmgrp->free_chunks_list;
-        cmgrp->free_chunks_list = chp;
-        bp += cmgrp->actual_chunk_size;
+    cgp->free_chunks = null;
+    page = cgp->chunks_block;
+    for (p = 0; p < cmgrp->pages_per_group; p++) {
+        ((chunk_page_t*) page)->my_group = cgp;
+        bp = (byte*) &(((chunk_page_t*) page)->data[0]);
+        for (i = 0; i < cmgrp->chunks_per_page; i++) {
+            chp = (chunk_header_t*) bp;
+            chp->next_chunk_header = cgp->free_chunks;
+            cgp->free_chunks = chp;
+            bp += cmgrp->actual_chunk_size;
+        }
+        page += CHUNK_PAGE_SIZE;
     }
 
     /* update group related stuff */
     cgp->my_manager = cmgrp;
     cgp->n_grp_free = cmgrp->chunks_per_group;
 
-    /* update the main manager related stuff */
-    // cmgrp->n_cmgr_free += cmgrp->chunks_per_group;
-
     /*
      * Everything in the group is now initialised, now
-     * add the new group to the head of groups list
+     * add the new group to the list of completely free groups
      */
-    cgp->next_chunk_group = cmgrp->groups;
-    cmgrp->groups = cgp;
+    group_list_add(cmgrp, cgp, CHUNK_GROUPS_EMPTY);
+    (cmgrp->n_groups)++;
 
     return 0;
 }
 
 /*
- * Grab a chunk from the head of the free chunks list,
- * and return it to the caller, adjusting counters & head.
+ * The group must already have been taken off its list
+ */
+static void
+chunk_group_free (chunk_manager_t *cmgrp, chunk_group_t *cgp)
+{
+    mem_monitor_record(chunk_manager_node_mem_monitor(cmgrp, cgp->node),
+        -(long long) chunk_group_block_size(cmgrp), 0, 1);
+    if (cmgrp->slab) {
+        mem_monitor_unregister_slab(cgp->chunks_block,
+            chunk_group_block_size(cmgrp));
+    }
+    chunk_group_block_free(cmgrp, cgp->chunks_block);
+    MEM_MONITOR_FREE(cgp);
+    (cmgrp->n_groups)--;
+}
+
+/*
+ * Called whenever the free chunk count of a group changes, to move it
+ * onto the list it now belongs to.  If it has just become completely
+ * free and there are already enough free groups around, it is released
+ * right there and then.
+ */
+static inline void
+group_update (chunk_manager_t *cmgrp, chunk_group_t *cgp)
+{
+    int list = group_list_of(cmgrp, cgp);
+
+    if (list == cgp->list) return;
+    group_list_remove(cmgrp, cgp);
+    if ((CHUNK_GROUPS_EMPTY == list) &&
+        (cmgrp->n_empty_groups >= cmgrp->max_empty_groups)) {
+            chunk_group_free(cmgrp, cgp);
+            return;
+    }
+    group_list_add(cmgrp, cgp, list);
+}
+
+/*
+ * The fullest group of the node which still has any free chunks.
+ * Completely free groups are used only if there are no partially
+ * used ones, so that they get the chance to stay free and be
+ * released.
+ */
+static inline chunk_group_t *
+group_to_allocate_from (chunk_manager_t *cmgrp, int node)
+{
+    chunk_group_t **lists = cmgrp->group_lists[node];
+    int l;
+
+    for (l = CHUNK_GROUPS_FULL + 1; l <= CHUNK_GROUPS_EMPTY; l++) {
+        if (lists[l]) return lists[l];
+    }
+    return null;
+}
+
+static inline chunk_header_t *
+group_pop_chunk (chunk_manager_t *cmgrp, int node)
+{
+    chunk_group_t *cgp = group_to_allocate_from(cmgrp, node);
+    chunk_header_t *chp;
+
+    if (NULL == cgp) return null;
+
+    chp = cgp->free_chunks;
+    cgp->free_chunks = chp->next_chunk_header;
+    (cgp->n_grp_free)--;
+    group_update(cmgrp, cgp);
+
+    return chp;
+}
+
+/*
+ * Same as above but takes as many chunks (up to 'n') as the group
+ * has in one go, moving the group between the lists only once.
+ */
+static inline int
+group_pop_run (chunk_manager_t *cmgrp, int node, void *chunks [], int n)
+{
+    chunk_group_t *cgp = group_to_allocate_from(cmgrp, node);
+    chunk_header_t *chp;
+    int got;
+
+    if (NULL == cgp) return 0;
+
+    chp = cgp->free_chunks;
+    for (got = 0; (got < n) && chp; got++) {
+        chunks[got] = chp;
+        chp = chp->next_chunk_header;
+        if (chp) __builtin_prefetch(chp);
+    }
+    cgp->free_chunks = chp;
+    cgp->n_grp_free -= got;
+    group_update(cmgrp, cgp);
+
+    return got;
+}
+
+/*
+ * Return a chunk to its own group.  The group
+ * may be released as a result (see above).
+ */
+static inline void
+group_push_chunk (chunk_manager_t *cmgrp, chunk_header_t *chp)
+{
+    chunk_group_t *cgp = chunk_group_of(chp);
+
+    chp->next_chunk_header = cgp->free_chunks;
+    cgp->free_chunks = chp;
+    (cgp->n_grp_free)++;
+    group_update(cmgrp, cgp);
+}
+
+/*
+ * Grab a chunk from the fullest group with any free chunks
+ * and return it to the caller.
  */
 static inline void *
 thread_unsafe_chunk_manager_alloc (chunk_manager_t *cmgrp)
 {
     chunk_header_t *chp;
+    int node = allocation_node(cmgrp);
 
-    /* pop the first chunk from the free chunks list */
-    //if (cmgrp->n_cmgr_free > 0) {
-    chp = cmgrp->free_chunks_list;
-    if (chp) {
-        cmgrp->free_chunks_list = chp->next_chunk_header;
-        (chp->my_group->n_grp_free)--;
-        //(cmgrp->n_cmgr_free)--;
-        return &(chp->data[0]);
-    }
+    chp = group_pop_chunk(cmgrp, node);
+    if (chp) return chp;
 
     /*
      * if we are here, no more free chunks left, so create a new
-     * group and recursively call the function again.
+     * group and take the chunk from there.
      */
-    if (chunk_manager_add_group_failed(cmgrp)) {
+    if (chunk_manager_add_group_failed(cmgrp, node)) {
         return null;
     }
 
-    /* new group created, recursive call will return successfully */
+    /* new group created, this will return successfully */
     return
-        thread_unsafe_chunk_manager_alloc(cmgrp);
+        group_pop_chunk(cmgrp, node);
 }
 
 /*
- * This function tries to return unused chunks back to the OS.
- * How does it do this ?  It makes a single pass thru all the
- * free chunks checking their groups.  If the group that
- * the chunk belongs to has all its chunks free, this indicates
- * that that specific group will be deleted and hence this chunk
- * also must be removed from the main manager's list.  During this
- * pass, the functions reconstructs the new free list of chunks by
- * excluding the ones which will be deleted (since their group
- * will be deleted).
- *
- * Once this pass finishes, then we also make a single pass thru
- * the groups and free the ones up whose free chunk count is
- * complete.
+ * Grab up to 'n' chunks, creating new groups as needed.  Returns
+ * how many were actually obtained.
  */
 static int
-thread_unsafe_chunk_manager_trim (chunk_manager_t *cmgrp)
+thread_unsafe_chunk_manager_alloc_bulk (chunk_manager_t *cmgrp,
+    void *chunks [], int n)
 {
-    chunk_header_t *chp, *next_chp;
-    chunk_group_t *cgp, *next_cgp;
-    int chunks_tobe_freed, grps_tobe_freed;
+    int run, got, node = allocation_node(cmgrp);
 
-    /*
-     * since we free up entire groups of chunks, there must at least
-     * be cmgrp->chunks_per_group free chunks before we even bother
-     * checking.  If this is not the case, it is impossible for any
-     * group to have all its chunks free.
-     */
-    //if (cmgrp->n_cmgr_free < cmgrp->chunks_per_group)
-        //return 0;
+    got = 0;
+    while (got < n) {
+        run = group_pop_run(cmgrp, node, &chunks[got], n - got);
+        if (run) {
+            got += run;
+        } else if (chunk_manager_add_group_failed(cmgrp, node)) {
+            break;
+        }
+    }
+    return got;
+}
 
-    chunks_tobe_freed = grps_tobe_freed = 0;
-    chp = cmgrp->free_chunks_list;
-    cmgrp->free_chunks_list = null;
-    //cmgrp->n_cmgr_free = 0;
-    while (chp) {
+/*
+ * Return all the chunks to their own groups
+ */
+static void
+thread_unsafe_chunk_manager_free_bulk (chunk_manager_t *cmgrp,
+    void *chunks [], int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (i + 1 < n) __builtin_prefetch(chunks[i + 1], 1);
+        group_push_chunk(cmgrp, (chunk_header_t*) chunks[i]);
+    }
+}
+
+/*
+ * Pop a magazine worth of chunks off the depot (the free chunks of all
+ * the groups) into the magazine, creating a new group only if the depot
+ * was completely empty.  Chunks in magazines are no longer counted as
+ * free in their groups.  Must be called with the manager locked.
+ */
+static void
+depot_fill_magazine (chunk_manager_t *cmgrp, chunk_magazine_t *mag)
+{
+    chunk_header_t *chp;
+    int node = allocation_node(cmgrp);
+
+    while (mag->n < CHUNK_MAGAZINE_SIZE) {
+        chp = group_pop_chunk(cmgrp, node);
+        if (NULL == chp) {
+            if (mag->n || chunk_manager_add_group_failed(cmgrp, node)) return;
+            continue;
+        }
+        chp->next_chunk_header = mag->chunks;
+        mag->chunks = chp;
+        (mag->n)++;
+    }
+}
+
+/*
+ * Return all the chunks in the magazine back to the depot.
+ * Must be called with the manager locked.
+ */
+static void
+depot_empty_magazine (chunk_manager_t *cmgrp, chunk_magazine_t *mag)
+{
+    chunk_header_t *chp, *next_chp;
 
+    chp = mag->chunks;
+    while (chp) {
         next_chp = chp->next_chunk_header;
+        group_push_chunk(cmgrp, chp);
+        chp = next_chp;
+    }
+    mag->chunks = null;
+    mag->n = 0;
+}
+
+static inline void
+magazine_slot_lock (chunk_magazine_slot_t *slot)
+{
+    while (__sync_lock_test_and_set(&slot->busy, 1)) {
+        while (slot->busy) sched_yield();
+    }
+}
+
+static inline void
+magazine_slot_unlock (chunk_magazine_slot_t *slot)
+{
+    __sync_lock_release(&slot->busy);
+}
+
+static inline void
+swap_magazines (chunk_magazine_slot_t *slot)
+{
+    chunk_magazine_t tmp;
+
+    tmp = slot->loaded;
+    slot->loaded = slot->previous;
+    slot->previous = tmp;
+}
+
+/*
+ * The 'previous' magazine of a slot is always either full or empty.
+ * The manager lock is taken only if the loaded magazine is empty and
+ * the previous one is too, in which case a full magazine is taken
+ * from the depot.
+ */
+static void *
+magazine_alloc (chunk_manager_t *cmgrp)
+{
+    chunk_magazine_slot_t *slot = &cmgrp->magazines[thread_slot()];
+    chunk_header_t *chp = null;
+
+    magazine_slot_lock(slot);
+    if (0 == slot->loaded.n) {
+        if (slot->previous.n) {
+            swap_magazines(slot);
+        } else {
+            OBJ_WRITE_LOCK(cmgrp);
+            depot_fill_magazine(cmgrp, &slot->loaded);
+            OBJ_WRITE_UNLOCK(cmgrp);
+        }
+    }
+    chp = slot->loaded.chunks;
+    if (chp) {
+        slot->loaded.chunks = chp->next_chunk_header;
+        (slot->loaded.n)--;
+    }
+    magazine_slot_unlock(slot);
+
+    return chp;
+}
+
+/*
+ * Mirror image of the above, the manager lock is taken only if both
+ * magazines are full, in which case the previous one is returned to
+ * the depot.
+ */
+static void
+magazine_free (chunk_manager_t *cmgrp, chunk_header_t *chp)
+{
+    chunk_magazine_slot_t *slot = &cmgrp->magazines[thread_slot()];
+
+    magazine_slot_lock(slot);
+    if (slot->loaded.n >= CHUNK_MAGAZINE_SIZE) {
+        if (slot->previous.n) {
+            OBJ_WRITE_LOCK(cmgrp);
+            depot_empty_magazine(cmgrp, &slot->previous);
+            OBJ_WRITE_UNLOCK(cmgrp);
+        }
+        swap_magazines(slot);
+    }
+    chp->next_chunk_header = slot->loaded.chunks;
+    slot->loaded.chunks = chp;
+    (slot->loaded.n)++;
+    magazine_slot_unlock(slot);
+}
+
+/*
+ * Bulk versions of the above.  The magazines of the slot are used up
+ * (or filled up when freeing) first and whatever is left over is taken
+ * from (or returned to) the depot directly, with a single acquisition
+ * of the manager lock.
+ */
+static int
+magazine_alloc_bulk (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    chunk_magazine_slot_t *slot = &cmgrp->magazines[thread_slot()];
+    chunk_header_t *chp;
+    int got = 0;
+
+    magazine_slot_lock(slot);
+    while (got < n) {
+        if (0 == slot->loaded.n) {
+            if (0 == slot->previous.n) break;
+            swap_magazines(slot);
+        }
+        chp = slot->loaded.chunks;
+        slot->loaded.chunks = chp->next_chunk_header;
+        (slot->loaded.n)--;
+        chunks[got++] = chp;
+    }
+    if (got < n) {
+        OBJ_WRITE_LOCK(cmgrp);
+        got += thread_unsafe_chunk_manager_alloc_bulk(cmgrp,
+                    &chunks[got], n - got);
+        OBJ_WRITE_UNLOCK(cmgrp);
+    }
+    magazine_slot_unlock(slot);
+
+    return got;
+}
+
+static void
+magazine_free_bulk (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    chunk_magazine_slot_t *slot = &cmgrp->magazines[thread_slot()];
+    chunk_header_t *chp;
+    int i = 0;
+
+    magazine_slot_lock(slot);
+    while (i < n) {
+        if (slot->loaded.n >= CHUNK_MAGAZINE_SIZE) {
+            if (slot->previous.n) break;
+            swap_magazines(slot);
+        }
+        chp = (chunk_header_t*) chunks[i++];
+        chp->next_chunk_header = slot->loaded.chunks;
+        slot->loaded.chunks = chp;
+        (slot->loaded.n)++;
+    }
+    if (i < n) {
+        OBJ_WRITE_LOCK(cmgrp);
+        thread_unsafe_chunk_manager_free_bulk(cmgrp, &chunks[i], n - i);
+        OBJ_WRITE_UNLOCK(cmgrp);
+    }
+    magazine_slot_unlock(slot);
+}
+
+/*
+ * Return the chunks in every magazine back to the depot.  Takes the
+ * locks in the same order as the allocation & free paths above, slot
+ * first and then the manager.
+ */
+static void
+flush_all_magazines (chunk_manager_t *cmgrp)
+{
+    chunk_magazine_slot_t *slot;
+    int s;
+
+    for (s = 0; s < MAX_THREAD_SLOTS; s++) {
+        slot = &cmgrp->magazines[s];
+        magazine_slot_lock(slot);
+        if (slot->loaded.n || slot->previous.n) {
+            OBJ_WRITE_LOCK(cmgrp);
+            depot_empty_magazine(cmgrp, &slot->loaded);
+            depot_empty_magazine(cmgrp, &slot->previous);
+            OBJ_WRITE_UNLOCK(cmgrp);
+        }
+        magazine_slot_unlock(slot);
+    }
+}
+
+/*
+ * Lock free stack of free chunks.  Pushing never looks inside any chunk
+ * already on the stack so it is always safe.  Popping has to read the
+ * next pointer of the head chunk, which another thread may have popped
+ * (& even trimmed away) meanwhile.  The tag takes care of the former and
+ * 'lock_free_pops' lets trimming wait until nobody can still be looking
+ * at a chunk it is about to free.
+ */
+static void
+lock_free_push_chain (chunk_manager_t *cmgrp,
+    chunk_header_t *first, chunk_header_t *last)
+{
+    chunk_stack_head_t old_head, new_head;
+
+    do {
+        old_head = cmgrp->lock_free_head;
+        last->next_chunk_header = STACK_HEAD_PTR(old_head);
+        new_head = STACK_HEAD_MAKE(first, STACK_HEAD_TAG(old_head) + 1);
+    } while (!__sync_bool_compare_and_swap(&cmgrp->lock_free_head,
+                old_head, new_head));
+}
+
+static chunk_header_t *
+lock_free_pop (chunk_manager_t *cmgrp)
+{
+    chunk_stack_head_t old_head, new_head;
+    chunk_header_t *chp;
+
+    __sync_fetch_and_add(&cmgrp->lock_free_pops, 1);
+    do {
+        old_head = cmgrp->lock_free_head;
+        chp = STACK_HEAD_PTR(old_head);
+        if (NULL == chp) break;
+        new_head = STACK_HEAD_MAKE(chp->next_chunk_header,
+                        STACK_HEAD_TAG(old_head) + 1);
+    } while (!__sync_bool_compare_and_swap(&cmgrp->lock_free_head,
+                old_head, new_head));
+    __sync_fetch_and_sub(&cmgrp->lock_free_pops, 1);
+
+    return chp;
+}
+
+/*
+ * takes the entire stack off and waits until no thread which may have
+ * seen any of its chunks is still in the middle of popping.
+ */
+static chunk_header_t *
+lock_free_detach_all (chunk_manager_t *cmgrp)
+{
+    chunk_stack_head_t old_head;
+
+    do {
+        old_head = cmgrp->lock_free_head;
+    } while (!__sync_bool_compare_and_swap(&cmgrp->lock_free_head,
+                old_head, STACK_HEAD_MAKE(null, STACK_HEAD_TAG(old_head) + 1)));
+    while (cmgrp->lock_free_pops) sched_yield();
+
+    return STACK_HEAD_PTR(old_head);
+}
+
+/*
+ * hand all the chunks of a newly created group over to the stack.  The
+ * very first chunk of the block was carved first and is hence the last
+ * one on the free list of the group.  From then on, the group is treated
+ * as fully used and is only looked at again when trimming.
+ */
+static void
+lock_free_push_new_group (chunk_manager_t *cmgrp, chunk_group_t *cgp)
+{
+    lock_free_push_chain(cmgrp, cgp->free_chunks,
+        (chunk_header_t*) &(((chunk_page_t*) cgp->chunks_block)->data[0]));
+    cgp->free_chunks = null;
+    cgp->n_grp_free = 0;
+    group_update(cmgrp, cgp);
+}
+
+static void *
+lock_free_alloc (chunk_manager_t *cmgrp)
+{
+    chunk_header_t *chp;
+    int failed;
+
+    while (NULL == (chp = lock_free_pop(cmgrp))) {
 
         /*
-         * if this chunk does not belong to a group whose chunks
-         * are all free (will be deleted), then re-add it to the
-         * free list.  The rest will be left 'dangling' but they
-         * will soon be all deleted anyway so it does not matter.
+         * another thread may already have added a group.  A new
+         * group is the only one ever on the completely free list
+         * in this mode, all the others are considered fully used.
          */
-        if (chp->my_group->n_grp_free < cmgrp->chunks_per_group) {
-            chp->next_chunk_header = cmgrp->free_chunks_list;
-            cmgrp->free_chunks_list = chp;
-            //(cmgrp->n_cmgr_free)++;
-        } else {
-            chunks_tobe_freed++;
+        failed = 0;
+        OBJ_WRITE_LOCK(cmgrp);
+        if (NULL == STACK_HEAD_PTR(cmgrp->lock_free_head)) {
+            failed = chunk_manager_add_group_failed(cmgrp, 0);
+            if (!failed) {
+                lock_free_push_new_group(cmgrp,
+                    cmgrp->group_lists[0][CHUNK_GROUPS_EMPTY]);
+            }
+        }
+        OBJ_WRITE_UNLOCK(cmgrp);
+        if (failed) return null;
+    }
+    return chp;
+}
+
+/*
+ * Detach a run of up to 'n' chunks off the stack with a single compare
+ * & swap.  The run has to be walked before it is owned, and a chunk
+ * which another thread popped meanwhile holds user data rather than a
+ * next pointer.  So every next pointer is only followed once the tag of
+ * the head is seen unchanged after reading it, ie nothing was popped.
+ * If the tag did change, the walk stops there and the compare & swap
+ * fails.  The head itself is read atomically for the same reason.
+ */
+static int
+lock_free_pop_run (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    chunk_stack_head_t old_head, new_head;
+    chunk_header_t *first, *last, *next;
+    int i, got = 0;
+
+    __sync_fetch_and_add(&cmgrp->lock_free_pops, 1);
+    do {
+        old_head = STACK_HEAD_READ(&cmgrp->lock_free_head);
+        first = last = STACK_HEAD_PTR(old_head);
+        if (NULL == first) break;
+        for (got = 1; got < n; got++) {
+            next = last->next_chunk_header;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if ((NULL == next) ||
+                (STACK_HEAD_TAG_OF(&cmgrp->lock_free_head) !=
+                    STACK_HEAD_TAG(old_head))) {
+                        break;
+            }
+            last = next;
+        }
+        new_head = STACK_HEAD_MAKE(last->next_chunk_header,
+                        STACK_HEAD_TAG(old_head) + 1);
+    } while (!__sync_bool_compare_and_swap(&cmgrp->lock_free_head,
+                old_head, new_head));
+    __sync_fetch_and_sub(&cmgrp->lock_free_pops, 1);
+    if (NULL == first) return 0;
+
+    for (i = 0; i < got; i++) {
+        chunks[i] = first;
+        first = first->next_chunk_header;
+    }
+    return got;
+}
+
+/*
+ * Runs are taken off the stack until it is empty, a new group is then
+ * added the same way as for a single chunk.  Freeing links all the
+ * chunks together first and pushes them in one go.
+ */
+static int
+lock_free_alloc_bulk (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    int run, got = 0;
+
+    while (got < n) {
+        run = lock_free_pop_run(cmgrp, &chunks[got], n - got);
+        if (run) {
+            got += run;
+            continue;
+        }
+        chunks[got] = lock_free_alloc(cmgrp);
+        if (NULL == chunks[got]) break;
+        got++;
+    }
+    return got;
+}
+
+static void
+lock_free_free_bulk (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    chunk_header_t *chp;
+    int i;
+
+    for (i = 0; i < n - 1; i++) {
+        chp = (chunk_header_t*) chunks[i];
+        chp->next_chunk_header = (chunk_header_t*) chunks[i + 1];
+    }
+    lock_free_push_chain(cmgrp, (chunk_header_t*) chunks[0],
+        (chunk_header_t*) chunks[n - 1]);
+}
+
+/*
+ * Release up to 'max_groups' completely free groups.  Since every group
+ * keeps its own free chunks and the completely free ones are on their
+ * own list, each one is released in constant time, without looking at
+ * any of the other groups or chunks.
+ */
+static int
+thread_unsafe_chunk_manager_trim (chunk_manager_t *cmgrp, int max_groups)
+{
+    chunk_group_t *cgp;
+    int n, grps_freed = 0;
+
+    for (n = 0; n < CHUNK_MAX_NUMA_NODES; n++) {
+        while (grps_freed < max_groups) {
+            cgp = cmgrp->group_lists[n][CHUNK_GROUPS_EMPTY];
+            if (NULL == cgp) break;
+            group_list_remove(cmgrp, cgp);
+            chunk_group_free(cmgrp, cgp);
+            grps_freed++;
+        }
+    }
+    return grps_freed;
+}
+
+/*
+ * In lock free mode the group free counts are not kept up to date,
+ * so the stack is taken off and the counts are computed from it.  Up
+ * to 'max_groups' groups which turn out to be completely free are
+ * marked by a free count of -1, all the chunks of the other groups
+ * are put back onto the stack and then the marked groups are freed.
+ * Unlike the other modes, this has to walk all the free chunks.
+ */
+static int
+lock_free_chunk_manager_trim (chunk_manager_t *cmgrp, int max_groups)
+{
+    chunk_header_t *chp, *next_chp, *first, *kept, *last_kept;
+    chunk_group_t *cgp, *next_cgp;
+    int grps_freed = 0;
+
+    first = lock_free_detach_all(cmgrp);
+    for (chp = first; chp; chp = chp->next_chunk_header) {
+        (chunk_group_of(chp)->n_grp_free)++;
+    }
+
+    cgp = cmgrp->group_lists[0][CHUNK_GROUPS_FULL];
+    for (; cgp && (grps_freed < max_groups); cgp = cgp->next_chunk_group) {
+        if (cgp->n_grp_free >= cmgrp->chunks_per_group) {
+            cgp->n_grp_free = -1;
+            grps_freed++;
         }
+    }
 
+    kept = last_kept = null;
+    chp = first;
+    while (chp) {
+        next_chp = chp->next_chunk_header;
+        if (chunk_group_of(chp)->n_grp_free >= 0) {
+            chp->next_chunk_header = kept;
+            kept = chp;
+            if (NULL == last_kept) last_kept = chp;
+        }
         chp = next_chp;
     }
+    if (kept) lock_free_push_chain(cmgrp, kept, last_kept);
 
-    /*
-     * now free up all the groups whose chunks are all free
-     * and which we just took off the main managers' free list
-     */
-    if (chunks_tobe_freed) {
-        cgp = cmgrp->groups;
-        cmgrp->groups = null;
-        while (cgp) {
-            next_cgp = cgp->next_chunk_group;
-            if (cgp->n_grp_free < cmgrp->chunks_per_group) {
-                cgp->next_chunk_group = cmgrp->groups;
-                cmgrp->groups = cgp;
-            } else {
-                MEM_MONITOR_FREE(cgp->chunks_block);
-                MEM_MONITOR_FREE(cgp);
-                grps_tobe_freed++;
-            }
-            cgp = next_cgp;
+    cgp = cmgrp->group_lists[0][CHUNK_GROUPS_FULL];
+    while (cgp) {
+        next_cgp = cgp->next_chunk_group;
+        if (cgp->n_grp_free < 0) {
+            group_list_remove(cmgrp, cgp);
+            chunk_group_free(cmgrp, cgp);
+        } else {
+            cgp->n_grp_free = 0;
         }
+        cgp = next_cgp;
     }
 
-    return grps_tobe_freed;
+    return grps_freed;
 }
 
 /***************************** 80 column separator ****************************/
 
 PUBLIC int
-chunk_manager_init (chunk_manager_t *cmgrp,
-    boolean make_it_thread_safe,
+chunk_manager_init_options (chunk_manager_t *cmgrp,
+    boolean make_it_thread_safe, int options,
     int chunk_size, int chunks_per_group,
     mem_monitor_t *parent_mem_monitor)
 {
+    int pages_per_huge_page = MEM_HUGE_PAGE_SIZE / CHUNK_PAGE_SIZE;
+    int n;
+
     /* basic sanity checks */
     if ((chunk_size < MIN_CHUNK_SIZE) ||
         (chunk_size > MAX_CHUNK_SIZE)) {
@@ -263,6 +973,11 @@ chunk_manager_init (chunk_manager_t *cmgrp,
         (chunks_per_group > MAX_CHUNKS_PER_GROUP)) {
             return EINVAL;
     }
+    if ((options & CHUNK_MANAGER_LOCK_FREE) &&
+        (options & CHUNK_MANAGER_NUMA)) {
+            return EINVAL;
+    }
+    if (options & CHUNK_MANAGER_LOCK_FREE) make_it_thread_safe = true;
 
     /* clear absolutely everything */
     memset(cmgrp, 0, sizeof(chunk_manager_t));
@@ -272,21 +987,106 @@ chunk_manager_init (chunk_manager_t *cmgrp,
 
     /* align the size to the next 8 bytes */
     cmgrp->chunk_size = chunk_size;
-    cmgrp->actual_chunk_size =
-        ((chunk_size + 7) & ~7) + sizeof(chunk_header_t);
+    cmgrp->actual_chunk_size = (chunk_size + 7) & ~7;
+
+    /* round the group up to whole pages */
+    cmgrp->chunks_per_page =
+        (CHUNK_PAGE_SIZE - sizeof(chunk_page_t)) / cmgrp->actual_chunk_size;
+    cmgrp->pages_per_group =
+        (chunks_per_group + cmgrp->chunks_per_page - 1) /
+            cmgrp->chunks_per_page;
+    if (options & CHUNK_MANAGER_HUGE_PAGES) {
+        cmgrp->huge_pages = true;
+        cmgrp->pages_per_group =
+            (cmgrp->pages_per_group + pages_per_huge_page - 1) /
+                pages_per_huge_page * pages_per_huge_page;
+    }
+    cmgrp->chunks_per_group =
+        cmgrp->pages_per_group * cmgrp->chunks_per_page;
 
-    cmgrp->chunks_per_group = chunks_per_group;
+    cmgrp->numa = (options & CHUNK_MANAGER_NUMA) != 0;
+    if (cmgrp->numa) {
+        cmgrp->node_mem_mon = mem_monitor_allocate_aligned(cmgrp->mem_mon_p,
+            CHUNK_MAX_NUMA_NODES * sizeof(mem_monitor_t), CACHE_LINE_SIZE);
+        if (NULL == cmgrp->node_mem_mon) {
+            OBJ_WRITE_UNLOCK(cmgrp);
+            LOCK_OBJ_DESTROY(cmgrp);
+            return ENOMEM;
+        }
+        for (n = 0; n < CHUNK_MAX_NUMA_NODES; n++) {
+            mem_monitor_init(&cmgrp->node_mem_mon[n], NULL);
+        }
+    }
+
+    /* by default, completely free groups are kept until trimmed */
+    cmgrp->max_empty_groups = INT_MAX;
+
+    /*
+     * lock free managers need no magazines, otherwise magazines
+     * are only worth it if there is a lock to avoid.  NUMA managers
+     * do not use them either, since a magazine would hand chunks freed
+     * by a thread on one node to allocations on another node.
+     */
+    if (options & CHUNK_MANAGER_LOCK_FREE) {
+        cmgrp->lock_free = true;
+    } else if (cmgrp->lock && !cmgrp->numa) {
+        cmgrp->magazines_block = MEM_MONITOR_ZALLOC(cmgrp,
+            (MAX_THREAD_SLOTS + 1) * sizeof(chunk_magazine_slot_t));
+        if (NULL == cmgrp->magazines_block) {
+            OBJ_WRITE_UNLOCK(cmgrp);
+            LOCK_OBJ_DESTROY(cmgrp);
+            return ENOMEM;
+        }
+        cmgrp->magazines = (chunk_magazine_slot_t*)
+            (((unsigned long) cmgrp->magazines_block + CACHE_LINE_SIZE - 1)
+                & ~((unsigned long) CACHE_LINE_SIZE - 1));
+    }
 
     OBJ_WRITE_UNLOCK(cmgrp);
 
     return 0;
 }
 
-PUBLIC void *
-chunk_alloc (chunk_manager_t *cmgrp)
+PUBLIC int
+chunk_manager_init (chunk_manager_t *cmgrp,
+    boolean make_it_thread_safe,
+    int chunk_size, int chunks_per_group,
+    mem_monitor_t *parent_mem_monitor)
+{
+    return
+        chunk_manager_init_options(cmgrp, make_it_thread_safe, 0,
+            chunk_size, chunks_per_group, parent_mem_monitor);
+}
+
+PUBLIC int
+chunk_manager_init_lock_free (chunk_manager_t *cmgrp,
+    int chunk_size, int chunks_per_group,
+    mem_monitor_t *parent_mem_monitor)
+{
+    return
+        chunk_manager_init_options(cmgrp, true, CHUNK_MANAGER_LOCK_FREE,
+            chunk_size, chunks_per_group, parent_mem_monitor);
+}
+
+PUBLIC int
+chunk_manager_init_numa (chunk_manager_t *cmgrp,
+    boolean make_it_thread_safe,
+    int chunk_size, int chunks_per_group,
+    mem_monitor_t *parent_mem_monitor)
+{
+    return
+        chunk_manager_init_options(cmgrp, make_it_thread_safe,
+            CHUNK_MANAGER_NUMA, chunk_size, chunks_per_group, parent_mem_monitor);
+}
+
+static void *
+chunk_alloc_once (chunk_manager_t *cmgrp)
 {
     void *ptr;
 
+    if (cmgrp->magazines) return magazine_alloc(cmgrp);
+    if (cmgrp->lock_free) return lock_free_alloc(cmgrp);
+
     OBJ_WRITE_LOCK(cmgrp);
     ptr = thread_unsafe_chunk_manager_alloc(cmgrp);
     OBJ_WRITE_UNLOCK(cmgrp);
@@ -294,6 +1094,26 @@ chunk_alloc (chunk_manager_t *cmgrp)
     return ptr;
 }
 
+/*
+ * A reclaim function triggered by adding a group is only called after
+ * the manager lock is released, since it may want to trim this very
+ * manager, and the allocation is then retried.
+ */
+PUBLIC void *
+chunk_alloc (chunk_manager_t *cmgrp)
+{
+    void *ptr;
+
+    mem_monitor_defer_reclaim_begin();
+    ptr = chunk_alloc_once(cmgrp);
+    if (mem_monitor_defer_reclaim_end() && (NULL == ptr)) {
+        mem_monitor_defer_reclaim_begin();
+        ptr = chunk_alloc_once(cmgrp);
+        (void) mem_monitor_defer_reclaim_end();
+    }
+    return ptr;
+}
+
 PUBLIC void
 chunk_free (void *chunk)
 {
@@ -301,49 +1121,156 @@ chunk_free (void *chunk)
     chunk_manager_t *cmgrp;
 
     /* get the hidden chunk header and the chunk manager pointer */
-    chp = (chunk_header_t*) (((byte*) chunk) - sizeof(chunk_header_t));
-    cmgrp = chp->my_group->my_manager;
+    chp = (chunk_header_t*) chunk;
+    cmgrp = chunk_group_of(chunk)->my_manager;
+
+    if (cmgrp->magazines) {
+        magazine_free(cmgrp, chp);
+        return;
+    }
+    if (cmgrp->lock_free) {
+        lock_free_push_chain(cmgrp, chp, chp);
+        return;
+    }
 
     OBJ_WRITE_LOCK(cmgrp);
+    group_push_chunk(cmgrp, chp);
+    OBJ_WRITE_UNLOCK(cmgrp);
+}
+
+static int
+chunk_alloc_bulk_once (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    int got;
+
+    if (cmgrp->magazines) return magazine_alloc_bulk(cmgrp, chunks, n);
+    if (cmgrp->lock_free) return lock_free_alloc_bulk(cmgrp, chunks, n);
+
+    OBJ_WRITE_LOCK(cmgrp);
+    got = thread_unsafe_chunk_manager_alloc_bulk(cmgrp, chunks, n);
+    OBJ_WRITE_UNLOCK(cmgrp);
+
+    return got;
+}
+
+PUBLIC int
+chunk_alloc_bulk (chunk_manager_t *cmgrp, void *chunks [], int n)
+{
+    int got;
+
+    if (n <= 0) return 0;
+    mem_monitor_defer_reclaim_begin();
+    got = chunk_alloc_bulk_once(cmgrp, chunks, n);
+    if (mem_monitor_defer_reclaim_end() && (got < n)) {
+        mem_monitor_defer_reclaim_begin();
+        got += chunk_alloc_bulk_once(cmgrp, &chunks[got], n - got);
+        (void) mem_monitor_defer_reclaim_end();
+    }
+    return got;
+}
+
+PUBLIC void
+chunk_free_bulk (void *chunks [], int n)
+{
+    chunk_manager_t *cmgrp;
+
+    if (n <= 0) return;
+    cmgrp = chunk_group_of(chunks[0])->my_manager;
+
+    if (cmgrp->magazines) {
+        magazine_free_bulk(cmgrp, chunks, n);
+        return;
+    }
+    if (cmgrp->lock_free) {
+        lock_free_free_bulk(cmgrp, chunks, n);
+        return;
+    }
 
-    /* group is being returned a chunk */
-    (chp->my_group->n_grp_free)++;
+    OBJ_WRITE_LOCK(cmgrp);
+    thread_unsafe_chunk_manager_free_bulk(cmgrp, chunks, n);
+    OBJ_WRITE_UNLOCK(cmgrp);
+}
 
-    /* main chunk manager is being returned one */
-    //(cmgrp->n_cmgr_free)++;
+PUBLIC int
+chunk_manager_trim_budget (chunk_manager_t *cmgrp, int max_groups)
+{
+    int grps_freed;
 
-    /* place it back into the head of free chunks list */
-    chp->next_chunk_header = cmgrp->free_chunks_list;
-    cmgrp->free_chunks_list = chp;
+    if (cmgrp->magazines) flush_all_magazines(cmgrp);
 
+    OBJ_WRITE_LOCK(cmgrp);
+    if (cmgrp->lock_free) {
+        grps_freed = lock_free_chunk_manager_trim(cmgrp, max_groups);
+    } else {
+        grps_freed = thread_unsafe_chunk_manager_trim(cmgrp, max_groups);
+    }
     OBJ_WRITE_UNLOCK(cmgrp);
+
+    return grps_freed;
 }
 
 PUBLIC int
 chunk_manager_trim (chunk_manager_t *cmgrp)
 {
-    int grps_tobe_freed;
+    return
+        chunk_manager_trim_budget(cmgrp, INT_MAX);
+}
+
+PUBLIC void
+chunk_manager_set_max_empty_groups (chunk_manager_t *cmgrp,
+    int max_empty_groups)
+{
+    OBJ_WRITE_LOCK(cmgrp);
+    cmgrp->max_empty_groups = max_empty_groups < 0 ? 0 : max_empty_groups;
+    if (!cmgrp->lock_free &&
+        (cmgrp->n_empty_groups > cmgrp->max_empty_groups)) {
+            thread_unsafe_chunk_manager_trim(cmgrp,
+                cmgrp->n_empty_groups - cmgrp->max_empty_groups);
+    }
+    OBJ_WRITE_UNLOCK(cmgrp);
+}
 
+PUBLIC int
+chunk_manager_set_slab (chunk_manager_t *cmgrp, mem_slab_t *slab)
+{
+    int rv = 0;
+
+    if (CHUNK_PAGE_SIZE % MEM_SLAB_PAGE_SIZE) return EINVAL;
     OBJ_WRITE_LOCK(cmgrp);
-    grps_tobe_freed = thread_unsafe_chunk_manager_trim(cmgrp);
+    if (cmgrp->n_groups) {
+        rv = EBUSY;
+    } else {
+        cmgrp->slab = slab;
+    }
     OBJ_WRITE_UNLOCK(cmgrp);
 
-    return grps_tobe_freed;
+    return rv;
 }
 
 PUBLIC void
 chunk_manager_destroy (chunk_manager_t *cmgrp)
 {
     chunk_group_t *grp, *next_grp;
+    int n, l;
 
     OBJ_WRITE_LOCK(cmgrp);
-    grp = cmgrp->groups;
-    while (grp) {
-        next_grp = grp->next_chunk_group;
-        MEM_MONITOR_FREE(grp->chunks_block);
-        MEM_MONITOR_FREE(grp);
-        grp = next_grp;
+    for (n = 0; n < CHUNK_MAX_NUMA_NODES; n++) {
+        for (l = 0; l < CHUNK_GROUP_LISTS; l++) {
+            grp = cmgrp->group_lists[n][l];
+            while (grp) {
+                next_grp = grp->next_chunk_group;
+                chunk_group_free(cmgrp, grp);
+                grp = next_grp;
+            }
+        }
+    }
+    MEM_MONITOR_FREE(cmgrp->magazines_block);
+    if (cmgrp->node_mem_mon) {
+        mem_monitor_free_aligned(cmgrp->mem_mon_p, cmgrp->node_mem_mon,
+            CHUNK_MAX_NUMA_NODES * sizeof(mem_monitor_t));
     }
+    OBJ_WRITE_UNLOCK(cmgrp);
+    LOCK_OBJ_DESTROY(cmgrp);
     memset(cmgrp, 0, sizeof(chunk_manager_t));
 }
 
@@ -43,6 +43,7 @@ extern "C" {
 #include "common.h"
 #include "mem_monitor_object.h"
 #include "lock_object.h"
+#include "tagged_head.h"
 
 /******************************************************************************
  *
@@ -79,12 +80,55 @@ extern "C" {
  * A bigger challenge is when 'trimming' the structure is needed.
  * This is when the user decides that there are a lot of free chunks
  * around which are not needed and may have to be returned back to
- * memory.  When this is requested, all the groups are scanned and
- * for the ones who have all their chunks unused, each chunk is
- * removed off the free chunks stack and the entire group deleted.
- * This can be a bit tricky and time consuming and is therefore not
- * automatically performed but left to the user as to when it needs
- * to be run.
+ * memory.  To make this cheap, every group keeps its own list of free
+ * chunks and the groups themselves are kept on lists according to how
+ * full they are.  Chunks are always allocated from the fullest group
+ * which still has free chunks, so that the emptier groups get the
+ * chance to become completely free.  Completely free groups are on
+ * their own list, so each one can be released in constant time without
+ * looking at any chunk.  Trimming can therefore be done a few groups
+ * at a time (see 'chunk_manager_trim_budget') or groups can even be
+ * released right away as soon as they become free (see
+ * 'chunk_manager_set_max_empty_groups').  By default, free groups are
+ * kept around until the user trims the manager.
+ *
+ * Chunks carry no hidden header.  The memory of every group is made up
+ * of CHUNK_PAGE_SIZE aligned pages each of which starts with a pointer
+ * to its group, so the group (and hence the manager) of any chunk is
+ * found by masking its address.  The link which chains free chunks
+ * together is kept inside the free chunks themselves.  So a chunk uses
+ * exactly its size (rounded up to 8 bytes) and nothing more.
+ *
+ * When the manager is thread safe, the shared free chunks list
+ * becomes a 'depot' and every thread allocates from & frees into
+ * its own 'magazines' of chunks instead (Bonwick's magazine layer).
+ * Each thread slot (see 'thread_slot' in lock_object.h) has two
+ * magazines, a 'loaded' one which chunks are popped from & pushed
+ * into and a 'previous' one which is either full or empty.  Only when
+ * both are exhausted (or both are full when freeing) is the manager
+ * lock taken, to exchange a whole magazine worth of chunks with the
+ * depot in one go.  Chunks sitting in magazines are counted as 'in use'
+ * by their groups, so trimming first flushes all the magazines back
+ * into the depot.
+ *
+ * For cases where per thread state does not work well (for example
+ * when chunks are mostly freed by different threads than the ones which
+ * allocated them), a manager can instead be initialized 'lock free'
+ * by 'chunk_manager_init_lock_free'.  The free chunks list is then a
+ * Treiber stack whose head is updated with compare & swap and carries
+ * an ABA tag.  The manager lock is then only taken when adding new
+ * groups and trimming.  In this mode the free chunk count of each group
+ * is not maintained and is only computed when trimming.
+ *
+ * On NUMA machines, a manager initialized by 'chunk_manager_init_numa'
+ * places every new group on the node of the thread which needed it and
+ * keeps separate group lists per node.  Threads allocate from the groups
+ * of the node they are running on and freed chunks always go back to
+ * their own group, so a thread does not end up being handed remote
+ * memory.  For the same reason, a NUMA manager does not use magazines,
+ * all allocations & frees take the manager lock.  How much memory sits
+ * on each node is kept in a mem monitor per node (see
+ * 'chunk_manager_node_mem_monitor').
  *
  */
 
@@ -92,6 +136,54 @@ typedef struct chunk_header_s chunk_header_t;
 typedef struct chunk_group_s chunk_group_t;
 typedef struct chunk_manager_s chunk_manager_t;
 
+/*
+ * Lock free stack head, a pointer and an ABA tag, see tagged_head.h
+ */
+typedef tagged_head_t chunk_stack_head_t;
+
+#define STACK_HEAD_PTR(h) \
+    ((chunk_header_t*) TAGGED_HEAD_PTR(h))
+#define STACK_HEAD_TAG(h)           TAGGED_HEAD_TAG(h)
+#define STACK_HEAD_MAKE(ptr, tag)   TAGGED_HEAD_MAKE(ptr, tag)
+#define STACK_HEAD_TAG_OF(hp)       TAGGED_HEAD_TAG_OF(hp)
+#define STACK_HEAD_READ(hp)         TAGGED_HEAD_READ(hp)
+
+/* NUMA nodes supported, higher numbered nodes wrap around */
+#define CHUNK_MAX_NUMA_NODES    8
+
+/*
+ * Groups with no free chunks left are on the CHUNK_GROUPS_FULL list,
+ * completely free groups on the CHUNK_GROUPS_EMPTY list and partially
+ * used groups are on one of the CHUNK_FULLNESS_BUCKETS lists in between,
+ * the fuller a group, the lower numbered its list.
+ */
+#define CHUNK_FULLNESS_BUCKETS  4
+#define CHUNK_GROUPS_FULL       0
+#define CHUNK_GROUPS_EMPTY      (CHUNK_FULLNESS_BUCKETS + 1)
+#define CHUNK_GROUP_LISTS       (CHUNK_FULLNESS_BUCKETS + 2)
+
+/* how many chunks a magazine can hold */
+#define CHUNK_MAGAZINE_SIZE     32
+
+typedef struct chunk_magazine_s {
+
+    chunk_header_t *chunks;
+    int n;
+
+} chunk_magazine_t;
+
+/*
+ * per thread slot magazine pair.  'busy' is needed only because
+ * more threads than MAX_THREAD_SLOTS may end up sharing a slot,
+ * it is otherwise never contended.
+ */
+typedef struct chunk_magazine_slot_s {
+
+    volatile int busy;
+    chunk_magazine_t loaded, previous;
+
+} __attribute__((aligned(CACHE_LINE_SIZE))) chunk_magazine_slot_t;
+
 struct chunk_manager_s {
 
     MEM_MON_VARIABLES;
@@ -104,18 +196,60 @@ struct chunk_manager_s {
     int chunk_size;
     int actual_chunk_size;
 
-    /* how many chunks per group is needed */
+    /*
+     * how many chunks per group is needed, rounded up to fill
+     * whole pages, and how they are laid out in pages
+     */
     int chunks_per_group;
+    int chunks_per_page;
+    int pages_per_group;
+
+    /*
+     * Every group keeps its own free chunks.  Groups are on one of
+     * these lists (per NUMA node, only node 0 is used if not NUMA aware)
+     * according to how many of their chunks are free.  See
+     * CHUNK_GROUPS_FULL & CHUNK_GROUPS_EMPTY.
+     */
+    chunk_group_t *group_lists [CHUNK_MAX_NUMA_NODES][CHUNK_GROUP_LISTS];
+    int n_groups;
+    int n_empty_groups;
 
     /*
-     * a linked list of all the free chunks in all the
-     * groups and their count
+     * when a group becomes completely free and there are already
+     * this many completely free groups, it is released right away
      */
-    chunk_header_t *free_chunks_list;
-    int n_cmgr_free;
+    int max_empty_groups;
 
-    /* a linked list of all the groups */
-    chunk_group_t *groups;
+    /*
+     * only when thread safe; MAX_THREAD_SLOTS of magazine pairs,
+     * 'magazines_block' is what was actually allocated & the
+     * magazines are cache line aligned inside it.
+     */
+    void *magazines_block;
+    chunk_magazine_slot_t *magazines;
+
+    /* are groups backed by huge pages */
+    boolean huge_pages;
+
+    /*
+     * is the manager NUMA aware.  If so, memory used by the groups
+     * of each node is kept track of in 'node_mem_mon', which is only
+     * allocated for NUMA aware managers.
+     */
+    boolean numa;
+    mem_monitor_t *node_mem_mon;
+
+    /* if set, the pages of every group are registered with this slab */
+    mem_slab_t *slab;
+
+    /*
+     * only when lock free; the free chunks stack and how many
+     * threads are in the middle of popping from it.
+     */
+    boolean lock_free;
+    volatile chunk_stack_head_t lock_free_head
+        __attribute__((aligned(sizeof(chunk_stack_head_t))));
+    volatile int lock_free_pops;
 
 };
 
@@ -123,6 +257,13 @@ struct chunk_manager_s {
  * Redefine these as per your own requirements
  */
 
+/*
+ * Chunks have no hidden header, their group is found by masking the
+ * chunk address down to a CHUNK_PAGE_SIZE boundary (must be a power
+ * of 2), where a pointer to the group is stored.
+ */
+#define CHUNK_PAGE_SIZE         (16 * 1024)
+
 #define MIN_CHUNK_SIZE          8
 #define MAX_CHUNK_SIZE          256
 #define MIN_CHUNKS_PER_GROUP    64
@@ -133,6 +274,8 @@ struct chunk_manager_s {
  * of each chunk guaranteed when returned to the user.
  * 'chunks_per_group' defines how many chunks will be created
  * all at once, in advance of calling the allocation function.
+ * It is rounded up so that the group fills whole CHUNK_PAGE_SIZE
+ * pages.
  * The higher this number, the more efficient the chunk manager
  * will run, but if you do not use all the chunks, memory will
  * have been wastefully allocated.  It is up to the user to
@@ -151,6 +294,57 @@ chunk_manager_init (chunk_manager_t *cmgrp,
     int chunk_size, int chunks_per_group,
     mem_monitor_t *parent_mem_monitor);
 
+/*
+ * Options which can be combined when initializing with
+ * 'chunk_manager_init_options'.  LOCK_FREE & NUMA cannot be used
+ * together and LOCK_FREE always makes the manager thread safe.
+ *
+ * HUGE_PAGES backs every group by huge pages (see
+ * 'mem_monitor_allocate_huge'), which cuts down TLB misses a lot when
+ * many millions of chunks are in use.  Groups are then rounded up to
+ * fill whole huge pages, so chunks_per_group becomes much bigger than
+ * requested for small chunk sizes.
+ */
+#define CHUNK_MANAGER_LOCK_FREE     0x1
+#define CHUNK_MANAGER_NUMA          0x2
+#define CHUNK_MANAGER_HUGE_PAGES    0x4
+
+extern int
+chunk_manager_init_options (chunk_manager_t *cmgrp,
+    boolean make_it_thread_safe, int options,
+    int chunk_size, int chunks_per_group,
+    mem_monitor_t *parent_mem_monitor);
+
+/*
+ * Same as 'chunk_manager_init' but the manager is always thread safe
+ * and allocates & frees chunks from a lock free stack rather than per
+ * thread magazines.
+ */
+extern int
+chunk_manager_init_lock_free (chunk_manager_t *cmgrp,
+    int chunk_size, int chunks_per_group,
+    mem_monitor_t *parent_mem_monitor);
+
+/*
+ * Same as 'chunk_manager_init' but NUMA aware as explained above.
+ */
+extern int
+chunk_manager_init_numa (chunk_manager_t *cmgrp,
+    boolean make_it_thread_safe,
+    int chunk_size, int chunks_per_group,
+    mem_monitor_t *parent_mem_monitor);
+
+/*
+ * memory used by the chunk groups placed on a NUMA node.  Returns
+ * NULL if the manager is not NUMA aware.
+ */
+static inline mem_monitor_t *
+chunk_manager_node_mem_monitor (chunk_manager_t *cmgrp, int node)
+{
+    return cmgrp->node_mem_mon ?
+        &cmgrp->node_mem_mon[node % CHUNK_MAX_NUMA_NODES] : NULL;
+}
+
 /*
  * returns a pointer to a memory block with a size specified
  * at the initialization of the chunk manager.  Do NOT access
@@ -168,6 +362,23 @@ chunk_alloc (chunk_manager_t *cmgrp);
 extern void
 chunk_free (void *chunk);
 
+/*
+ * Allocate up to 'n' chunks at once into 'chunks', much faster than
+ * calling 'chunk_alloc' 'n' times since the lock is taken at most once
+ * and chunks are taken off their groups in runs (or off the stack of
+ * a lock free manager with a single compare & swap).  Returns how many
+ * chunks were actually allocated, which is less than 'n' only if
+ * memory ran out.
+ */
+extern int
+chunk_alloc_bulk (chunk_manager_t *cmgrp, void *chunks [], int n);
+
+/*
+ * Free 'n' chunks at once.  They must ALL belong to the same manager.
+ */
+extern void
+chunk_free_bulk (void *chunks [], int n);
+
 /*
  * When chunks are allocated, they are also internally cached so that
  * they can be re allocated very quickly.  So, if the user allocates
@@ -186,6 +397,37 @@ chunk_free (void *chunk);
 extern int
 chunk_manager_trim (chunk_manager_t *cmgrp);
 
+/*
+ * Same as above but returns at most 'max_groups' groups back to the OS,
+ * so that the manager lock is held for a bounded time.  It can be
+ * called repeatedly (for example from a background thread) until it
+ * returns 0.  For lock free managers, all the free chunks still have
+ * to be looked at every time, regardless of 'max_groups'.
+ */
+extern int
+chunk_manager_trim_budget (chunk_manager_t *cmgrp, int max_groups);
+
+/*
+ * Register the pages of every group of this manager as a headerless
+ * slab of the mem monitor (see 'mem_monitor_register_slab') so that
+ * its chunks can be freed with 'mem_monitor_free'.  Must be done
+ * before any chunk is allocated, else EBUSY is returned.
+ */
+extern int
+chunk_manager_set_slab (chunk_manager_t *cmgrp, mem_slab_t *slab);
+
+/*
+ * Keep at most 'max_empty_groups' completely free groups around.  Any
+ * group becoming completely free beyond that is returned back to the OS
+ * immediately, in constant time, by the very call to 'chunk_free' which
+ * freed its last chunk.  Any extra free groups are returned right away.
+ * Does nothing for lock free managers, whose groups are only ever
+ * released by trimming.
+ */
+extern void
+chunk_manager_set_max_empty_groups (chunk_manager_t *cmgrp,
+    int max_empty_groups);
+
 /*
  * destroys the chunk manager object.  The object can no longer
  * be used until the next initialization.  The entire memory it uses
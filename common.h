@@ -103,6 +103,14 @@ typedef int boolean;
 #define TYPEDEF_BOOL
 #endif /* TYPEDEF_BOOL */
 
+/*
+ * size of a cpu cache line, used to pad data which is written
+ * by different threads so that they do not share cache lines.
+ */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE     64
+#endif /* CACHE_LINE_SIZE */
+
 /*************************************************************************/
 
 /*
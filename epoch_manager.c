@@ -0,0 +1,299 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#include "epoch_manager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* initial size of each retired list, doubles as needed */
+#define EPOCH_RETIRED_INITIAL_SIZE  64
+
+/*
+ * User data retired with a destruction handler is put on the retired
+ * lists as one of these, allocated from the epoch manager's monitor.
+ * Its pointer has the lowest bit set to tell it apart from a normal
+ * retired block.
+ */
+typedef struct epoch_retired_data_s {
+
+    destruction_handler_t dh;
+    void *data;
+    void *extra_arg;
+
+} epoch_retired_data_t;
+
+#define RETIRED_DATA_TAG            1UL
+
+/*
+ * frees all the blocks in one retired list of the thread
+ */
+static int
+free_retired_list (epoch_thread_t *etp, int list)
+{
+    int i, count = etp->n_retired[list];
+    epoch_retired_data_t *rdp;
+    void *ptr;
+
+    for (i = 0; i < count; i++) {
+        ptr = etp->retired[list][i];
+        if ((unsigned long) ptr & RETIRED_DATA_TAG) {
+            rdp = (epoch_retired_data_t*)
+                ((unsigned long) ptr & ~RETIRED_DATA_TAG);
+            rdp->dh(rdp->data, rdp->extra_arg);
+            ptr = rdp;
+        }
+        mem_monitor_free_retired(ptr);
+    }
+    etp->n_retired[list] = 0;
+    return count;
+}
+
+/*
+ * frees the lists of the thread which were retired at
+ * least two epochs before the current global epoch
+ */
+static int
+free_safe_retired_lists (epoch_thread_t *etp)
+{
+    unsigned long long global_epoch = etp->emp->global_epoch;
+    int list, freed = 0;
+
+    for (list = 0; list < EPOCH_LISTS; list++) {
+        if (etp->n_retired[list] &&
+            ((etp->retired_epoch[list] + 2) <= global_epoch)) {
+                freed += free_retired_list(etp, list);
+        }
+    }
+    return freed;
+}
+
+/*
+ * The global epoch can be moved forward only if every thread which is
+ * currently in a critical section has already observed it.
+ */
+static boolean
+try_advance_epoch (epoch_manager_t *emp)
+{
+    unsigned long long global_epoch = emp->global_epoch;
+    unsigned long long state;
+    epoch_thread_t *etp;
+    int t;
+
+    __sync_synchronize();
+    for (t = 0; t < emp->max_threads; t++) {
+        etp = &emp->threads[t];
+        state = etp->state;
+        if (etp->registered && EPOCH_STATE_DEPTH(state) &&
+            (EPOCH_STATE_EPOCH(state) != global_epoch)) {
+                return false;
+        }
+    }
+    return
+        __sync_bool_compare_and_swap(&emp->global_epoch,
+            global_epoch, global_epoch + 1);
+}
+
+static int
+grow_retired_list (epoch_thread_t *etp, int list)
+{
+    int new_size;
+    void **new_list;
+
+    new_size = etp->max_retired[list] ?
+        (etp->max_retired[list] * 2) : EPOCH_RETIRED_INITIAL_SIZE;
+    new_list = MEM_MONITOR_REALLOC(etp->emp, etp->retired[list],
+                    new_size * sizeof(void*));
+    if (NULL == new_list) return ENOMEM;
+    etp->retired[list] = new_list;
+    etp->max_retired[list] = new_size;
+    return 0;
+}
+
+/**************************** Initialize *************************************/
+
+PUBLIC int
+epoch_manager_init (epoch_manager_t *emp, int max_threads,
+    mem_monitor_t *parent_mem_monitor)
+{
+    int t;
+
+    if (max_threads <= 0) return EINVAL;
+
+    memset(emp, 0, sizeof(epoch_manager_t));
+    MEM_MONITOR_SETUP(emp);
+    emp->threads = MEM_MONITOR_ZALLOC(emp,
+                        max_threads * sizeof(epoch_thread_t));
+    if (NULL == emp->threads) return ENOMEM;
+    for (t = 0; t < max_threads; t++) emp->threads[t].emp = emp;
+    emp->max_threads = max_threads;
+    emp->global_epoch = EPOCH_LISTS;
+
+    return 0;
+}
+
+/**************************** Register ***************************************/
+
+PUBLIC int
+epoch_thread_register (epoch_manager_t *emp, epoch_thread_t **etp)
+{
+    int t;
+
+    for (t = 0; t < emp->max_threads; t++) {
+        if (__sync_bool_compare_and_swap(&emp->threads[t].registered,
+                0, 1)) {
+            emp->threads[t].state = 0;
+            emp->threads[t].retires = 0;
+            *etp = &emp->threads[t];
+            return 0;
+        }
+    }
+    *etp = NULL;
+    return ENOSPC;
+}
+
+PUBLIC void
+epoch_thread_unregister (epoch_thread_t *etp)
+{
+    int list;
+
+    assert(EPOCH_STATE_DEPTH(etp->state) == 0);
+
+    /* wait until everything we retired has become safe to free */
+    for (list = 0; list < EPOCH_LISTS; list++) {
+        while (etp->n_retired[list] &&
+            ((etp->retired_epoch[list] + 2) > etp->emp->global_epoch)) {
+                if (!try_advance_epoch(etp->emp)) sched_yield();
+        }
+        free_retired_list(etp, list);
+        MEM_MONITOR_FREE(etp->retired[list]);
+        etp->retired[list] = NULL;
+        etp->max_retired[list] = 0;
+    }
+    __sync_lock_release(&etp->registered);
+}
+
+/**************************** Retire *****************************************/
+
+/*
+ * 'block' is what is counted as deferred in its monitor and
+ * 'entry' is what goes on the retired list.
+ */
+static int
+retire_entry (epoch_thread_t *etp, void *block, void *entry)
+{
+    unsigned long long epoch = etp->emp->global_epoch;
+    int list = epoch % EPOCH_LISTS;
+
+    /*
+     * This list was last used at least EPOCH_LISTS epochs ago,
+     * so everything still in it can definitely be freed now.
+     */
+    if (etp->retired_epoch[list] != epoch) {
+        free_retired_list(etp, list);
+        etp->retired_epoch[list] = epoch;
+    }
+
+    if (etp->n_retired[list] >= etp->max_retired[list]) {
+        if (grow_retired_list(etp, list)) return ENOMEM;
+    }
+    mem_monitor_retire(block);
+    etp->retired[list][etp->n_retired[list]++] = entry;
+
+    if (++etp->retires >= EPOCH_ADVANCE_FREQUENCY) {
+        (void) epoch_reclaim(etp);
+    }
+    return 0;
+}
+
+PUBLIC int
+epoch_retire (epoch_thread_t *etp, void *ptr)
+{
+    return
+        retire_entry(etp, ptr, ptr);
+}
+
+PUBLIC int
+epoch_retire_data (epoch_thread_t *etp, void *data,
+    destruction_handler_t dh, void *extra_arg)
+{
+    epoch_retired_data_t *rdp;
+    int failed;
+
+    if (NULL == dh) return EINVAL;
+    rdp = MEM_MONITOR_ALLOC(etp->emp, sizeof(epoch_retired_data_t));
+    if (NULL == rdp) return ENOMEM;
+    rdp->dh = dh;
+    rdp->data = data;
+    rdp->extra_arg = extra_arg;
+    failed = retire_entry(etp, rdp,
+                (void*) ((unsigned long) rdp | RETIRED_DATA_TAG));
+    if (failed) MEM_MONITOR_FREE(rdp);
+    return failed;
+}
+
+PUBLIC int
+epoch_reclaim (epoch_thread_t *etp)
+{
+    etp->retires = 0;
+    (void) try_advance_epoch(etp->emp);
+    return
+        free_safe_retired_lists(etp);
+}
+
+/**************************** Destroy ****************************************/
+
+PUBLIC void
+epoch_manager_destroy (epoch_manager_t *emp)
+{
+    epoch_thread_t *etp;
+    int t, list;
+
+    for (t = 0; t < emp->max_threads; t++) {
+        etp = &emp->threads[t];
+        for (list = 0; list < EPOCH_LISTS; list++) {
+            free_retired_list(etp, list);
+            MEM_MONITOR_FREE(etp->retired[list]);
+        }
+    }
+    MEM_MONITOR_FREE(emp->threads);
+    memset(emp, 0, sizeof(epoch_manager_t));
+}
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
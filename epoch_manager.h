@@ -0,0 +1,253 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#ifndef __EPOCH_MANAGER_H__
+#define __EPOCH_MANAGER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <assert.h>
+#include <sched.h>
+
+#include "common.h"
+#include "mem_monitor_object.h"
+
+/******************************************************************************
+ *
+ * Epoch based memory reclamation.
+ *
+ * Objects whose readers do not take locks (or take them only
+ * optimistically) cannot free a node the moment it is removed, since a
+ * reader may still be looking at it.  Instead the node is 'retired' and
+ * freed later, once no reader can possibly have a reference to it.
+ *
+ * Every thread which reads or retires has to register with the epoch
+ * manager first and gets back a per thread record.  A reader brackets
+ * every access to the shared structure with 'epoch_enter' and
+ * 'epoch_exit' (these nest).  When entering, a thread records the
+ * current global epoch.  The global epoch can only move forward when
+ * every thread which is inside a critical section has seen the current
+ * epoch.  So a block retired during epoch 'e' can no longer be seen by
+ * anybody once the global epoch reaches 'e + 2', and it is then freed.
+ *
+ * Threads which are almost always reading can instead call
+ * 'epoch_quiescent' every now and then (QSBR style), which is the same
+ * as leaving the critical section and immediately entering it again.
+ *
+ * Retired blocks must have been allocated thru a mem monitor.  They stay
+ * counted in the 'bytes_used' of their monitor until they are actually
+ * freed and are also counted in its 'deferred_bytes' meanwhile.  Any
+ * other data can be retired with a destruction handler instead, which
+ * is called when the data would otherwise have been freed.
+ *
+ * Each thread keeps its own retired lists so retiring never contends
+ * with other threads.  A thread which stops retiring (or unregisters)
+ * leaves its blocks behind to be freed by 'epoch_thread_unregister' or
+ * 'epoch_manager_destroy'.
+ */
+
+typedef struct epoch_manager_s epoch_manager_t;
+typedef struct epoch_thread_s epoch_thread_t;
+
+/*
+ * blocks are retired into one of these many lists, depending on the
+ * epoch they were retired in.  Three is enough since only the
+ * current & the previous epochs can still be referenced.
+ */
+#define EPOCH_LISTS                 3
+
+/* how many retires before a thread tries to advance the epoch */
+#define EPOCH_ADVANCE_FREQUENCY     64
+
+/* split of the 'state' word of a thread record */
+#define EPOCH_DEPTH_BITS            16
+#define EPOCH_DEPTH_MASK            ((1ULL << EPOCH_DEPTH_BITS) - 1)
+#define EPOCH_STATE_DEPTH(state)    ((state) & EPOCH_DEPTH_MASK)
+#define EPOCH_STATE_EPOCH(state)    ((state) >> EPOCH_DEPTH_BITS)
+
+struct epoch_thread_s {
+
+    /* which epoch manager this belongs to */
+    epoch_manager_t *emp;
+
+    /* is this record taken by a thread */
+    volatile int registered;
+
+    /*
+     * critical section nesting depth in the lowest EPOCH_DEPTH_BITS
+     * and the global epoch observed when the outermost critical
+     * section was entered above them.  Both are kept in one word so
+     * that a record can also be shared by several threads (see
+     * 'epoch_enter').
+     */
+    volatile unsigned long long state;
+
+    /* retired blocks, per epoch they were retired in */
+    unsigned long long retired_epoch [EPOCH_LISTS];
+    void **retired [EPOCH_LISTS];
+    int n_retired [EPOCH_LISTS];
+    int max_retired [EPOCH_LISTS];
+
+    /* retires since the last time we tried advancing the epoch */
+    int retires;
+
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct epoch_manager_s {
+
+    MEM_MON_VARIABLES;
+
+    volatile unsigned long long global_epoch;
+
+    /* how many threads can be registered & their records */
+    int max_threads;
+    epoch_thread_t *threads;
+
+};
+
+/*
+ * Initializes the epoch manager for up to 'max_threads' registered
+ * threads.  Returns 0 or an errno.
+ */
+extern int
+epoch_manager_init (epoch_manager_t *emp, int max_threads,
+    mem_monitor_t *parent_mem_monitor);
+
+/*
+ * Registers the calling thread & returns its record in 'etp'.  Returns 0,
+ * or ENOSPC if 'max_threads' threads are already registered.
+ */
+extern int
+epoch_thread_register (epoch_manager_t *emp, epoch_thread_t **etp);
+
+/*
+ * Unregisters the thread.  It must not be in a critical section.
+ * Waits until everything it retired can be freed and frees it.
+ */
+extern void
+epoch_thread_unregister (epoch_thread_t *etp);
+
+/*
+ * A record may be entered by more than one thread at the same time,
+ * which is what lets lock objects index the records by 'thread_slot'
+ * instead of registering every thread.  Only the first thread in
+ * records the epoch, the others join it.  Since the recorded epoch
+ * can then only be older than the one they observed, this is safe,
+ * it just holds back the global epoch a little longer.
+ */
+static inline void
+epoch_enter (epoch_thread_t *etp)
+{
+    unsigned long long state, new_state;
+
+    do {
+        state = etp->state;
+        if (EPOCH_STATE_DEPTH(state)) {
+            new_state = state + 1;
+        } else {
+            new_state = (etp->emp->global_epoch << EPOCH_DEPTH_BITS) | 1;
+        }
+    } while (!__sync_bool_compare_and_swap(&etp->state, state, new_state));
+}
+
+static inline void
+epoch_exit (epoch_thread_t *etp)
+{
+    __sync_fetch_and_sub(&etp->state, 1);
+}
+
+/*
+ * Only for records used by a single thread, since it moves the
+ * recorded epoch forward for everybody in the record.
+ */
+static inline void
+epoch_quiescent (epoch_thread_t *etp)
+{
+    unsigned long long state, new_state;
+
+    do {
+        state = etp->state;
+        new_state = (etp->emp->global_epoch << EPOCH_DEPTH_BITS) |
+            EPOCH_STATE_DEPTH(state);
+    } while (!__sync_bool_compare_and_swap(&etp->state, state, new_state));
+}
+
+/*
+ * Retires a block allocated thru a mem monitor which has already been
+ * made unreachable for new readers.  It will be freed when no reader
+ * can be referencing it any more.  Returns 0, or ENOMEM if the block
+ * could not be recorded, in which case it has NOT been retired and it
+ * is up to the caller what to do with it.
+ */
+extern int
+epoch_retire (epoch_thread_t *etp, void *ptr);
+
+/*
+ * Same as 'epoch_retire' but for user data which was not allocated
+ * thru a mem monitor (or not by us).  Instead of being freed, the data
+ * is handed to 'dh' together with 'extra_arg' when no reader can be
+ * referencing it any more.  Returns 0, EINVAL if 'dh' is NULL or
+ * ENOMEM, in which case the data has NOT been retired.
+ */
+extern int
+epoch_retire_data (epoch_thread_t *etp, void *data,
+    destruction_handler_t dh, void *extra_arg);
+
+/*
+ * Tries to move the global epoch forward and frees whatever the
+ * calling thread retired which has become safe to free.  This is
+ * called automatically every EPOCH_ADVANCE_FREQUENCY retires but can
+ * also be called explicitly.  Returns the number of blocks freed.
+ */
+extern int
+epoch_reclaim (epoch_thread_t *etp);
+
+/*
+ * Frees everything still waiting to be freed.  No thread may be
+ * in a critical section or use the manager during or after this.
+ */
+extern void
+epoch_manager_destroy (epoch_manager_t *emp);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif // __EPOCH_MANAGER_H__
+
+
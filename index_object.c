@@ -30,17 +30,41 @@
 extern "C" {
 #endif
 
+/*
+ * The element array is preceded by a hidden slot holding its capacity,
+ * so that a lockless reader always knows how far it can index whatever
+ * array it picked up, even after it has been shrunk & replaced by the
+ * writers (see 'index_optimistic_search').
+ */
+#define index_elements_capacity(elements) \
+    ((int) pointer2integer((elements)[-1]))
+
+#define index_elements_block(elements)      (&(elements)[-1])
+
+static void **
+index_elements_allocate (index_obj_t *idx, int size)
+{
+    void **block = MEM_MONITOR_ZALLOC(idx, (size + 1) * sizeof(void*));
+
+    if (NULL == block) return NULL;
+    block[0] = integer2pointer(size);
+    return &block[1];
+}
+
 static int
 index_resize (index_obj_t *idx, int new_size)
 {
-    void **new_elements;
+    void **new_elements, **old_elements;
 
-    new_elements = MEM_MONITOR_ZALLOC(idx, new_size * sizeof(void*));
+    new_elements = index_elements_allocate(idx, new_size);
     if (NULL == new_elements) return ENOMEM;
     copy_pointer_blocks(idx->elements, new_elements, idx->n);
-    MEM_MONITOR_FREE(idx->elements);
-    idx->elements = new_elements;
+    old_elements = idx->elements;
+
+    /* the new array & its capacity must be complete before it is seen */
+    __atomic_store_n(&idx->elements, new_elements, __ATOMIC_RELEASE);
     idx->maximum_size = new_size;
+    OBJ_MEMORY_FREE(idx, index_elements_block(old_elements));
     return 0;
 }
 
@@ -79,6 +103,49 @@ index_find_position (index_obj_t *idx,
     return -1;
 }
 
+/*
+ * Lockless binary search used when the index allows optimistic reads.
+ * 'n' and 'elements' may belong to different versions of the index
+ * since writers may be changing them under us, so the search is
+ * clamped to the capacity of the array actually picked up.  The
+ * caller decides whether the result can be trusted and re-tries if not.
+ */
+static void *
+index_optimistic_search (index_obj_t *idx, void *searched_data,
+        boolean *found)
+{
+    int mid, diff, lo, hi, capacity;
+    void **elements, *data;
+
+    hi = __atomic_load_n(&idx->n, __ATOMIC_ACQUIRE);
+    elements = __atomic_load_n(&idx->elements, __ATOMIC_ACQUIRE);
+    capacity = index_elements_capacity(elements);
+    if (hi > capacity) hi = capacity;
+    hi--;
+    lo = 0;
+    while (lo <= hi) {
+        mid = (hi+lo) >> 1;
+        data = elements[mid];
+
+        /*
+         * unused slot of a freshly resized array, only possible
+         * while a writer is at work, so this read will be re-tried
+         */
+        if (NULL == data) break;
+        diff = (idx->cmpf)(searched_data, data);
+        if (diff > 0) {
+            lo = mid + 1;
+        } else if (diff < 0) {
+            hi = mid - 1;
+        } else {
+            *found = true;
+            return data;
+        }
+    }
+    *found = false;
+    return NULL;
+}
+
 static int
 thread_unsafe_index_obj_insert (index_obj_t *idx,
         void *data,
@@ -236,7 +303,7 @@ index_obj_init (index_obj_t *idx,
     idx->n = 0;
     idx->current = 0;
     reset_stats(idx);
-    idx->elements = MEM_MONITOR_ZALLOC(idx, sizeof(void*) * maximum_size);
+    idx->elements = index_elements_allocate(idx, maximum_size);
     if (NULL == idx->elements) {
         failed = EINVAL;
     }
@@ -254,10 +321,20 @@ index_obj_insert (index_obj_t *idx,
 {
     int failed;
 
+    /* a reclaim function may well want to trim this very index */
+    mem_monitor_defer_reclaim_begin();
     OBJ_WRITE_LOCK(idx);
     failed = thread_unsafe_index_obj_insert(idx, data,
                 present_data, overwrite_if_present);
     OBJ_WRITE_UNLOCK(idx);
+    if (mem_monitor_defer_reclaim_end() && (ENOMEM == failed)) {
+        mem_monitor_defer_reclaim_begin();
+        OBJ_WRITE_LOCK(idx);
+        failed = thread_unsafe_index_obj_insert(idx, data,
+                    present_data, overwrite_if_present);
+        OBJ_WRITE_UNLOCK(idx);
+        (void) mem_monitor_defer_reclaim_end();
+    }
     return failed;
 }
 
@@ -269,6 +346,20 @@ index_obj_search (index_obj_t *idx,
         void **present_data)
 {
     int failed;
+    unsigned int sequence;
+    boolean found;
+    void *user_data;
+
+    if (OBJ_OPTIMISTIC_READS(idx)) {
+        do {
+            sequence = lock_obj_optimistic_read_begin(idx->lock);
+            user_data = index_optimistic_search(idx, data, &found);
+        } while (!lock_obj_optimistic_read_end(idx->lock, sequence));
+        safe_pointer_set(present_data, user_data);
+        search_stats_update(idx, !found);
+        return
+            found ? 0 : ENODATA;
+    }
 
     OBJ_READ_LOCK(idx);
     failed = thread_unsafe_index_obj_search(idx, data, present_data);
@@ -291,6 +382,22 @@ index_obj_remove (index_obj_t *idx,
     return failed;
 }
 
+PUBLIC int
+index_obj_remove_retire (index_obj_t *idx,
+        void *data,
+        destruction_handler_t dh, void *extra_arg)
+{
+    void *removed;
+    int failed;
+
+    if (NULL == dh) return EINVAL;
+    OBJ_WRITE_LOCK(idx);
+    failed = thread_unsafe_index_obj_remove(idx, data, &removed);
+    if (0 == failed) OBJ_DATA_RETIRE(idx, removed, dh, extra_arg);
+    OBJ_WRITE_UNLOCK(idx);
+    return failed;
+}
+
 /**************************** Get all entries ********************************/
 
 PUBLIC void
@@ -333,17 +440,28 @@ index_obj_traverse (index_obj_t *idx,
 
 #define INDEX_OBJ_BLOAT     4
 
-PUBLIC int
-index_obj_trim (index_obj_t *idx)
+static int
+thread_unsafe_index_obj_trim (index_obj_t *idx)
 {
-    int failed = 0;
     int bloated = idx->n + INDEX_OBJ_BLOAT;
 
-    OBJ_WRITE_LOCK(idx);
     if (idx->maximum_size > bloated) {
-        failed = index_resize(idx, bloated);
+        return
+            index_resize(idx, bloated);
     }
+    return 0;
+}
+
+PUBLIC int
+index_obj_trim (index_obj_t *idx)
+{
+    int failed;
+
+    mem_monitor_defer_reclaim_begin();
+    OBJ_WRITE_LOCK(idx);
+    failed = thread_unsafe_index_obj_trim(idx);
     OBJ_WRITE_UNLOCK(idx);
+    (void) mem_monitor_defer_reclaim_end();
     return failed;
 }
 
@@ -352,10 +470,12 @@ index_obj_trim (index_obj_t *idx)
 PUBLIC void
 index_obj_reset (index_obj_t *idx)
 {
+    mem_monitor_defer_reclaim_begin();
     OBJ_WRITE_LOCK(idx);
     idx->n = 0;
-    index_obj_trim(idx);
+    thread_unsafe_index_obj_trim(idx);
     OBJ_WRITE_UNLOCK(idx);
+    (void) mem_monitor_defer_reclaim_end();
 }
 
 /**************************** Destroy ****************************************/
@@ -379,7 +499,7 @@ index_obj_destroy (index_obj_t *idx,
             for (i = 0; i < idx->n; i++)
                 dh_fptr(idx->elements[i], extra_arg);
         }
-        MEM_MONITOR_FREE(idx->elements);
+        MEM_MONITOR_FREE(index_elements_block(idx->elements));
     }
     OBJ_WRITE_UNLOCK(idx);
     LOCK_OBJ_DESTROY(idx);
@@ -67,7 +67,7 @@ typedef struct index_obj_s {
     int maximum_size;
     int expansion_size;
     int n;
-    void **elements;
+    void **elements;       /* preceded by its capacity, see .c file */
 
     /* used for traversing */
     int current;
@@ -134,6 +134,18 @@ index_obj_remove (index_obj_t *idx,
         void *data,
         void **data_removed);
 
+/*
+ * Same as above but what is removed is disposed of by calling 'dh' with
+ * it & 'extra_arg'.  If the index allows optimistic searches
+ * (LOCK_TYPE_SEQLOCK), 'dh' is called only once no search can still
+ * be looking at the data, so removed data of such an index must be
+ * freed this way and never after a plain 'index_obj_remove'.
+ */
+extern int
+index_obj_remove_retire (index_obj_t *idx,
+        void *data,
+        destruction_handler_t dh, void *extra_arg);
+
 /**************************** Get all entries ********************************
  *
  * Get a snapshot of all the data pointers in the object.  The user
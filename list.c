@@ -381,8 +381,8 @@ list_destroy (list_t *list)
         node = next_node;
     }
     OBJ_WRITE_UNLOCK(list);
+    LOCK_OBJ_DESTROY(list);
     memset(list, 0, sizeof(list_t));
-    lock_obj_destroy(list->lock);
 }
 
 #ifdef __cplusplus
@@ -25,6 +25,13 @@
 ******************************************************************************/
 
 #include "lock_object.h"
+#include "mem_monitor_object.h"
+#include "epoch_manager.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -60,19 +67,49 @@ holdoff (lock_obj_t *lck)
 #endif
 }
 
-#define PUBLIC
+/*
+ * tell the cpu we are busy waiting so it can relax the
+ * pipeline and let the sibling hyper thread run
+ */
+static inline void
+cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+}
 
-/******* Public functions start here *****************************************/
+/*
+ * Bounded exponential backoff for the spinning lock types.  The
+ * number of pauses doubles every time we are called until it
+ * reaches the limit, after which the cpu is simply yielded.
+ */
+#define MIN_BACKOFF_SPINS       4
+#define MAX_BACKOFF_SPINS       64
 
-PUBLIC int 
-lock_obj_init (lock_obj_t *lck /*, int yield_if_locked */)
+static inline void
+backoff (int *spins)
 {
-    memset((void*) lck, 0, sizeof(lock_obj_t));
-    return 0;
+    int i;
+
+    if (*spins >= MAX_BACKOFF_SPINS) {
+        sched_yield();
+        return;
+    }
+    for (i = 0; i < *spins; i++) cpu_relax();
+    *spins <<= 1;
 }
 
+#define PUBLIC
+
+/******* LOCK_TYPE_SPIN_YIELD ************************************************/
+
 static int 
-_read_lock (lock_obj_t *lck, boolean block)
+spin_yield_read_lock (lock_obj_t *lck, boolean block)
 {
     while (1) {
         if (ttas(&lck->mtx, 0, 1)) {
@@ -91,12 +128,8 @@ _read_lock (lock_obj_t *lck, boolean block)
     }
 }
 
-PUBLIC void
-grab_read_lock (lock_obj_t *lck)
-{ (void) _read_lock(lck, true); }
-
-PUBLIC void 
-release_read_lock (lock_obj_t *lck)
+static void 
+spin_yield_read_unlock (lock_obj_t *lck)
 {
     while (1) {
         if (ttas(&lck->mtx, 0, 1)) {
@@ -109,7 +142,7 @@ release_read_lock (lock_obj_t *lck)
 }
 
 static int
-_write_lock (lock_obj_t *lck, boolean block)
+spin_yield_write_lock (lock_obj_t *lck, boolean block)
 {
     while (1) {
         if (ttas(&lck->mtx, 0, 1)) {
@@ -135,12 +168,8 @@ _write_lock (lock_obj_t *lck, boolean block)
     }
 }
 
-PUBLIC void
-grab_write_lock (lock_obj_t *lck)
-{ return (void) _write_lock(lck, true); }
-
-PUBLIC void 
-release_write_lock (lock_obj_t *lck)
+static void 
+spin_yield_write_unlock (lock_obj_t *lck)
 {
     while (1) {
         if (ttas(&lck->mtx, 0, 1)) {
@@ -152,10 +181,583 @@ release_write_lock (lock_obj_t *lck)
     }
 }
 
+/******* LOCK_TYPE_PHASE_FAIR ************************************************
+ *
+ * Phase fair ticket reader/writer lock (Brandenburg & Anderson).
+ *
+ * Readers take a ticket by adding PF_RINC to 'rin' and leave by adding
+ * PF_RINC to 'rout'.  Writers queue up in FIFO order on the 'win'/'wout'
+ * ticket pair.  The writer at the head of the queue then sets the
+ * writer present bit (plus its phase bit) in 'rin', which blocks all
+ * newly arriving readers, and waits until all readers which arrived
+ * before it have left ('rout' catches up).  Readers blocked by a writer
+ * only wait until the writer phase bits change, ie until THAT writer
+ * is done, so readers & writers alternate and nobody starves.
+ *
+ * Every waiter spins on a variable it only reads, with bounded backoff.
+ */
+
+#define PF_RINC         0x100       /* reader ticket increment */
+#define PF_WBITS        0x3         /* writer bits in 'rin' */
+#define PF_PRES         0x2         /* writer present */
+#define PF_PHID         0x1         /* writer phase id */
+
+static void
+phase_fair_read_lock (lock_obj_t *lck)
+{
+    unsigned int w;
+    int spins = MIN_BACKOFF_SPINS;
+
+    w = __sync_fetch_and_add(&lck->rin, PF_RINC) & PF_WBITS;
+    while ((w != 0) && (w == (lck->rin & PF_WBITS))) backoff(&spins);
+    __sync_synchronize();
+}
+
+static void
+phase_fair_read_unlock (lock_obj_t *lck)
+{
+    __sync_fetch_and_add(&lck->rout, PF_RINC);
+}
+
+static void
+phase_fair_write_lock (lock_obj_t *lck)
+{
+    unsigned int ticket, w;
+    int spins = MIN_BACKOFF_SPINS;
+
+    /* wait for our turn amongst the writers */
+    ticket = __sync_fetch_and_add(&lck->win, 1);
+    while (ticket != lck->wout) backoff(&spins);
+
+    /* block new readers & wait for the present ones to drain */
+    w = PF_PRES | (ticket & PF_PHID);
+    ticket = __sync_fetch_and_add(&lck->rin, w);
+    spins = MIN_BACKOFF_SPINS;
+    while (ticket != lck->rout) backoff(&spins);
+    __sync_synchronize();
+}
+
+static void
+phase_fair_write_unlock (lock_obj_t *lck)
+{
+    __sync_fetch_and_and(&lck->rin, ~PF_WBITS);
+    __sync_fetch_and_add(&lck->wout, 1);
+}
+
+/******* LOCK_TYPE_FUTEX *****************************************************
+ *
+ * The state ('readers', 'writing' & the waiter counts) is protected by
+ * the 'mtx' byte, which is only ever held for a few instructions and
+ * never across a system call.  A waiter first retries for a little
+ * while with backoff and then parks itself on one of the two wakeup
+ * futex words, after noting its value.  Whoever wakes it up increments
+ * that word before calling the kernel so a wake up which happens
+ * between the noting & the parking is never lost.
+ *
+ * Writers have preference: once a writer wants the lock, new readers
+ * wait, so a stream of readers cannot starve out a writer.
+ */
+
+#define ADAPTIVE_SPIN_TRIES     100
+
+static inline void
+futex_wait (volatile int *word, int value)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+#else
+    if (*word == value) sched_yield();
+#endif
+}
+
+static inline void
+futex_wake (volatile int *word, int how_many)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, how_many, NULL, NULL, 0);
+#else
+    SUPPRESS_UNUSED_VARIABLE_COMPILER_WARNING(word);
+    SUPPRESS_UNUSED_VARIABLE_COMPILER_WARNING(how_many);
+#endif
+}
+
+static inline void
+state_lock (lock_obj_t *lck)
+{
+    while (!ttas(&lck->mtx, 0, 1)) cpu_relax();
+}
+
+static inline void
+state_unlock (lock_obj_t *lck)
+{
+    __sync_lock_release(&lck->mtx);
+}
+
+/*
+ * spin a little before re-checking the lock, but do not ever yield,
+ * parking in the kernel is the slow path for this lock type
+ */
+static inline void
+adaptive_spin (int tries)
+{
+    int i, spins = MIN_BACKOFF_SPINS << (tries & 3);
+
+    for (i = 0; i < spins; i++) cpu_relax();
+}
+
+static void
+futex_read_lock (lock_obj_t *lck)
+{
+    int tries = 0, seq;
+    boolean parked = false;
+
+    while (1) {
+        state_lock(lck);
+        if (parked) {
+            lck->readers_parked--;
+            parked = false;
+        }
+        if (!lck->writing && (lck->writers_waiting <= 0)) {
+            lck->readers++;
+            state_unlock(lck);
+            return;
+        }
+        if (tries < ADAPTIVE_SPIN_TRIES) {
+            state_unlock(lck);
+            adaptive_spin(tries++);
+            continue;
+        }
+        lck->readers_parked++;
+        parked = true;
+        seq = lck->readers_wakeup;
+        state_unlock(lck);
+        futex_wait(&lck->readers_wakeup, seq);
+    }
+}
+
+/*
+ * must be called with the state locked.  If all the writers which
+ * want the lock are sleeping, one of them has to be woken up since
+ * there is nobody else who will take the lock.  Returns true if
+ * 'futex_wake' needs to be called after the state is unlocked.
+ */
+static inline boolean
+writer_needs_waking (lock_obj_t *lck)
+{
+    if ((lck->writers_waiting > 0) &&
+        (lck->writers_parked >= lck->writers_waiting)) {
+            lck->writers_wakeup++;
+            return true;
+    }
+    return false;
+}
+
+static void
+futex_read_unlock (lock_obj_t *lck)
+{
+    boolean wake_writer = false;
+
+    state_lock(lck);
+    if (--lck->readers <= 0) {
+        lck->readers = 0;
+        wake_writer = writer_needs_waking(lck);
+    }
+    state_unlock(lck);
+    if (wake_writer) futex_wake(&lck->writers_wakeup, 1);
+}
+
+static void
+futex_write_lock (lock_obj_t *lck)
+{
+    int tries = 0, seq;
+    boolean parked = false;
+
+    state_lock(lck);
+    lck->writers_waiting++;
+    state_unlock(lck);
+    while (1) {
+        state_lock(lck);
+        if (parked) {
+            lck->writers_parked--;
+            parked = false;
+        }
+        if (!lck->writing && (lck->readers <= 0)) {
+            lck->writing = true;
+            lck->writers_waiting--;
+            state_unlock(lck);
+            return;
+        }
+        if (tries < ADAPTIVE_SPIN_TRIES) {
+            state_unlock(lck);
+            adaptive_spin(tries++);
+            continue;
+        }
+        lck->writers_parked++;
+        parked = true;
+        seq = lck->writers_wakeup;
+        state_unlock(lck);
+        futex_wait(&lck->writers_wakeup, seq);
+    }
+}
+
+static void
+futex_write_unlock (lock_obj_t *lck)
+{
+    boolean wake_writer, wake_readers = false;
+
+    state_lock(lck);
+    lck->writing = false;
+    wake_writer = writer_needs_waking(lck);
+    if ((lck->writers_waiting <= 0) && (lck->readers_parked > 0)) {
+        lck->readers_wakeup++;
+        wake_readers = true;
+    }
+    state_unlock(lck);
+    if (wake_writer) futex_wake(&lck->writers_wakeup, 1);
+    if (wake_readers) futex_wake(&lck->readers_wakeup, INT32_MAX);
+}
+
+/******* LOCK_TYPE_BIG_READER ************************************************
+ *
+ * A reader only ever writes to its own slot's counter.  It increments
+ * it and then checks whether a writer is present.  A writer first sets
+ * the writer present flag ('mtx') and then waits for every slot to
+ * become 0.  Since both sides do a full barrier between their write &
+ * their read, either the reader sees the writer and backs out, or the
+ * writer sees the reader and waits for it.
+ */
+
+static volatile int next_thread_slot = 0;
+static __thread int my_thread_slot = -1;
+
+static int
+big_reader_init (lock_obj_t *lck)
+{
+    void *slots;
+
+    if (posix_memalign(&slots, CACHE_LINE_SIZE,
+            MAX_THREAD_SLOTS * sizeof(lock_reader_slot_t))) {
+        return ENOMEM;
+    }
+    memset(slots, 0, MAX_THREAD_SLOTS * sizeof(lock_reader_slot_t));
+    lck->reader_slots = (lock_reader_slot_t*) slots;
+    return 0;
+}
+
+static void
+big_reader_read_lock (lock_obj_t *lck)
+{
+    volatile int *readers = &lck->reader_slots[thread_slot()].readers;
+    int spins;
+
+    while (1) {
+        __sync_fetch_and_add(readers, 1);
+        if (lck->mtx == 0) return;
+
+        /* a writer is in or coming in, get out of its way */
+        __sync_fetch_and_sub(readers, 1);
+        spins = MIN_BACKOFF_SPINS;
+        while (lck->mtx) backoff(&spins);
+    }
+}
+
+static void
+big_reader_read_unlock (lock_obj_t *lck)
+{
+    __sync_fetch_and_sub(&lck->reader_slots[thread_slot()].readers, 1);
+}
+
+static void
+big_reader_write_lock (lock_obj_t *lck)
+{
+    int s, spins = MIN_BACKOFF_SPINS;
+
+    while (!ttas(&lck->mtx, 0, 1)) backoff(&spins);
+    for (s = 0; s < MAX_THREAD_SLOTS; s++) {
+        spins = MIN_BACKOFF_SPINS;
+        while (lck->reader_slots[s].readers) backoff(&spins);
+    }
+    __sync_synchronize();
+}
+
+static void
+big_reader_write_unlock (lock_obj_t *lck)
+{
+    __sync_lock_release(&lck->mtx);
+}
+
+/******* LOCK_TYPE_SEQLOCK ***************************************************
+ *
+ * Normal (pessimistic) readers & writers exclude each other exactly like
+ * the big reader lock.  On top of that, writers make the sequence odd
+ * while they hold the lock.  Optimistic readers are inside an epoch
+ * critical section (on the epoch record of their thread slot) for the
+ * duration of their read, and enter it only while the sequence is
+ * even, so they never hold the epoch back waiting for a writer.
+ * Retired memory is then freed by the epoch manager once none of the
+ * optimistic readers which could have seen it is still reading.
+ */
+
+#define SEQLOCK_WRITER_RECORD(lck) \
+    (&(lck)->epochs->threads[MAX_THREAD_SLOTS])
+
+#define SEQLOCK_READER_RECORD(lck) \
+    (&(lck)->epochs->threads[thread_slot()])
+
+static int
+seqlock_init (lock_obj_t *lck)
+{
+    epoch_thread_t *etp;
+    int t, failed = big_reader_init(lck);
+
+    if (failed) return failed;
+    lck->epochs = malloc(sizeof(epoch_manager_t));
+    if (lck->epochs) {
+        failed = epoch_manager_init(lck->epochs, MAX_THREAD_SLOTS + 1, NULL);
+        if (failed) {
+            free(lck->epochs);
+            lck->epochs = NULL;
+        }
+    }
+    if (NULL == lck->epochs) {
+        free(lck->reader_slots);
+        lck->reader_slots = NULL;
+        return ENOMEM;
+    }
+
+    /* records are handed out in order, so record 't' is thread slot 't' */
+    for (t = 0; t <= MAX_THREAD_SLOTS; t++) {
+        (void) epoch_thread_register(lck->epochs, &etp);
+    }
+    return 0;
+}
+
+static void
+seqlock_write_lock (lock_obj_t *lck)
+{
+    big_reader_write_lock(lck);
+    __sync_fetch_and_add(&lck->sequence, 1);
+}
+
+static void
+seqlock_write_unlock (lock_obj_t *lck)
+{
+    __sync_fetch_and_add(&lck->sequence, 1);
+    big_reader_write_unlock(lck);
+}
+
+/*
+ * Only used when a block could not be retired.  The writer holds the
+ * lock so no new optimistic reader can start, wait for the ones which
+ * are still reading to finish.
+ */
+static void
+wait_for_optimistic_readers (lock_obj_t *lck)
+{
+    int s, spins;
+
+    for (s = 0; s < MAX_THREAD_SLOTS; s++) {
+        spins = MIN_BACKOFF_SPINS;
+        while (EPOCH_STATE_DEPTH(lck->epochs->threads[s].state)) {
+            backoff(&spins);
+        }
+    }
+    __sync_synchronize();
+}
+
+/******* Public functions start here *****************************************/
+
+PUBLIC int
+thread_slot (void)
+{
+    if (my_thread_slot < 0) {
+        my_thread_slot =
+            __sync_fetch_and_add(&next_thread_slot, 1) % MAX_THREAD_SLOTS;
+    }
+    return my_thread_slot;
+}
+
+PUBLIC int 
+lock_obj_init (lock_obj_t *lck)
+{
+    return
+        lock_obj_init_type(lck, LOCK_TYPE_DEFAULT);
+}
+
+PUBLIC int
+lock_obj_init_type (lock_obj_t *lck, int type)
+{
+    memset((void*) lck, 0, sizeof(lock_obj_t));
+    lck->type = type;
+    switch (type) {
+    case LOCK_TYPE_SPIN_YIELD:
+    case LOCK_TYPE_PHASE_FAIR:
+    case LOCK_TYPE_FUTEX:
+        return 0;
+    case LOCK_TYPE_BIG_READER:
+        return
+            big_reader_init(lck);
+    case LOCK_TYPE_SEQLOCK:
+        return
+            seqlock_init(lck);
+    }
+    return EINVAL;
+}
+
+PUBLIC void
+grab_read_lock (lock_obj_t *lck)
+{
+    switch (lck->type) {
+    case LOCK_TYPE_PHASE_FAIR:
+        phase_fair_read_lock(lck);
+        break;
+    case LOCK_TYPE_FUTEX:
+        futex_read_lock(lck);
+        break;
+    case LOCK_TYPE_BIG_READER:
+        big_reader_read_lock(lck);
+        break;
+    case LOCK_TYPE_SEQLOCK:
+        big_reader_read_lock(lck);
+        break;
+    default:
+        (void) spin_yield_read_lock(lck, true);
+        break;
+    }
+}
+
+PUBLIC void 
+release_read_lock (lock_obj_t *lck)
+{
+    switch (lck->type) {
+    case LOCK_TYPE_PHASE_FAIR:
+        phase_fair_read_unlock(lck);
+        break;
+    case LOCK_TYPE_FUTEX:
+        futex_read_unlock(lck);
+        break;
+    case LOCK_TYPE_BIG_READER:
+        big_reader_read_unlock(lck);
+        break;
+    case LOCK_TYPE_SEQLOCK:
+        big_reader_read_unlock(lck);
+        break;
+    default:
+        spin_yield_read_unlock(lck);
+        break;
+    }
+}
+
+PUBLIC void
+grab_write_lock (lock_obj_t *lck)
+{
+    switch (lck->type) {
+    case LOCK_TYPE_PHASE_FAIR:
+        phase_fair_write_lock(lck);
+        break;
+    case LOCK_TYPE_FUTEX:
+        futex_write_lock(lck);
+        break;
+    case LOCK_TYPE_BIG_READER:
+        big_reader_write_lock(lck);
+        break;
+    case LOCK_TYPE_SEQLOCK:
+        seqlock_write_lock(lck);
+        break;
+    default:
+        (void) spin_yield_write_lock(lck, true);
+        break;
+    }
+}
+
+PUBLIC void 
+release_write_lock (lock_obj_t *lck)
+{
+    switch (lck->type) {
+    case LOCK_TYPE_PHASE_FAIR:
+        phase_fair_write_unlock(lck);
+        break;
+    case LOCK_TYPE_FUTEX:
+        futex_write_unlock(lck);
+        break;
+    case LOCK_TYPE_BIG_READER:
+        big_reader_write_unlock(lck);
+        break;
+    case LOCK_TYPE_SEQLOCK:
+        seqlock_write_unlock(lck);
+        break;
+    default:
+        spin_yield_write_unlock(lck);
+        break;
+    }
+}
+
+PUBLIC unsigned int
+lock_obj_optimistic_read_begin (lock_obj_t *lck)
+{
+    epoch_thread_t *etp = SEQLOCK_READER_RECORD(lck);
+    unsigned int sequence;
+    int spins = MIN_BACKOFF_SPINS;
+
+    while (1) {
+        sequence = lck->sequence;
+        if (0 == (sequence & 1)) {
+            epoch_enter(etp);
+            if (__atomic_load_n(&lck->sequence, __ATOMIC_ACQUIRE) ==
+                    sequence) {
+                return sequence;
+            }
+            epoch_exit(etp);
+        }
+        backoff(&spins);
+    }
+}
+
+PUBLIC boolean
+lock_obj_optimistic_read_end (lock_obj_t *lck, unsigned int sequence)
+{
+    boolean valid;
+
+    __sync_synchronize();
+    valid = (lck->sequence == sequence);
+    epoch_exit(SEQLOCK_READER_RECORD(lck));
+    return valid;
+}
+
+PUBLIC void
+lock_obj_retire (lock_obj_t *lck, void *ptr)
+{
+    if (epoch_retire(SEQLOCK_WRITER_RECORD(lck), ptr)) {
+        wait_for_optimistic_readers(lck);
+        mem_monitor_free(ptr);
+    }
+}
+
+PUBLIC void
+lock_obj_retire_data (lock_obj_t *lck, void *data,
+    destruction_handler_t dh, void *extra_arg)
+{
+    if (epoch_retire_data(SEQLOCK_WRITER_RECORD(lck), data, dh, extra_arg)) {
+        wait_for_optimistic_readers(lck);
+        dh(data, extra_arg);
+    }
+}
+
+/*
+ * Nobody may be using the lock at this point so whatever
+ * was retired can be freed without waiting.
+ */
 void
 lock_obj_destroy (lock_obj_t *lck)
 {
-    if (lck) memset(lck, 0, sizeof(lock_obj_t));
+    if (lck) {
+        if (lck->epochs) {
+            epoch_manager_destroy(lck->epochs);
+            free(lck->epochs);
+        }
+        if (lck->reader_slots) free(lck->reader_slots);
+        memset(lck, 0, sizeof(lock_obj_t));
+    }
 }
 
 #ifdef __cplusplus
@@ -45,6 +45,65 @@
 **        write locking is attempted.
 **      - read locks will not starve out a write lock.
 **
+** More than one locking algorithm is available.  The algorithm is
+** chosen at initialization time and does not change afterwards.
+** All of them are used thru the same grab/release functions, so
+** the code using the lock does not need to know which one it has.
+**
+**      - LOCK_TYPE_SPIN_YIELD is the original lock.  Every reader and
+**        writer serializes on a single compare & swap byte and yields
+**        the cpu every time it fails to get it.  Cheap & small, fine
+**        for low thread counts.
+**
+**      - LOCK_TYPE_PHASE_FAIR is a phase fair reader/writer ticket
+**        lock.  Writers are served strictly in FIFO order, readers
+**        and writers alternate in phases so neither can starve the
+**        other and all waiters spin with a bounded backoff on a
+**        variable they only read, so there is no cache line ping
+**        pong while waiting.  It scales much better with many
+**        threads.  Read locks are NOT recursive with this type,
+**        a recursive read lock will deadlock if a writer is waiting.
+**
+**      - LOCK_TYPE_FUTEX is an adaptive spin then park lock for locks
+**        which can be held for a long time.  Waiters spin for a short
+**        while and if the lock is still not available, they go to
+**        sleep in the kernel on a futex (linux only, other systems
+**        fall back to yielding).  Releasing the lock wakes up only the
+**        sleepers which can actually proceed, ie one writer or all the
+**        readers.  The futexes are NOT process private so this type
+**        also works in shared memory between processes.
+**
+**      - LOCK_TYPE_BIG_READER is a 'big reader' lock for read mostly
+**        objects.  Every thread increments a reader counter in its own
+**        cache line padded slot, so readers running on different cores
+**        never write to the same cache line.  A writer announces itself
+**        and then waits for all the slots to drain, so writes are much
+**        more expensive.  The slots are allocated separately from the
+**        lock structure, so this type CANNOT be used in shared memory
+**        between processes, only between threads.
+**
+**      - LOCK_TYPE_SEQLOCK is the big reader lock plus a sequence
+**        counter which every writer increments once when it takes the
+**        lock and once when it releases it.  On top of normal locking,
+**        this allows 'optimistic' readers which take no lock at all:
+**        they note the sequence, read, and if the sequence changed (or
+**        was odd) meanwhile, they throw away what they read and re-try.
+**        Memory which optimistic readers may be looking at must NOT be
+**        freed by the writers, it must be retired with 'lock_obj_retire'
+**        which frees it only after all the optimistic readers which
+**        could have seen it are gone.  Objects which support optimistic
+**        searches (avl tree & index object) do this automatically.
+**        Note that an optimistic search may still call the user's
+**        comparison function with user data which was just removed
+**        by a writer, so the user must not free removed user data
+**        immediately either.  Instead, it must be removed with
+**        'avl_tree_remove_retire' or 'index_obj_remove_retire' (or
+**        retired with 'lock_obj_retire_data' while holding the write
+**        lock), which hand the data to the user's destruction handler
+**        only once no optimistic reader can be looking at it.  Like the
+**        big reader lock, this type cannot be used in shared memory
+**        between processes.
+**
 *******************************************************************************
 *******************************************************************************
 *******************************************************************************
@@ -69,20 +128,112 @@ extern "C" {
 #include "common.h"
 #include "timer_object.h"
 
+/*
+ * Lock types.  Any one of these can be passed as the
+ * 'make_it_thread_safe' parameter of all the object initialization
+ * functions to choose the type of lock the object will use.  Note
+ * that 'false' (0) still means no locking and 'true' (1) still means
+ * the original lock, so existing callers are not affected.
+ */
+#define LOCK_TYPE_NONE              0
+#define LOCK_TYPE_SPIN_YIELD        1
+#define LOCK_TYPE_PHASE_FAIR        2
+#define LOCK_TYPE_FUTEX             3
+#define LOCK_TYPE_BIG_READER        4
+#define LOCK_TYPE_SEQLOCK           5
+
+#define LOCK_TYPE_DEFAULT           LOCK_TYPE_SPIN_YIELD
+
+/*
+ * Every thread is given a small number the first time it calls
+ * 'thread_slot', which can be used to index arrays of per thread
+ * data.  The number is always in the range [0, MAX_THREAD_SLOTS),
+ * so if there are more threads than slots, some threads will share
+ * a slot.  Per thread data indexed by this must therefore still be
+ * updated atomically, but there will very rarely be any contention.
+ */
+#define MAX_THREAD_SLOTS            64
+
+extern int
+thread_slot (void);
+
+/*
+ * LOCK_TYPE_BIG_READER & LOCK_TYPE_SEQLOCK per thread reader counters,
+ * one slot per cache line.
+ */
+typedef struct lock_reader_slot_s {
+
+    volatile int readers;
+
+} __attribute__((aligned(CACHE_LINE_SIZE))) lock_reader_slot_t;
+
+struct epoch_manager_s;
+
 typedef struct lock_obj_s {
 
-    /* used with compare & swap, protects rest of the variables */
+    /* one of the LOCK_TYPE_xxx values above */
+    byte type;
+
+    /*
+     * LOCK_TYPE_SPIN_YIELD: used with compare & swap,
+     * protects rest of the variables
+     */
     volatile byte mtx;
 
     short readers;
     tinybool write_pending;
     tinybool writing;
 
+    /*
+     * LOCK_TYPE_PHASE_FAIR: reader entry/exit and writer
+     * entry/exit ticket counters.  The lowest byte of 'rin'
+     * also holds the writer present & phase bits.
+     */
+    volatile unsigned int rin, rout;
+    volatile unsigned int win, wout;
+
+    /*
+     * LOCK_TYPE_FUTEX: 'mtx', 'readers' & 'writing' above are also
+     * used by this type.  'writers_waiting' counts all the writers
+     * which want the lock (spinning or sleeping), the 'parked' ones
+     * are the ones sleeping in the kernel.  The 'wakeup' variables
+     * are the futex words the sleepers wait on.
+     */
+    int writers_waiting;
+    int readers_parked, writers_parked;
+    volatile int readers_wakeup, writers_wakeup;
+
+    /*
+     * LOCK_TYPE_BIG_READER & LOCK_TYPE_SEQLOCK: MAX_THREAD_SLOTS
+     * reader counters.  'mtx' above is used as the writer present flag.
+     */
+    lock_reader_slot_t *reader_slots;
+
+    /*
+     * LOCK_TYPE_SEQLOCK: odd while a writer holds the lock and the
+     * epoch manager which defers the freeing of retired memory.  It
+     * has one thread record per thread slot for the optimistic
+     * readers plus one more, used by the writers to retire into.
+     */
+    volatile unsigned int sequence;
+    struct epoch_manager_s *epochs;
+
 } lock_obj_t;
 
+/*
+ * initializes the lock with the default type
+ */
 extern int 
 lock_obj_init (lock_obj_t *lck);
 
+/*
+ * initializes the lock with one of the specific LOCK_TYPE_xxx types.
+ * Returns 0, EINVAL if the type is not known or ENOMEM if the type
+ * needs extra memory which could not be allocated.
+ */
+extern int
+lock_obj_init_type (lock_obj_t *lck, int type);
+
 extern void
 grab_read_lock (lock_obj_t *lck);
 
@@ -95,6 +246,52 @@ grab_write_lock (lock_obj_t *lck);
 extern void
 release_write_lock (lock_obj_t *lck);
 
+/*
+ * LOCK_TYPE_SEQLOCK optimistic (lockless) reading.  The read must
+ * be enclosed by these two calls and must be repeated for as long as
+ * 'lock_obj_optimistic_read_end' returns false, since that means a
+ * writer changed things during the read and what was read cannot be
+ * trusted.  Typical use is:
+ *
+ *      do {
+ *          seq = lock_obj_optimistic_read_begin(lck);
+ *          ... read ...
+ *      } while (!lock_obj_optimistic_read_end(lck, seq));
+ */
+extern unsigned int
+lock_obj_optimistic_read_begin (lock_obj_t *lck);
+
+extern boolean
+lock_obj_optimistic_read_end (lock_obj_t *lck, unsigned int sequence);
+
+/*
+ * LOCK_TYPE_SEQLOCK only, must be called with the write lock held.
+ * Frees a memory block allocated thru the mem monitor, but only after
+ * all the optimistic readers which may still be looking at it are
+ * done.  This is simply 'epoch_retire' on the lock's epoch manager,
+ * so the block is counted in the 'deferred_bytes' of its monitor
+ * until it is actually freed.
+ */
+extern void
+lock_obj_retire (lock_obj_t *lck, void *ptr);
+
+/*
+ * LOCK_TYPE_SEQLOCK only, must be called with the write lock held.
+ * For user data which has been removed from the object the lock
+ * protects: 'dh' is called with 'data' & 'extra_arg' once all the
+ * optimistic readers which may still be looking at the data are done.
+ * This is the only safe way to free user data removed from an object
+ * which allows optimistic reads.  'dh' may be called by whichever
+ * thread next retires into the lock, or when the lock is destroyed.
+ */
+extern void
+lock_obj_retire_data (lock_obj_t *lck, void *data,
+    destruction_handler_t dh, void *extra_arg);
+
+/*
+ * must always be called when the lock is no longer needed
+ * since some lock types allocate extra memory.
+ */
 extern void 
 lock_obj_destroy (lock_obj_t *lck);
 
@@ -105,13 +302,15 @@ lock_obj_destroy (lock_obj_t *lck);
 /*
  * If locking is required, set up the object's lock structure and let
  * the object's 'lock' pointer point to it.  Otherwise, the pointer
- * is set to NULL (indicating locking is not required).
+ * is set to NULL (indicating locking is not required).  The value of
+ * 'make_it_thread_safe' also selects the lock type (LOCK_TYPE_xxx).
  */
 #define LOCK_SETUP(obj) \
     do { \
         obj->lock = NULL; \
         if (make_it_thread_safe) { \
-            int __failed__ = lock_obj_init(&obj->lock_structure); \
+            int __failed__ = lock_obj_init_type(&obj->lock_structure, \
+                                    make_it_thread_safe); \
             if (__failed__) return __failed__; \
             obj->lock = &obj->lock_structure; \
             grab_write_lock(obj->lock); \
@@ -128,6 +327,41 @@ lock_obj_destroy (lock_obj_t *lck);
 #define OBJ_READ_UNLOCK(obj)        SAFE_READ_UNLOCK(obj->lock)
 #define OBJ_WRITE_UNLOCK(obj)       SAFE_WRITE_UNLOCK(obj->lock)
 
+/*
+ * does this object allow optimistic (lockless) reads
+ */
+#define OBJ_OPTIMISTIC_READS(obj) \
+    (obj->lock && (obj->lock->type == LOCK_TYPE_SEQLOCK))
+
+/*
+ * In objects which support optimistic reads, use this instead of
+ * MEM_MONITOR_FREE for any memory an optimistic reader may access.
+ */
+#define OBJ_MEMORY_FREE(obj, ptr) \
+    do { \
+        if (ptr) { \
+            if (OBJ_OPTIMISTIC_READS(obj)) { \
+                lock_obj_retire(obj->lock, ptr); \
+            } else { \
+                mem_monitor_free(ptr); \
+            } \
+        } \
+    } while (0)
+
+/*
+ * Use this, with the object write locked, to dispose of user data which
+ * was just removed from the object.  If optimistic readers may still be
+ * looking at the data, 'dh' is called later, otherwise right away.
+ */
+#define OBJ_DATA_RETIRE(obj, data, dh, extra_arg) \
+    do { \
+        if (OBJ_OPTIMISTIC_READS(obj)) { \
+            lock_obj_retire_data(obj->lock, data, dh, extra_arg); \
+        } else { \
+            dh(data, extra_arg); \
+        } \
+    } while (0)
+
 #define LOCK_OBJ_DESTROY(obj) \
     do { \
         if (obj->lock) { \
@@ -15,6 +15,10 @@
 *******************************************************************************
 ******************************************************************************/
 
+#include <sys/mman.h>
+#include <pthread.h>
+#include <execinfo.h>
+
 #include "mem_monitor_object.h"
 
 #ifdef __cplusplus
@@ -35,6 +39,12 @@ typedef struct mem_header_s {
     /* total size of bytes used INCLUDING THIS header */
     int total_size;
 
+    /* was this served by the backend allocator rather than malloc */
+    unsigned int from_backend : 1;
+
+    /* the allocation site, if this block was sampled by the profiler */
+    unsigned int site : 31;
+
     /* make the whole size of the structure a mult of 8 bytes */
     unsigned long long data [0];
 
@@ -50,6 +60,588 @@ get_mem_header_ptr (void *ptr)
         (mem_header_t*) (((byte*) ptr) - sizeof(mem_header_t));
 }
 
+/*
+ * Every thread is handed the next shard (round robin) the first time
+ * it touches any monitor and keeps using that shard of every monitor.
+ */
+static volatile int next_shard = 0;
+static __thread int my_shard = -1;
+
+static inline int
+shard_index (void)
+{
+    if (my_shard < 0) {
+        my_shard = __sync_fetch_and_add(&next_shard, 1) % MEM_MONITOR_SHARDS;
+    }
+    return my_shard;
+}
+
+/*
+ * the counters are updated in the monitor & all its ancestors
+ */
+static inline void
+account (mem_monitor_t *mmp, long long bytes, int allocations, int frees)
+{
+    int s = shard_index();
+    mem_monitor_shard_t *shp;
+
+    for (; mmp; mmp = mmp->parent) {
+        shp = &mmp->shards[s];
+        if (bytes) {
+            __sync_fetch_and_add(&shp->bytes_used, (unsigned long long) bytes);
+        }
+        if (allocations) __sync_fetch_and_add(&shp->allocations, allocations);
+        if (frees) __sync_fetch_and_add(&shp->frees, frees);
+    }
+}
+
+static inline void
+account_deferred (mem_monitor_t *mmp, long long bytes, int blocks)
+{
+    int s = shard_index();
+    mem_monitor_shard_t *shp;
+
+    for (; mmp; mmp = mmp->parent) {
+        shp = &mmp->shards[s];
+        __sync_fetch_and_add(&shp->deferred_bytes,
+            (unsigned long long) bytes);
+        __sync_fetch_and_add(&shp->deferred_blocks, (long long) blocks);
+    }
+}
+
+static __thread int in_reclaim = 0;
+
+/* see 'mem_monitor_defer_reclaim_begin' */
+__thread int mem_monitor_reclaim_deferrals = 0;
+__thread mem_monitor_t *mem_monitor_deferred_reclaim = NULL;
+static __thread long long deferred_reclaim_bytes = 0;
+
+/*
+ * Give 'bytes' back to every budget from 'mmp' up to (but excluding)
+ * 'stop'.
+ */
+static inline void
+uncharge (mem_monitor_t *mmp, mem_monitor_t *stop, long long bytes)
+{
+    for (; mmp != stop; mmp = mmp->parent) {
+        if (mmp->budget > 0) __sync_sub_and_fetch(&mmp->charged, bytes);
+    }
+}
+
+/*
+ * Charge 'bytes' against every budget on the way up from 'mmp'.  If one
+ * would be exceeded, whatever was charged is given back and its reclaim
+ * function (if any) is given one chance to make some space.
+ */
+static boolean
+charge (mem_monitor_t *mmp, long long bytes)
+{
+    mem_monitor_t *m, *over;
+    int attempt;
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        over = NULL;
+        for (m = mmp; m; m = m->parent) {
+            if (m->budget <= 0) continue;
+            if (__sync_add_and_fetch(&m->charged, bytes) > m->budget) {
+                over = m;
+                break;
+            }
+        }
+        if (NULL == over) return true;
+        uncharge(mmp, over->parent, bytes);
+        __sync_fetch_and_add(&over->budget_failures, 1);
+        if (attempt || (NULL == over->reclaim_fn) || in_reclaim) break;
+        if (mem_monitor_reclaim_deferrals) {
+            mem_monitor_deferred_reclaim = over;
+            deferred_reclaim_bytes = bytes;
+            break;
+        }
+        in_reclaim = 1;
+        over->reclaim_fn(over->reclaim_arg, over, bytes);
+        in_reclaim = 0;
+    }
+    return false;
+}
+
+boolean
+mem_monitor_run_deferred_reclaim (void)
+{
+    mem_monitor_t *mmp = mem_monitor_deferred_reclaim;
+    mem_monitor_reclaim_fn reclaim_fn;
+
+    mem_monitor_deferred_reclaim = NULL;
+    if ((NULL == mmp) || in_reclaim) return false;
+    reclaim_fn = mmp->reclaim_fn;
+    if (NULL == reclaim_fn) return false;
+    in_reclaim = 1;
+    reclaim_fn(mmp->reclaim_arg, mmp, deferred_reclaim_bytes);
+    in_reclaim = 0;
+    return true;
+}
+
+void
+mem_monitor_init (mem_monitor_t *mmp, mem_monitor_t *parent)
+{
+    memset(mmp, 0, sizeof(mem_monitor_t));
+    mmp->parent = parent;
+}
+
+void
+mem_monitor_set_budget (mem_monitor_t *mmp, long long budget,
+    mem_monitor_reclaim_fn reclaim_fn, void *reclaim_arg)
+{
+    mmp->reclaim_fn = reclaim_fn;
+    mmp->reclaim_arg = reclaim_arg;
+    mmp->charged = mem_monitor_bytes_used(mmp);
+    __sync_synchronize();
+    mmp->budget = budget;
+}
+
+void
+mem_monitor_record (mem_monitor_t *mmp, long long bytes,
+    int allocations, int frees)
+{
+    if (mmp) account(mmp, bytes, allocations, frees);
+}
+
+void
+mem_monitor_totals (mem_monitor_t *mmp, mem_monitor_shard_t *totals)
+{
+    mem_monitor_shard_t *shp;
+    int s;
+
+    memset(totals, 0, sizeof(mem_monitor_shard_t));
+    for (s = 0; s < MEM_MONITOR_SHARDS; s++) {
+        shp = &mmp->shards[s];
+        totals->bytes_used += shp->bytes_used;
+        totals->allocations += shp->allocations;
+        totals->frees += shp->frees;
+        totals->deferred_bytes += shp->deferred_bytes;
+        totals->deferred_blocks += shp->deferred_blocks;
+    }
+}
+
+/*
+ * the backend allocator, if any.  'in_backend' stops the backend
+ * from recursing into itself when it needs memory of its own.
+ */
+static mem_backend_alloc_fn backend_alloc = NULL;
+static mem_backend_free_fn backend_free = NULL;
+static void *backend_arg = NULL;
+static int backend_max_size = 0;
+static __thread int in_backend = 0;
+
+void
+mem_monitor_set_backend (mem_backend_alloc_fn alloc_fn,
+    mem_backend_free_fn free_fn, void *arg, int max_size)
+{
+    backend_alloc = NULL;
+    __sync_synchronize();
+    backend_free = free_fn;
+    backend_arg = arg;
+    backend_max_size = max_size;
+    __sync_synchronize();
+    backend_alloc = alloc_fn;
+}
+
+static inline byte *
+raw_allocate (int total_size, int *from_backend)
+{
+    byte *block;
+
+    if (backend_alloc && (total_size <= backend_max_size) && !in_backend) {
+        in_backend = 1;
+        block = backend_alloc(backend_arg, total_size);
+        in_backend = 0;
+        if (block) {
+            *from_backend = 1;
+            return block;
+        }
+    }
+    *from_backend = 0;
+    return
+        malloc(total_size);
+}
+
+static inline void
+raw_free (mem_header_t *mhp)
+{
+    if (mhp->from_backend) {
+        in_backend = 1;
+        backend_free(mhp);
+        in_backend = 0;
+    } else {
+        free(mhp);
+    }
+}
+
+/*
+ * The registry of headerless slab pages, a 3 level radix tree indexed
+ * by the page number of an address (48 bits of address space).  Nodes
+ * are only ever added, never freed, so looking up needs no locking.
+ * 'slabs_registered' saves even the look up until a slab is first
+ * registered.
+ */
+#define SLAB_PAGE_SHIFT             14
+#define SLAB_LEAF_BITS              11
+#define SLAB_MID_BITS               11
+#define SLAB_ROOT_BITS \
+    (48 - SLAB_PAGE_SHIFT - SLAB_MID_BITS - SLAB_LEAF_BITS)
+
+typedef struct slab_leaf_s {
+    mem_slab_t * volatile slabs [1 << SLAB_LEAF_BITS];
+} slab_leaf_t;
+
+typedef struct slab_mid_s {
+    slab_leaf_t * volatile leaves [1 << SLAB_MID_BITS];
+} slab_mid_t;
+
+static slab_mid_t * volatile slab_root [1 << SLAB_ROOT_BITS];
+static volatile int slabs_registered = 0;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline mem_slab_t *
+slab_of (void *ptr)
+{
+    unsigned long page = ((unsigned long) ptr) >> SLAB_PAGE_SHIFT;
+    slab_mid_t *mid;
+    slab_leaf_t *leaf;
+
+    if (page >> (SLAB_ROOT_BITS + SLAB_MID_BITS + SLAB_LEAF_BITS)) {
+        return NULL;
+    }
+    mid = slab_root[page >> (SLAB_MID_BITS + SLAB_LEAF_BITS)];
+    if (NULL == mid) return NULL;
+    leaf = mid->leaves[(page >> SLAB_LEAF_BITS) &
+                ((1 << SLAB_MID_BITS) - 1)];
+    if (NULL == leaf) return NULL;
+    return
+        leaf->slabs[page & ((1 << SLAB_LEAF_BITS) - 1)];
+}
+
+/*
+ * the leaf slot of a page, created if 'create' is set
+ */
+static mem_slab_t * volatile *
+slab_slot (unsigned long page, boolean create)
+{
+    slab_mid_t *mid;
+    slab_leaf_t *leaf;
+    int r = page >> (SLAB_MID_BITS + SLAB_LEAF_BITS);
+    int m = (page >> SLAB_LEAF_BITS) & ((1 << SLAB_MID_BITS) - 1);
+
+    mid = slab_root[r];
+    if (NULL == mid) {
+        if (!create) return NULL;
+        mid = calloc(1, sizeof(slab_mid_t));
+        if (NULL == mid) return NULL;
+        slab_root[r] = mid;
+    }
+    leaf = mid->leaves[m];
+    if (NULL == leaf) {
+        if (!create) return NULL;
+        leaf = calloc(1, sizeof(slab_leaf_t));
+        if (NULL == leaf) return NULL;
+        mid->leaves[m] = leaf;
+    }
+    return
+        &leaf->slabs[page & ((1 << SLAB_LEAF_BITS) - 1)];
+}
+
+int
+mem_monitor_register_slab (void *pages, int size, mem_slab_t *slab)
+{
+    unsigned long page = ((unsigned long) pages) >> SLAB_PAGE_SHIFT;
+    unsigned long last = page + (size >> SLAB_PAGE_SHIFT);
+    mem_slab_t * volatile *slot;
+
+    assert((1 << SLAB_PAGE_SHIFT) == MEM_SLAB_PAGE_SIZE);
+    assert(0 == (((unsigned long) pages) & (MEM_SLAB_PAGE_SIZE - 1)));
+    if (last >> (SLAB_ROOT_BITS + SLAB_MID_BITS + SLAB_LEAF_BITS)) {
+        return EINVAL;
+    }
+    pthread_mutex_lock(&slab_lock);
+    for (; page < last; page++) {
+        slot = slab_slot(page, true);
+        if (NULL == slot) {
+            pthread_mutex_unlock(&slab_lock);
+            mem_monitor_unregister_slab(pages,
+                (page << SLAB_PAGE_SHIFT) - (unsigned long) pages);
+            return ENOMEM;
+        }
+        *slot = slab;
+    }
+    __sync_synchronize();
+    slabs_registered = 1;
+    pthread_mutex_unlock(&slab_lock);
+
+    return 0;
+}
+
+void
+mem_monitor_unregister_slab (void *pages, int size)
+{
+    unsigned long page = ((unsigned long) pages) >> SLAB_PAGE_SHIFT;
+    unsigned long last = page + (size >> SLAB_PAGE_SHIFT);
+    mem_slab_t * volatile *slot;
+
+    pthread_mutex_lock(&slab_lock);
+    for (; page < last; page++) {
+        slot = slab_slot(page, false);
+        if (slot) *slot = NULL;
+    }
+    pthread_mutex_unlock(&slab_lock);
+}
+
+void
+mem_monitor_set_slabs (mem_monitor_t *mmp, mem_slab_alloc_fn alloc_fn,
+    void *arg, int max_size)
+{
+    mmp->slab_alloc_fn = NULL;
+    __sync_synchronize();
+    mmp->slab_arg = arg;
+    mmp->slab_max_size = max_size;
+    __sync_synchronize();
+    mmp->slab_alloc_fn = alloc_fn;
+}
+
+/*
+ * the slab of a block, if it is a headerless one
+ */
+static inline mem_slab_t *
+headerless (void *ptr)
+{
+    return
+        slabs_registered ? slab_of(ptr) : NULL;
+}
+
+static void *
+headerless_allocate (mem_monitor_t *mmp, int size, bool initialize_to_zero)
+{
+    mem_slab_t *slab;
+    void *block;
+
+    block = mmp->slab_alloc_fn(mmp->slab_arg, size);
+    if (NULL == block) return null;
+    slab = slab_of(block);
+    assert(slab && (slab->mmp == mmp));
+    if (!charge(mmp, slab->block_size)) {
+        slab->free_fn(block);
+        return null;
+    }
+    account(mmp, slab->block_size, 1, 0);
+    if (initialize_to_zero) memset(block, 0, size);
+
+    return block;
+}
+
+static void
+headerless_free (mem_slab_t *slab, void *block)
+{
+    uncharge(slab->mmp, NULL, slab->block_size);
+    account(slab->mmp, -(long long) slab->block_size, 0, 1);
+    slab->free_fn(block);
+}
+
+/*
+ * The heap profiler.  Every thread counts down the bytes it allocates
+ * and when 'profile_period' bytes have gone by, the allocation at hand
+ * is sampled; its call stack is looked up in (or added to) the sites
+ * table and the index of the site is kept in the header of the block.
+ * A sample stands for 'profile_period' bytes, or the size of the block
+ * if bigger, which is what the live bytes of its site go up by and
+ * later down by when it is freed.  Sites are only ever added, so
+ * looking one up is only locked when it has to be added.  Site 0 means
+ * not sampled and site 1 is where samples go if the table is full.
+ */
+typedef struct mem_profile_site_s {
+
+    void *frames [MEM_PROFILE_DEPTH];
+    int depth;
+    volatile long long live_bytes;
+    volatile long long live_blocks;
+    volatile unsigned long long sampled;
+
+} mem_profile_site_t;
+
+#define MEM_PROFILE_SITES           4096
+#define MEM_PROFILE_OVERFLOW        1
+
+static mem_profile_site_t profile_sites [MEM_PROFILE_SITES];
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static int profile_period = 0;
+static int last_profile_period = 0;
+static __thread long long bytes_until_sample = 0;
+
+static inline long long
+profile_weight (int total_size, int period)
+{
+    return
+        (total_size > period) ? total_size : period;
+}
+
+static int
+profile_site (void *frames [], int depth)
+{
+    unsigned long hash = depth;
+    int i, site, probes;
+
+    for (i = 0; i < depth; i++) {
+        hash = (hash * 31) ^ ((unsigned long) frames[i] >> 4);
+    }
+
+    /*
+     * Open addressing.  A site with a non zero depth is complete
+     * (it is published after its frames), so it can be compared with
+     * no locking.  If not found, look again under the lock & add it.
+     */
+    for (probes = 0; probes < 2; probes++) {
+        site = 2 + (hash % (MEM_PROFILE_SITES - 2));
+        for (i = 0; i < MEM_PROFILE_SITES - 2; i++) {
+            if (0 == profile_sites[site].depth) break;
+            if ((profile_sites[site].depth == depth) &&
+                (0 == memcmp(profile_sites[site].frames, frames,
+                        depth * sizeof(void*)))) {
+                    if (probes) pthread_mutex_unlock(&profile_lock);
+                    return site;
+            }
+            if (++site >= MEM_PROFILE_SITES) site = 2;
+        }
+        if (probes) break;
+        pthread_mutex_lock(&profile_lock);
+    }
+
+    /* 'site' is an empty slot, unless the table is full */
+    if (profile_sites[site].depth) {
+        site = MEM_PROFILE_OVERFLOW;
+    } else {
+        memcpy(profile_sites[site].frames, frames, depth * sizeof(void*));
+        __sync_synchronize();
+        profile_sites[site].depth = depth;
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    return site;
+}
+
+/*
+ * Not inlined so that the frames to skip are always the same: this
+ * one and the mem_monitor function which called it.
+ */
+static __attribute__((noinline)) void
+profile_allocation (mem_header_t *mhp)
+{
+    void *frames [MEM_PROFILE_DEPTH + 2];
+    int period = profile_period;
+    int depth, site;
+    long long weight;
+
+    bytes_until_sample -= mhp->total_size;
+    if ((bytes_until_sample > 0) || (period <= 0)) return;
+
+    /* carry the overshoot over, unless the block stands for itself */
+    if (mhp->total_size >= period) {
+        bytes_until_sample = period;
+    } else {
+        bytes_until_sample += period;
+    }
+
+    depth = backtrace(frames, MEM_PROFILE_DEPTH + 2) - 2;
+    site = (depth > 0) ?
+        profile_site(&frames[2], depth) : MEM_PROFILE_OVERFLOW;
+    weight = profile_weight(mhp->total_size, period);
+    __sync_fetch_and_add(&profile_sites[site].live_bytes, weight);
+    __sync_fetch_and_add(&profile_sites[site].live_blocks, 1);
+    __sync_fetch_and_add(&profile_sites[site].sampled, 1);
+    mhp->site = site;
+}
+
+static void
+profile_free (mem_header_t *mhp)
+{
+    mem_profile_site_t *sitep = &profile_sites[mhp->site];
+
+    __sync_fetch_and_sub(&sitep->live_bytes,
+        profile_weight(mhp->total_size, last_profile_period));
+    __sync_fetch_and_sub(&sitep->live_blocks, 1);
+    mhp->site = 0;
+}
+
+int
+mem_monitor_profile_start (int sample_period)
+{
+    int s;
+
+    if (sample_period <= 0) return EINVAL;
+    pthread_mutex_lock(&profile_lock);
+    if (sample_period != last_profile_period) {
+        for (s = 0; s < MEM_PROFILE_SITES; s++) {
+            if (profile_sites[s].live_blocks) {
+                pthread_mutex_unlock(&profile_lock);
+                return EBUSY;
+            }
+        }
+        last_profile_period = sample_period;
+    }
+    profile_period = sample_period;
+    pthread_mutex_unlock(&profile_lock);
+
+    return 0;
+}
+
+void
+mem_monitor_profile_stop (void)
+{
+    profile_period = 0;
+}
+
+/*
+ * 'backtrace_symbols' gives "binary(function+0x1f) [0x4005d3]" so the
+ * function name is picked out of that, or else the address is used.
+ */
+static void
+profile_print_frame (FILE *fp, void *frame, char *symbol)
+{
+    char *start = symbol ? strchr(symbol, '(') : NULL;
+    char *end = start ? strpbrk(start + 1, "+)") : NULL;
+
+    if (start && end && (end > start + 1)) {
+        fprintf(fp, "%.*s", (int) (end - start - 1), start + 1);
+    } else {
+        fprintf(fp, "%p", frame);
+    }
+}
+
+int
+mem_monitor_profile_dump (FILE *fp)
+{
+    mem_profile_site_t *sitep;
+    char **symbols;
+    int s, f, n = 0;
+
+    for (s = MEM_PROFILE_OVERFLOW; s < MEM_PROFILE_SITES; s++) {
+        sitep = &profile_sites[s];
+        if (sitep->live_bytes <= 0) continue;
+        if (s == MEM_PROFILE_OVERFLOW) {
+            fprintf(fp, "[other] %lld\n", sitep->live_bytes);
+            n++;
+            continue;
+        }
+        symbols = backtrace_symbols(sitep->frames, sitep->depth);
+        for (f = sitep->depth - 1; f >= 0; f--) {
+            profile_print_frame(fp, sitep->frames[f],
+                symbols ? symbols[f] : NULL);
+            fprintf(fp, f ? ";" : " ");
+        }
+        fprintf(fp, "%lld\n", sitep->live_bytes);
+        if (symbols) free(symbols);
+        n++;
+    }
+
+    return n;
+}
+
 /*
  * An extra mem_header_t is inserted into the front
  * of all memory returrned to the user so we have all
@@ -60,21 +652,30 @@ mem_monitor_allocate (mem_monitor_t *mmp,
         int size, bool initialize_to_zero)
 {
     int total_size = size + sizeof(mem_header_t);
+    int from_backend;
     mem_header_t *mhp;
     byte *block;
 
-    block = malloc(total_size);
+    /* small enough to be served with no header at all */
+    if (mmp && mmp->slab_alloc_fn && (size <= mmp->slab_max_size)) {
+        block = headerless_allocate(mmp, size, initialize_to_zero);
+        if (block) return block;
+    }
+
+    if (mmp && !charge(mmp, total_size)) return null;
+    block = raw_allocate(total_size, &from_backend);
     if (block) {
         if (initialize_to_zero) memset(block, 0, total_size);
         mhp = (mem_header_t*) block;
         mhp->mmp = mmp;
         mhp->total_size = total_size;
-        if (mmp) {
-            mmp->bytes_used += total_size;
-            mmp->allocations++;
-        }
+        mhp->from_backend = from_backend;
+        mhp->site = 0;
+        if (profile_period) profile_allocation(mhp);
+        if (mmp) account(mmp, total_size, 1, 0);
         return &(mhp->data[0]);
     }
+    if (mmp) uncharge(mmp, NULL, total_size);
     return null;
 }
 
@@ -82,14 +683,139 @@ void
 mem_monitor_free (void *ptr)
 {
     mem_header_t *mhp;
+    mem_slab_t *slab = headerless(ptr);
+
+    if (slab) {
+        headerless_free(slab, ptr);
+        return;
+    }
 
     mhp = get_mem_header_ptr(ptr);
+    if (mhp->site) profile_free(mhp);
     if (mhp->mmp) {
-        mhp->mmp->bytes_used -= mhp->total_size;
-        mhp->mmp->frees++;
+        uncharge(mhp->mmp, NULL, mhp->total_size);
+        account(mhp->mmp, -(long long) mhp->total_size, 0, 1);
+    }
+
+    raw_free(mhp);
+}
+
+void *
+mem_monitor_allocate_aligned (mem_monitor_t *mmp, int size, int alignment)
+{
+    void *block;
+
+    if (mmp && !charge(mmp, size)) return null;
+    if (posix_memalign(&block, alignment, size)) {
+        if (mmp) uncharge(mmp, NULL, size);
+        return null;
+    }
+    if (mmp) account(mmp, size, 1, 0);
+    return block;
+}
+
+void
+mem_monitor_free_aligned (mem_monitor_t *mmp, void *ptr, int size)
+{
+    if (mmp) {
+        uncharge(mmp, NULL, size);
+        account(mmp, -(long long) size, 0, 1);
+    }
+    free(ptr);
+}
+
+/*
+ * map 'size' bytes aligned to MEM_HUGE_PAGE_SIZE by over mapping
+ * and unmapping the unaligned head & the tail.
+ */
+static void *
+map_huge_aligned (int size)
+{
+    byte *block, *aligned;
+    long excess = MEM_HUGE_PAGE_SIZE;
+    long head;
+
+    block = mmap(NULL, size + excess, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == block) return null;
+
+    aligned = (byte*) (((unsigned long) block + MEM_HUGE_PAGE_SIZE - 1) &
+                    ~((unsigned long) MEM_HUGE_PAGE_SIZE - 1));
+    head = aligned - block;
+    if (head) munmap(block, head);
+    if (excess - head) munmap(aligned + size, excess - head);
+
+#ifdef MADV_HUGEPAGE
+    (void) madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+    return aligned;
+}
+
+void *
+mem_monitor_allocate_huge (mem_monitor_t *mmp, int size)
+{
+    void *block = MAP_FAILED;
+
+    size = mem_monitor_huge_size(size);
+    if (mmp && !charge(mmp, size)) return null;
+
+#ifdef MAP_HUGETLB
+    block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (MAP_FAILED == block) {
+        block = map_huge_aligned(size);
+        if (NULL == block) {
+            if (mmp) uncharge(mmp, NULL, size);
+            return null;
+        }
     }
+    if (mmp) account(mmp, size, 1, 0);
+    return block;
+}
 
-    free(mhp);
+void
+mem_monitor_free_huge (mem_monitor_t *mmp, void *ptr, int size)
+{
+    size = mem_monitor_huge_size(size);
+    if (mmp) {
+        uncharge(mmp, NULL, size);
+        account(mmp, -(long long) size, 0, 1);
+    }
+    munmap(ptr, size);
+}
+
+void
+mem_monitor_retire (void *ptr)
+{
+    mem_slab_t *slab = headerless(ptr);
+    mem_header_t *mhp;
+
+    if (slab) {
+        account_deferred(slab->mmp, slab->block_size, 1);
+        return;
+    }
+    mhp = get_mem_header_ptr(ptr);
+    if (mhp->mmp) account_deferred(mhp->mmp, mhp->total_size, 1);
+}
+
+void
+mem_monitor_free_retired (void *ptr)
+{
+    mem_slab_t *slab = headerless(ptr);
+    mem_header_t *mhp;
+
+    if (slab) {
+        account_deferred(slab->mmp, -(long long) slab->block_size, -1);
+    } else {
+        mhp = get_mem_header_ptr(ptr);
+        if (mhp->mmp) {
+            account_deferred(mhp->mmp, -(long long) mhp->total_size, -1);
+        }
+    }
+    mem_monitor_free(ptr);
 }
 
 void *
@@ -98,6 +824,7 @@ mem_monitor_reallocate (mem_monitor_t *mmp,
     bool initialize_to_zero)
 {
     mem_header_t *mhp;
+    mem_slab_t *slab;
     int old_total_size, new_total_size;
     byte *new_data;
 
@@ -107,25 +834,76 @@ mem_monitor_reallocate (mem_monitor_t *mmp,
             mem_monitor_allocate(mmp, new_data_size, initialize_to_zero);
     }
 
+    /* a headerless block is simply moved to a new block */
+    slab = headerless(ptr);
+    if (slab) {
+        assert(mmp == slab->mmp);
+        new_data = mem_monitor_allocate(mmp, new_data_size, false);
+        if (NULL == new_data) return null;
+        memcpy(new_data, ptr, (slab->block_size < new_data_size) ?
+            slab->block_size : new_data_size);
+        if (initialize_to_zero && (new_data_size > slab->block_size)) {
+            memset(new_data + slab->block_size, 0,
+                new_data_size - slab->block_size);
+        }
+        headerless_free(slab, ptr);
+        return new_data;
+    }
+
     /* record old stuff */
     mhp = get_mem_header_ptr(ptr);
     assert(mmp == mhp->mmp);
     old_total_size = mhp->total_size;
     new_total_size = new_data_size + sizeof(mem_header_t);
 
+    /*
+     * Blocks from the backend cannot be realloced, so get a new
+     * block and copy.  Otherwise a plain realloc will do.
+     */
+    if (mhp->from_backend) {
+        new_data = mem_monitor_allocate(mmp, new_data_size, false);
+        if (NULL == new_data) return null;
+        memcpy(new_data, ptr,
+            (old_total_size < new_total_size ?
+                old_total_size : new_total_size) - sizeof(mem_header_t));
+        if (initialize_to_zero && (new_total_size > old_total_size)) {
+            memset(new_data + old_total_size - sizeof(mem_header_t), 0,
+                new_total_size - old_total_size);
+        }
+        mem_monitor_free(ptr);
+        return new_data;
+    }
+
+    /* growing must fit in the budgets */
+    if (mmp && (new_total_size > old_total_size) &&
+        !charge(mmp, new_total_size - old_total_size)) {
+            return null;
+    }
+
     /* get new memory */
     new_data = realloc(mhp, new_total_size);
     if (new_data) {
-        if (initialize_to_zero) memset(mhp, 0, new_total_size);
-        mmp->bytes_used -= old_total_size;
-        mmp->bytes_used += new_total_size;
+        if (mmp && (new_total_size < old_total_size)) {
+            uncharge(mmp, NULL, old_total_size - new_total_size);
+        }
+        if (initialize_to_zero && (new_total_size > old_total_size)) {
+            memset(new_data + old_total_size, 0,
+                new_total_size - old_total_size);
+        }
+        if (mmp) account(mmp, new_total_size - old_total_size, 0, 0);
         mhp = (mem_header_t*) new_data;
+        if (mhp->site) profile_free(mhp);
         mhp->mmp = mmp;
         mhp->total_size = new_total_size;
+        mhp->from_backend = 0;
+        if (profile_period) profile_allocation(mhp);
         return &(mhp->data[0]);
     }
 
     /* if we are here, realloc failed, nothing we can do */
+    if (mmp && (new_total_size > old_total_size)) {
+        uncharge(mmp, NULL, new_total_size - old_total_size);
+    }
     return null;
 }
 
@@ -26,17 +26,233 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "common.h"
 
-typedef struct mem_monitor_s {
+/*
+ * One monitor is typically shared by many objects used by many threads,
+ * so its counters are split into shards, each in a cache line of its
+ * own.  A thread always updates the same shard (atomically, since more
+ * threads than shards may exist) and the counters are summed up only
+ * when read, using the accessors below.  A block may well be freed by
+ * a different thread (& shard) than the one which allocated it, so a
+ * single shard on its own is meaningless; only the sums make sense.
+ */
+#define MEM_MONITOR_SHARDS          8
+
+typedef struct mem_monitor_shard_s {
 
     unsigned long long bytes_used;
     unsigned long long allocations;
     unsigned long long frees;
 
-} mem_monitor_t;
+    /*
+     * Blocks which have been retired (logically freed) but whose
+     * actual freeing is deferred until no reader can be using them.
+     * These are still included in 'bytes_used' above.
+     */
+    unsigned long long deferred_bytes;
+    unsigned long long deferred_blocks;
+
+} __attribute__((aligned(CACHE_LINE_SIZE))) mem_monitor_shard_t;
+
+typedef struct mem_monitor_s mem_monitor_t;
+
+/*
+ * Headerless mode.  Normally, every block has a small hidden header
+ * remembering its monitor & size for when it is freed.  For small
+ * blocks that is a lot of overhead, so a monitor can instead be given
+ * its own slab allocator (see 'mem_monitor_set_slabs') which serves
+ * its small allocations with no header at all.  Every page of such a
+ * slab is registered (see 'mem_monitor_register_slab') with what
+ * every block in it needs: which monitor it is for, its size (the size
+ * class of the slab) and how to free it.  Freeing a block first
+ * looks its page up, so 'mem_monitor_free' is used for every block,
+ * headerless or not.  Pages are MEM_SLAB_PAGE_SIZE aligned.
+ */
+#define MEM_SLAB_PAGE_SIZE          (16 * 1024)
+
+typedef struct mem_slab_s {
+
+    mem_monitor_t *mmp;
+    int block_size;
+    void (*free_fn)(void *block);
+
+} mem_slab_t;
+
+typedef void *(*mem_slab_alloc_fn)(void *arg, int size);
+
+/*
+ * Called when an allocation would take a monitor over its budget (see
+ * 'mem_monitor_set_budget'), to release whatever can be released (for
+ * example by 'chunk_manager_trim' or 'index_obj_trim', which are safe
+ * since those objects defer reclaims until they release their lock,
+ * see 'mem_monitor_defer_reclaim_begin').  'bytes_needed' is the size
+ * of the allocation which failed.
+ */
+typedef void (*mem_monitor_reclaim_fn)(void *arg, mem_monitor_t *mmp,
+    long long bytes_needed);
+
+struct mem_monitor_s {
+
+    mem_monitor_shard_t shards [MEM_MONITOR_SHARDS];
+
+    /*
+     * Monitors can form a tree (process -> subsystem -> object).
+     * Everything accounted in a monitor is also accounted in all of
+     * its ancestors.
+     */
+    mem_monitor_t *parent;
+
+    /*
+     * 0 if no budget.  Otherwise the allocations of this monitor and
+     * all its descendants may not total more than 'budget' bytes.
+     * Then, 'charged' is exactly what is used against the budget and
+     * 'budget_failures' is how many allocations did not fit.  This is
+     * a single counter so it is only kept when there is a budget.
+     */
+    long long budget;
+    mem_monitor_reclaim_fn reclaim_fn;
+    void *reclaim_arg;
+    volatile long long charged
+        __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile unsigned long long budget_failures;
+
+    /* headerless mode; serves sizes up to 'slab_max_size' if set */
+    mem_slab_alloc_fn slab_alloc_fn;
+    void *slab_arg;
+    int slab_max_size;
+
+};
+
+/*
+ * Initialize a stand alone monitor which is a child of 'parent'
+ * (which may be NULL), typically for a subsystem.  Objects are then
+ * simply given it as their 'parent_mem_monitor'.
+ */
+extern void
+mem_monitor_init (mem_monitor_t *mmp, mem_monitor_t *parent);
+
+/*
+ * Put a budget of 'budget' bytes (0 removes it) on a monitor.  Once
+ * reached, allocations fail (return NULL) unless 'reclaim_fn' (which
+ * may be NULL) manages to release enough memory, in which case the
+ * allocation is retried once.  The reclaim function is never called
+ * recursively.  It is called by whichever thread is allocating, which
+ * may well be holding the lock of the object it is allocating for, so
+ * it must not need that lock, unless that object defers reclaims.
+ *
+ * Memory already in use is charged at the time the budget is set,
+ * so it is best set before the monitor is actually used.
+ */
+extern void
+mem_monitor_set_budget (mem_monitor_t *mmp, long long budget,
+    mem_monitor_reclaim_fn reclaim_fn, void *reclaim_arg);
+
+/*
+ * An object which allocates while holding its own lock brackets that
+ * with these two, since a reclaim function may well need that very lock
+ * (for example 'chunk_manager_trim' of the same manager).  In between,
+ * an allocation over a budget simply fails and its reclaim function is
+ * only remembered.  'mem_monitor_defer_reclaim_end', called once the
+ * lock is released, then calls it and returns true if it did, in which
+ * case the object retries what failed, once, bracketed the same way
+ * (the lock is taken again after all).  They nest, only the outermost
+ * end calls the reclaim function.
+ */
+extern __thread int mem_monitor_reclaim_deferrals;
+extern __thread mem_monitor_t *mem_monitor_deferred_reclaim;
+
+extern boolean
+mem_monitor_run_deferred_reclaim (void);
+
+static inline void
+mem_monitor_defer_reclaim_begin (void)
+{ mem_monitor_reclaim_deferrals++; }
+
+static inline boolean
+mem_monitor_defer_reclaim_end (void)
+{
+    return
+        (0 == --mem_monitor_reclaim_deferrals) &&
+        mem_monitor_deferred_reclaim &&
+        mem_monitor_run_deferred_reclaim();
+}
+
+/*
+ * Serve the allocations of up to 'max_size' bytes of this monitor from
+ * 'alloc_fn' (which must return blocks of registered slabs whose
+ * 'mmp' is this monitor) with no header.  A NULL 'alloc_fn' stops it.
+ * Blocks are accounted with the size of their slab's size class.  If
+ * 'alloc_fn' fails, the block comes from malloc as usual.  Headerless
+ * blocks are never profiled.
+ */
+extern void
+mem_monitor_set_slabs (mem_monitor_t *mmp, mem_slab_alloc_fn alloc_fn,
+    void *arg, int max_size);
+
+/*
+ * Register (or unregister, before freeing them) the 'size' bytes of
+ * MEM_SLAB_PAGE_SIZE aligned pages at 'pages' as belonging to 'slab'.
+ * Returns 0 or ENOMEM.  Registering is locked but looking a page up
+ * never is.
+ */
+extern int
+mem_monitor_register_slab (void *pages, int size, mem_slab_t *slab);
+
+extern void
+mem_monitor_unregister_slab (void *pages, int size);
+
+/*
+ * Sum up all the shards of a monitor into 'totals'
+ */
+extern void
+mem_monitor_totals (mem_monitor_t *mmp, mem_monitor_shard_t *totals);
+
+/*
+ * the most commonly needed total, on its own
+ */
+static inline unsigned long long
+mem_monitor_bytes_used (mem_monitor_t *mmp)
+{
+    unsigned long long bytes_used = 0;
+    int s;
+
+    for (s = 0; s < MEM_MONITOR_SHARDS; s++) {
+        bytes_used += mmp->shards[s].bytes_used;
+    }
+    return bytes_used;
+}
+
+/*
+ * For memory an object obtains by other means (mmap etc.) but still
+ * wants accounted for in a monitor.  'bytes' may be negative.  This is
+ * only book keeping, it is never refused because of a budget.
+ */
+extern void
+mem_monitor_record (mem_monitor_t *mmp, long long bytes,
+    int allocations, int frees);
+
+/*
+ * By default, all memory comes from malloc.  A backend allocator can
+ * instead be plugged in which serves all requests whose size (including
+ * the small hidden header the monitor adds) is no more than 'max_size'.
+ * 'arg' is passed back to 'alloc_fn'.  'free_fn' is given the very same
+ * pointer 'alloc_fn' returned.  Blocks remember where they came from, so
+ * the backend can be plugged in at any time but must not be destroyed
+ * while any of its blocks are still in use.  Passing a NULL 'alloc_fn'
+ * reverts back to malloc.
+ *
+ * Memory the backend itself needs is never served by the backend.
+ */
+typedef void *(*mem_backend_alloc_fn)(void *arg, int size);
+typedef void (*mem_backend_free_fn)(void *block);
+
+extern void
+mem_monitor_set_backend (mem_backend_alloc_fn alloc_fn,
+    mem_backend_free_fn free_fn, void *arg, int max_size);
 
 extern void *
 mem_monitor_allocate (mem_monitor_t *mmp, int size,
@@ -49,14 +265,87 @@ mem_monitor_reallocate (mem_monitor_t *mmp,
 extern void
 mem_monitor_free (void *ptr);
 
+/*
+ * For blocks which must start at an 'alignment' (a power of 2) boundary.
+ * These have no hidden header (so that nothing precedes the alignment
+ * boundary) and hence must be freed with the same monitor & size.
+ */
+extern void *
+mem_monitor_allocate_aligned (mem_monitor_t *mmp, int size, int alignment);
+
+extern void
+mem_monitor_free_aligned (mem_monitor_t *mmp, void *ptr, int size);
+
+/*
+ * For big blocks which should be backed by huge pages.  The block is
+ * mapped with MAP_HUGETLB if the system has huge pages reserved, else
+ * it is mapped normally, aligned to MEM_HUGE_PAGE_SIZE and marked with
+ * MADV_HUGEPAGE so that transparent huge pages can back it.  Size is
+ * always rounded up to a multiple of MEM_HUGE_PAGE_SIZE, which is
+ * what 'mem_monitor_huge_size' returns and what gets accounted for.
+ * The block must be freed with the same monitor & originally
+ * requested size.
+ */
+#define MEM_HUGE_PAGE_SIZE          (2 * 1024 * 1024)
+
+static inline int
+mem_monitor_huge_size (int size)
+{
+    return
+        (size + MEM_HUGE_PAGE_SIZE - 1) & ~(MEM_HUGE_PAGE_SIZE - 1);
+}
+
+extern void *
+mem_monitor_allocate_huge (mem_monitor_t *mmp, int size);
+
+extern void
+mem_monitor_free_huge (mem_monitor_t *mmp, void *ptr, int size);
+
+/*
+ * For deferred freeing.  'mem_monitor_retire' marks the block as retired
+ * in its monitor's deferred counters.  'mem_monitor_free_retired' must
+ * later be used to really free it, instead of 'mem_monitor_free'.
+ */
+extern void
+mem_monitor_retire (void *ptr);
+
+extern void
+mem_monitor_free_retired (void *ptr);
+
+/*
+ * Heap profiler.  Once started, roughly one allocation in every
+ * 'sample_period' bytes allocated (by each thread) is sampled & its
+ * call stack (up to MEM_PROFILE_DEPTH frames) recorded, so the live
+ * bytes of every allocation site can be estimated.  Only the memory
+ * with a hidden header (allocate & reallocate) is profiled.  When not
+ * profiling, allocating costs a single extra branch and so does
+ * freeing.  Stopping only stops sampling; blocks already sampled are
+ * still taken off their sites when freed.  Starting again with a
+ * different period fails with EBUSY while sampled blocks are alive.
+ *
+ * 'mem_monitor_profile_dump' writes the live bytes of every site in
+ * folded stack format ("outermost;...;innermost bytes" per line) as
+ * used by flame graph tools, and returns the number of sites written.
+ * Function names need the program to be linked with -rdynamic, else
+ * the addresses are written.
+ */
+#define MEM_PROFILE_DEPTH           8
+
+extern int
+mem_monitor_profile_start (int sample_period);
+
+extern void
+mem_monitor_profile_stop (void);
+
+extern int
+mem_monitor_profile_dump (FILE *fp);
+
 #define MEM_MON_VARIABLES \
     mem_monitor_t mem_mon, *mem_mon_p
 
 #define MEM_MONITOR_SETUP(objp) \
     do { \
-        objp->mem_mon.bytes_used = 0; \
-        objp->mem_mon.allocations = 0; \
-        objp->mem_mon.frees = 0; \
+        memset(&objp->mem_mon, 0, sizeof(mem_monitor_t)); \
         objp->mem_mon_p = \
             parent_mem_monitor ? parent_mem_monitor : &objp->mem_mon; \
     } while (0)
@@ -79,7 +368,7 @@ mem_monitor_free (void *ptr);
 #define OBJECT_MEMORY_USAGE(objp, size_in_bytes, size_in_megabytes) \
     do { \
         size_in_bytes = ((unsigned long long int) (sizeof(*(objp)) + \
-            (objp)->mem_mon_p->bytes_used)); \
+            mem_monitor_bytes_used((objp)->mem_mon_p))); \
         size_in_megabytes = ((double) size_in_bytes / (double) (1024 * 1024)); \
     } while (0)
 
@@ -0,0 +1,185 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#include "slab_allocator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static int slab_class_sizes [] = { SLAB_SIZE_CLASSES };
+
+#define SLAB_CLASSES \
+    ((int) (sizeof(slab_class_sizes) / sizeof(slab_class_sizes[0])))
+
+static void *
+slab_backend_alloc (void *arg, int size)
+{
+    return
+        slab_alloc((slab_allocator_t*) arg, size);
+}
+
+/**************************** Initialize *************************************/
+
+PUBLIC int
+slab_allocator_init (slab_allocator_t *sap,
+    boolean make_it_thread_safe,
+    mem_monitor_t *parent_mem_monitor)
+{
+    int c, idx, rv;
+
+    assert(SLAB_CLASSES <= SLAB_MAX_CLASSES);
+    assert(slab_class_sizes[SLAB_CLASSES - 1] == SLAB_MAX_SIZE);
+
+    memset(sap, 0, sizeof(slab_allocator_t));
+    MEM_MONITOR_SETUP(sap);
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        rv = chunk_manager_init(&sap->classes[c], make_it_thread_safe,
+                slab_class_sizes[c], SLAB_CHUNKS_PER_GROUP, sap->mem_mon_p);
+        if (rv) {
+            while (--c >= 0) chunk_manager_destroy(&sap->classes[c]);
+            return rv;
+        }
+    }
+
+    idx = 0;
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        for (; idx <= slab_class_sizes[c]; idx++) {
+            sap->size_lookup_table[idx] = c;
+        }
+    }
+
+    return 0;
+}
+
+/**************************** Alloc ******************************************/
+
+PUBLIC void *
+slab_alloc (slab_allocator_t *sap, int size)
+{
+    if ((size < 0) || (size > SLAB_MAX_SIZE)) return null;
+    return
+        chunk_alloc(&sap->classes[sap->size_lookup_table[size]]);
+}
+
+/* the slab allocator plugged in as the backend of the mem monitor */
+static slab_allocator_t *backend_slab = NULL;
+
+PUBLIC int
+slab_allocator_use_for_mem_monitor (slab_allocator_t *sap)
+{
+    if (sap) {
+        if (sap->served) return EBUSY;
+        backend_slab = sap;
+        mem_monitor_set_backend(slab_backend_alloc, chunk_free,
+            sap, SLAB_MAX_SIZE);
+    } else {
+        mem_monitor_set_backend(NULL, NULL, NULL, 0);
+        backend_slab = NULL;
+    }
+    return 0;
+}
+
+PUBLIC int
+slab_allocator_serve_mem_monitor (slab_allocator_t *sap, mem_monitor_t *mmp)
+{
+    mem_monitor_t *m;
+    int c, rv;
+
+    /* the same memory would be charged twice to a common ancestor */
+    for (m = sap->mem_mon_p; m; m = m->parent) {
+        if (m == mmp) return EINVAL;
+    }
+    for (m = mmp; m; m = m->parent) {
+        if (m == sap->mem_mon_p) return EINVAL;
+    }
+
+    /* all or nothing, so check everything first */
+    if (CHUNK_PAGE_SIZE % MEM_SLAB_PAGE_SIZE) return EINVAL;
+    if (sap == backend_slab) return EBUSY;
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        if (sap->classes[c].n_groups) return EBUSY;
+    }
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        sap->slabs[c].mmp = mmp;
+        sap->slabs[c].block_size = slab_class_sizes[c];
+        sap->slabs[c].free_fn = chunk_free;
+        rv = chunk_manager_set_slab(&sap->classes[c], &sap->slabs[c]);
+        if (rv) {
+
+            /* something got allocated meanwhile, undo the others */
+            while (--c >= 0) {
+                (void) chunk_manager_set_slab(&sap->classes[c], NULL);
+            }
+            return rv;
+        }
+    }
+    sap->served = mmp;
+    mem_monitor_set_slabs(mmp, slab_backend_alloc, sap, SLAB_MAX_SIZE);
+
+    return 0;
+}
+
+/**************************** Trim *******************************************/
+
+PUBLIC int
+slab_allocator_trim (slab_allocator_t *sap)
+{
+    int c, groups = 0;
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        groups += chunk_manager_trim(&sap->classes[c]);
+    }
+    return groups;
+}
+
+/**************************** Destroy ****************************************/
+
+PUBLIC void
+slab_allocator_destroy (slab_allocator_t *sap)
+{
+    int c;
+
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        chunk_manager_destroy(&sap->classes[c]);
+    }
+    memset(sap, 0, sizeof(slab_allocator_t));
+}
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
@@ -0,0 +1,163 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#ifndef __SLAB_ALLOCATOR_H__
+#define __SLAB_ALLOCATOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+#include "mem_monitor_object.h"
+#include "chunk_manager.h"
+
+/******************************************************************************
+ *
+ * A size class slab allocator for variable sized small objects.
+ *
+ * 'chunk_manager' serves only one size.  This keeps one chunk manager
+ * per size class and serves each request from the smallest class which
+ * can accommodate it.  The class is found with a single lookup into a
+ * table indexed by the requested size, same as the buffer manager.
+ * Anything bigger than the biggest class is not served (NULL returned)
+ * and must be obtained elsewhere.
+ *
+ * Since every chunk knows which chunk manager it came from, freeing
+ * does not need to know the size or even the slab allocator.
+ *
+ * A slab allocator can also be plugged in as the backend of the mem
+ * monitor by 'slab_allocator_use_for_mem_monitor' so that all the
+ * small MEM_MONITOR_ALLOC requests of every object are served from it
+ * rather than from malloc.
+ */
+
+/*
+ * size classes, each is a multiple of 8 and they must be increasing.
+ * The last one is also the biggest size served and can be at most
+ * MAX_CHUNK_SIZE.
+ */
+#define SLAB_SIZE_CLASSES \
+    16, 24, 32, 48, 64, 80, 96, 128, 160, 192, 224, 256
+
+#define SLAB_MAX_CLASSES            12
+#define SLAB_MAX_SIZE               256
+
+/* how many chunks each class pre allocates at a time */
+#define SLAB_CHUNKS_PER_GROUP       256
+
+typedef struct slab_allocator_s {
+
+    MEM_MON_VARIABLES;
+
+    /* one chunk manager per size class */
+    chunk_manager_t classes [SLAB_MAX_CLASSES];
+
+    /* which class serves each size, indexed by size */
+    byte size_lookup_table [SLAB_MAX_SIZE + 1];
+
+    /* only when serving a mem monitor with no headers */
+    mem_monitor_t *served;
+    mem_slab_t slabs [SLAB_MAX_CLASSES];
+
+} slab_allocator_t;
+
+/*
+ * Initializes the slab allocator, returns 0 or an errno.
+ */
+extern int
+slab_allocator_init (slab_allocator_t *sap,
+    boolean make_it_thread_safe,
+    mem_monitor_t *parent_mem_monitor);
+
+/*
+ * returns a block of at least 'size' bytes or NULL if 'size'
+ * is more than SLAB_MAX_SIZE or no memory is left.
+ */
+extern void *
+slab_alloc (slab_allocator_t *sap, int size);
+
+/*
+ * frees a block obtained from 'slab_alloc'
+ */
+static inline void
+slab_free (void *ptr)
+{ chunk_free(ptr); }
+
+/*
+ * Serve all the small allocations of the mem monitor from this slab
+ * allocator (or pass NULL to go back to malloc).  The slab allocator
+ * must have been initialized as thread safe if the mem monitor will
+ * be used by more than one thread.  Returns EBUSY if the slab allocator
+ * already serves a mem monitor with no headers (see below), since its
+ * blocks would then be mistaken for headerless ones when freed.
+ */
+extern int
+slab_allocator_use_for_mem_monitor (slab_allocator_t *sap);
+
+/*
+ * Serve the small allocations of only 'mmp' from this slab allocator
+ * with no hidden headers at all (see 'mem_monitor_set_slabs'), so a 32
+ * byte block really takes 32 bytes.  Must be called before anything
+ * is allocated from the slab allocator, and not on the slab allocator
+ * used for the mem monitor as a whole (see above), else EBUSY is
+ * returned and none of the size classes are changed.  The slab
+ * allocator is then dedicated to 'mmp'.
+ *
+ * 'mmp' is charged the size class of each block, whereas the memory
+ * of the slabs themselves is charged to the monitor the slab allocator
+ * was initialized with.  So that may not be 'mmp', one of its ancestors
+ * or one of its descendants, since the same memory would be counted
+ * twice, EINVAL is returned if it is.
+ */
+extern int
+slab_allocator_serve_mem_monitor (slab_allocator_t *sap, mem_monitor_t *mmp);
+
+/*
+ * returns cached but unused memory of all the size classes back to
+ * the OS, return value is the number of chunk groups freed.
+ */
+extern int
+slab_allocator_trim (slab_allocator_t *sap);
+
+extern void
+slab_allocator_destroy (slab_allocator_t *sap);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif // __SLAB_ALLOCATOR_H__
+
@@ -0,0 +1,127 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#ifndef __TAGGED_HEAD_H__
+#define __TAGGED_HEAD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+/******************************************************************************
+ *
+ * Head of a lock free (Treiber) stack, a pointer and a tag which is
+ * changed at every update so that a stale head (ABA) can never be
+ * swapped in by a thread which read the head, got delayed and meanwhile
+ * the same pointer came back to the top of the stack.
+ *
+ * By default the head is 16 bytes, a full pointer and a full 64 bit tag,
+ * which is updated with a 16 byte compare & swap (-mcx16 on x86_64, see
+ * the Makefile).  A 64 bit tag never wraps around in practice.
+ *
+ * Defining TAGGED_HEAD_PACKED opts in to an 8 byte head instead, where
+ * a 16 bit tag is packed into the top bits of a 48 bit pointer.  The
+ * tag then wraps around after 65536 updates, so a thread delayed across
+ * that many updates of the same stack WILL corrupt it, and the pointers
+ * must really fit in 48 bits (with 5 level page tables, linux only hands
+ * out addresses above that to mmap calls which ask for them).  Only use
+ * it where both are known to hold.
+ *
+ ******************************************************************************/
+
+#ifdef TAGGED_HEAD_PACKED
+
+#if __SIZEOF_POINTER__ != 8
+#error "packed tagged heads need 64 bit pointers"
+#endif
+
+#define TAGGED_HEAD_PTR_BITS        48
+
+typedef unsigned long long tagged_head_t;
+
+#define TAGGED_HEAD_PTR_MASK \
+    ((1ULL << TAGGED_HEAD_PTR_BITS) - 1)
+#define TAGGED_HEAD_PTR(h) \
+    ((void*) (unsigned long) ((h) & TAGGED_HEAD_PTR_MASK))
+#define TAGGED_HEAD_TAG(h) \
+    ((h) >> TAGGED_HEAD_PTR_BITS)
+#define TAGGED_HEAD_MAKE(ptr, tag) \
+    (((tagged_head_t) (tag) << TAGGED_HEAD_PTR_BITS) | \
+        ((unsigned long) (ptr) & TAGGED_HEAD_PTR_MASK))
+#define TAGGED_HEAD_TAG_OF(hp) \
+    TAGGED_HEAD_TAG(*(hp))
+
+#else /* !TAGGED_HEAD_PACKED */
+
+#ifndef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+#error "tagged heads need a 16 byte compare & swap (-mcx16 on x86_64)"
+#endif
+
+typedef unsigned __int128 tagged_head_t;
+
+#define TAGGED_HEAD_PTR(h) \
+    ((void*) (unsigned long) (h))
+#define TAGGED_HEAD_TAG(h) \
+    ((unsigned long long) ((h) >> 64))
+#define TAGGED_HEAD_MAKE(ptr, tag) \
+    (((tagged_head_t) (tag) << 64) | (unsigned long) (ptr))
+
+/* the tag of the head at 'hp' only, with a single 8 byte load */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TAGGED_HEAD_TAG_OF(hp) \
+    (((volatile unsigned long long*) (hp))[1])
+#else
+#define TAGGED_HEAD_TAG_OF(hp) \
+    (((volatile unsigned long long*) (hp))[0])
+#endif
+
+#endif /* TAGGED_HEAD_PACKED */
+
+/*
+ * An atomic read of the whole head.  A 16 byte head cannot be read
+ * with a single plain load, so this is done with a compare & swap
+ * which does not change anything.
+ */
+#define TAGGED_HEAD_READ(hp) \
+    __sync_val_compare_and_swap((hp), 0, 0)
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif // __TAGGED_HEAD_H__
+
@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <pthread.h>
 
 #include "timer_object.h"
 #include "avl_tree_object.h"
@@ -117,6 +118,209 @@ traverse_test (void)
     printf("ok\n");
 }
 
+/*
+ * records carrying their own tree node
+ */
+#define RECORDS         (1024 * 1024)
+
+typedef struct record_s {
+
+    int key;
+    avl_node_t node;
+
+} record_t;
+
+record_t records [RECORDS], copies [RECORDS];
+int visited;
+
+static int
+record_compare (void *p1, void *p2)
+{
+    return ((record_t*) p1)->key - ((record_t*) p2)->key;
+}
+
+static int
+record_check (void *utility, void *node, void *data,
+        void *p0, void *p1, void *p2, void *p3)
+{
+    record_t *rec = (record_t*) data;
+
+    if ((node != &rec->node) || (rec != &copies[rec->key])) {
+        (*((int*) p0))++;
+    }
+    visited++;
+    return 0;
+}
+
+static int
+insert_search_records (avl_tree_t *tree, char *name)
+{
+    timer_obj_t tmr;
+    void *found;
+    unsigned int i;
+    int errors = 0;
+
+    printf("\n%s: inserting & searching %d records .. ", name, RECORDS);
+    fflush(stdout);
+    timer_start(&tmr);
+    for (i = 0; i < RECORDS; i++) {
+        if (avl_tree_insert(tree, &records[(i * 7919u) % RECORDS],
+                &found, false)) {
+            errors++;
+        }
+    }
+    for (i = 0; i < RECORDS; i++) {
+        if (avl_tree_search(tree, &records[(i * 104729u) % RECORDS], &found))
+            errors++;
+    }
+    timer_end(&tmr);
+    printf("ok\n");
+    timer_report(&tmr, 2 * RECORDS, NULL);
+    return errors;
+}
+
+static void
+intrusive_test (void)
+{
+    avl_tree_t tree;
+    void *found;
+    int i, errors = 0;
+
+    for (i = 0; i < RECORDS; i++) {
+        records[i].key = copies[i].key = i;
+    }
+    if (avl_tree_init_intrusive(&tree, LOCK_TYPE_SEQLOCK, false,
+            record_compare, AVL_NODE_OFFSET(record_t, node), NULL)
+                != EINVAL) {
+        errors++;
+    }
+
+    /* the same work with the nodes allocated by the tree */
+    avl_tree_init(&tree, false, false, record_compare, NULL);
+    errors += insert_search_records(&tree, "allocated nodes");
+    avl_tree_destroy(&tree, NULL, NULL);
+
+    avl_tree_init_intrusive(&tree, false, false, record_compare,
+        AVL_NODE_OFFSET(record_t, node), NULL);
+    errors += insert_search_records(&tree, "intrusive nodes");
+    if (mem_monitor_bytes_used(&tree.mem_mon) != 0) errors++;
+
+    /* overwriting swaps the embedded nodes in */
+    for (i = 0; i < RECORDS; i++) {
+        if (avl_tree_insert(&tree, &copies[i], &found, true) ||
+            (found != &records[i])) {
+                errors++;
+        }
+    }
+    memset(records, 0xEE, sizeof(records));
+    visited = 0;
+    avl_tree_morris_traverse(&tree, NULL, record_check, &errors,
+        NULL, NULL, NULL);
+    if (visited != RECORDS) errors++;
+    for (i = 0; i < RECORDS; i += 2) {
+        if (avl_tree_remove(&tree, &copies[i], &found) ||
+            (found != &copies[i])) {
+                errors++;
+        }
+    }
+    if (avl_tree_size(&tree) != RECORDS / 2) errors++;
+    avl_tree_destroy(&tree, NULL, NULL);
+
+    printf("\nintrusive test: %d errors\n", errors);
+}
+
+/*
+ * Optimistic (lockless) searches running while a writer inserts &
+ * removes.  The even keys are always in the tree, the odd ones come
+ * & go, and the removed nodes are retired rather than freed.
+ */
+#define OPT_KEYS        4096
+#define OPT_READERS     4
+#define OPT_ROUNDS      200
+
+int opt_keys [OPT_KEYS];
+avl_tree_t opt_tree;
+volatile int opt_done;
+int opt_errors;
+
+static int
+key_compare (void *p1, void *p2)
+{
+    return *((int*) p1) - *((int*) p2);
+}
+
+static void *
+optimistic_reader (void *arg)
+{
+    unsigned int seed = pointer2integer(arg);
+    void *found;
+    int k;
+
+    while (!opt_done) {
+        k = rand_r(&seed) % OPT_KEYS;
+        if (avl_tree_search(&opt_tree, &k, &found) == 0) {
+            if (found != &opt_keys[k]) __sync_fetch_and_add(&opt_errors, 1);
+        } else if (0 == (k & 1)) {
+            __sync_fetch_and_add(&opt_errors, 1);
+        }
+    }
+    return NULL;
+}
+
+static void
+optimistic_test (void)
+{
+    pthread_t readers [OPT_READERS];
+    mem_monitor_t mon;
+    mem_monitor_shard_t totals;
+    void *found;
+    int i, r, round;
+
+    mem_monitor_init(&mon, NULL);
+    if (avl_tree_init(&opt_tree, LOCK_TYPE_SEQLOCK, false, key_compare,
+            &mon)) {
+        printf("could not create optimistic tree\n");
+        return;
+    }
+    for (i = 0; i < OPT_KEYS; i++) {
+        opt_keys[i] = i;
+        if ((0 == (i & 1)) &&
+            avl_tree_insert(&opt_tree, &opt_keys[i], &found, false)) {
+                opt_errors++;
+        }
+    }
+    for (r = 0; r < OPT_READERS; r++) {
+        pthread_create(&readers[r], NULL, optimistic_reader,
+            integer2pointer(r + 1));
+    }
+    for (round = 0; round < OPT_ROUNDS; round++) {
+        for (i = 1; i < OPT_KEYS; i += 2) {
+            if (avl_tree_insert(&opt_tree, &opt_keys[i], &found, false)) {
+                opt_errors++;
+            }
+        }
+        for (i = 1; i < OPT_KEYS; i += 2) {
+            if (avl_tree_remove(&opt_tree, &opt_keys[i], &found) ||
+                (found != &opt_keys[i])) {
+                    opt_errors++;
+            }
+        }
+    }
+    opt_done = 1;
+    for (r = 0; r < OPT_READERS; r++) pthread_join(readers[r], NULL);
+
+    /* every retired node must have been freed by now */
+    avl_tree_destroy(&opt_tree, NULL, NULL);
+    mem_monitor_totals(&mon, &totals);
+    if (totals.bytes_used || totals.deferred_blocks ||
+        (totals.allocations != totals.frees)) {
+            printf("%llu bytes in %llu retired blocks left\n",
+                totals.bytes_used, totals.deferred_blocks);
+            opt_errors++;
+    }
+    printf("\noptimistic search test: %d errors\n", opt_errors);
+}
+
 #if 0
 
 void perform_avl_tree_test (avl_tree_t *avlt, int use_odd_numbers)
@@ -276,6 +480,8 @@ int main (argc, argv)
 int argc;
 char *argv [];
 {
+    optimistic_test();
+    intrusive_test();
     traverse_test();
     return 0;
 
@@ -0,0 +1,241 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timer_object.h"
+#include "avl_tree_object.h"
+#include "btree_object.h"
+
+#define COUNT           (1024 * 1024)
+
+int values [COUNT];
+int copies [COUNT];
+int order [COUNT];
+timer_obj_t tmr;
+int expected;
+
+static int
+int_compare (void *v1, void *v2)
+{
+    return *((int*) v1) - *((int*) v2);
+}
+
+static void
+shuffle (void)
+{
+    int i, j, t;
+
+    for (i = COUNT - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+static int
+order_check (void *utility, void *node, void *data,
+        void *p0, void *p1, void *p2, void *p3)
+{
+    int *errors = p0;
+
+    if (*((int*) data) != expected) (*errors)++;
+    expected += 2;
+    return 0;
+}
+
+static int
+stop_early (void *utility, void *node, void *data,
+        void *p0, void *p1, void *p2, void *p3)
+{
+    int *count = p0;
+
+    return (++(*count) == 10) ? EINTR : 0;
+}
+
+static int
+count_all (void *utility, void *node, void *data,
+        void *p0, void *p1, void *p2, void *p3)
+{
+    (*((int*) p0))++;
+    return 0;
+}
+
+static void
+destroy (void *data, void *unused)
+{
+    *((int*) data) = -1;
+}
+
+/*
+ * random inserts & removes, checking ordering and that the
+ * separators never refer to anything not in the tree
+ */
+static int
+btree_correctness_test (void)
+{
+    btree_t tree;
+    void *found;
+    int i, count, errors = 0;
+
+    if (btree_init(&tree, false, false, int_compare, NULL)) return 1;
+    shuffle();
+    for (i = 0; i < COUNT; i++) {
+        if (btree_insert(&tree, &values[order[i]], &found, false) || found) {
+            errors++;
+        }
+    }
+    if (btree_insert(&tree, &copies[5], &found, false) ||
+        (found != &values[5])) {
+            errors++;
+    }
+    if (btree_size(&tree) != COUNT) errors++;
+
+    /* remove every odd value in random order */
+    shuffle();
+    for (i = 0; i < COUNT; i++) {
+        if (0 == (order[i] & 1)) continue;
+        if (btree_remove(&tree, &values[order[i]], &found) ||
+            (found != &values[order[i]])) {
+                errors++;
+        }
+        if (btree_search(&tree, &values[order[i]], &found) != ENODATA) {
+            errors++;
+        }
+    }
+    if (btree_remove(&tree, &values[1], &found) != ENODATA) errors++;
+
+    /* replace every even value, nothing may refer to the originals */
+    for (i = 0; i < COUNT; i += 2) {
+        if (btree_insert(&tree, &copies[i], &found, true) ||
+            (found != &values[i])) {
+                errors++;
+        }
+        values[i] = -1;
+    }
+    expected = 0;
+    btree_traverse(&tree, NULL, order_check, &errors, NULL, NULL, NULL);
+    if (expected != COUNT) errors++;
+    for (i = 0; i < COUNT; i += 2) {
+        values[i] = i;
+        if (btree_search(&tree, &values[i], &found) ||
+            (found != &copies[i])) {
+                errors++;
+        }
+    }
+
+    /* range scan & early stop */
+    expected = COUNT / 2;
+    btree_traverse(&tree, &values[COUNT / 2 - 1], order_check,
+        &errors, NULL, NULL, NULL);
+    if (expected != COUNT) errors++;
+    count = 0;
+    if (btree_traverse(&tree, NULL, stop_early, &count, NULL, NULL, NULL)
+            != EINTR) {
+        errors++;
+    }
+    if (count != 10) errors++;
+
+    /* drain it completely, then re-use it */
+    shuffle();
+    for (i = 0; i < COUNT; i++) {
+        if (order[i] & 1) continue;
+        if (btree_remove(&tree, &values[order[i]], &found)) errors++;
+    }
+    if (btree_size(&tree) || tree.root_node ||
+        mem_monitor_bytes_used(&tree.mem_mon)) {
+            errors++;
+    }
+    for (i = 0; i < COUNT; i++) {
+        if (btree_insert(&tree, &copies[i], &found, false)) errors++;
+    }
+    btree_destroy(&tree, destroy, NULL);
+    for (i = 0; i < COUNT; i++) {
+        if (copies[i] != -1) errors++;
+        copies[i] = i;
+    }
+
+    fprintf(stderr, "btree correctness: %d errors\n", errors);
+    return errors;
+}
+
+#define BENCHMARK(name, tree, init, insert, search, traverse, remove) \
+    do { \
+        long long int bytes; \
+        double mbytes; \
+        void *found; \
+        int i, count = 0; \
+        \
+        init; \
+        shuffle(); \
+        printf("\n%s: inserting %d entries\n", name, COUNT); \
+        timer_start(&tmr); \
+        for (i = 0; i < COUNT; i++) { \
+            if (insert(tree, &values[order[i]], &found, false)) errors++; \
+        } \
+        timer_end(&tmr); \
+        timer_report(&tmr, COUNT, NULL); \
+        OBJECT_MEMORY_USAGE(tree, bytes, mbytes); \
+        printf("%s: %lld bytes (%f Mbytes)\n", name, bytes, mbytes); \
+        shuffle(); \
+        printf("%s: searching %d entries\n", name, COUNT); \
+        timer_start(&tmr); \
+        for (i = 0; i < COUNT; i++) { \
+            if (search(tree, &values[order[i]], &found)) errors++; \
+        } \
+        timer_end(&tmr); \
+        timer_report(&tmr, COUNT, NULL); \
+        printf("%s: traversing %d entries\n", name, COUNT); \
+        timer_start(&tmr); \
+        traverse; \
+        timer_end(&tmr); \
+        timer_report(&tmr, COUNT, NULL); \
+        if (count != COUNT) errors++; \
+        shuffle(); \
+        printf("%s: removing %d entries\n", name, COUNT); \
+        timer_start(&tmr); \
+        for (i = 0; i < COUNT; i++) { \
+            if (remove(tree, &values[order[i]], &found)) errors++; \
+        } \
+        timer_end(&tmr); \
+        timer_report(&tmr, COUNT, NULL); \
+    } while (0)
+
+static int
+benchmark (void)
+{
+    avl_tree_t avl;
+    btree_t btree;
+    int errors = 0;
+
+    BENCHMARK("avl", (&avl),
+        avl_tree_init(&avl, false, false, int_compare, NULL),
+        avl_tree_insert, avl_tree_search,
+        avl_tree_iterate(&avl, NULL, count_all, &count, NULL, NULL, NULL),
+        avl_tree_remove);
+    avl_tree_destroy(&avl, NULL, NULL);
+
+    BENCHMARK("btree", (&btree),
+        btree_init(&btree, false, false, int_compare, NULL),
+        btree_insert, btree_search,
+        btree_traverse(&btree, NULL, count_all, &count, NULL, NULL, NULL),
+        btree_remove);
+    btree_destroy(&btree, NULL, NULL);
+
+    fprintf(stderr, "\nbenchmark: %d errors\n", errors);
+    return errors;
+}
+
+int main (int argc, char *argv[])
+{
+    int i, errors;
+
+    for (i = 0; i < COUNT; i++) {
+        values[i] = copies[i] = order[i] = i;
+    }
+    srand(1);
+    errors = btree_correctness_test();
+    errors += benchmark();
+    return errors ? -1 : 0;
+}
+
@@ -0,0 +1,115 @@
+
+#include <stdio.h>
+#include "buffer_chain.h"
+
+#define SMALL                   256
+#define BIG                     2048
+#define COUNT                   64
+#define MESSAGE                 10000
+#define HEADER                  20
+
+static size_count_tuple_t tuples [] = {
+    { SMALL, COUNT },
+    { BIG, COUNT },
+    { -1, -1 }
+};
+
+static buffer_manager_t bm;
+static byte message [MESSAGE + 3 * HEADER];
+static byte copy [MESSAGE + 3 * HEADER + 100 + 10];
+static void *all [2 * COUNT];
+
+static int
+check (byte *data, int length, int first_value)
+{
+    int i;
+
+    for (i = 0; i < length; i++) {
+        if (data[i] != (byte) (first_value + i)) return 1;
+    }
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    buffer_chain_t chain;
+    struct iovec iov [64];
+    byte *shared, *p;
+    int i, n, fd, errors = 0;
+    FILE *fp;
+
+    if (buffer_manager_initialize(&bm, false, tuples, NULL) ||
+        buffer_chain_init(&chain, &bm)) {
+            printf("initialization failed\n");
+            return -1;
+    }
+
+    /* message is 3 headers followed by the payload, all sequential */
+    for (i = 0; i < (int) sizeof(message); i++) message[i] = i;
+
+    /* payload much bigger than the biggest pool */
+    if (buffer_chain_append(&chain, &message[3 * HEADER], MESSAGE / 2) ||
+        buffer_chain_append(&chain, &message[3 * HEADER + MESSAGE / 2],
+            MESSAGE / 2)) {
+                errors++;
+    }
+    if ((chain.length != MESSAGE) ||
+        (chain.n_segments != (MESSAGE + BIG - 1) / BIG)) {
+            errors++;
+    }
+
+    /* first header needs a new segment, the others fit in front of it */
+    for (i = 2; i >= 0; i--) {
+        if (buffer_chain_prepend(&chain, &message[i * HEADER], HEADER)) {
+            errors++;
+        }
+    }
+    if ((chain.length != (int) sizeof(message)) ||
+        (chain.n_segments != (MESSAGE + BIG - 1) / BIG + 1)) {
+            errors++;
+    }
+
+    /* a shared buffer must never be written into by the chain */
+    shared = buffer_allocate(&bm, 100);
+    memset(shared, 0xEE, buffer_capacity(shared));
+    if (buffer_chain_append_buffer(&chain, shared, 0, 100)) errors++;
+    if (buffer_chain_append(&chain, message, 10)) errors++;
+    for (i = 0; i < buffer_capacity(shared); i++) {
+        if (shared[i] != 0xEE) errors++;
+    }
+    buffer_put(shared);
+
+    /* whole chain straight to a file without linearizing */
+    n = buffer_chain_iovec(&chain, iov, 64);
+    if (n != chain.n_segments) errors++;
+    fp = tmpfile();
+    fd = fileno(fp);
+    if (writev(fd, iov, n) != chain.length) errors++;
+    lseek(fd, 0, SEEK_SET);
+    if (read(fd, copy, sizeof(copy)) != sizeof(copy)) errors++;
+    if (check(copy, sizeof(message), 0)) errors++;
+    fclose(fp);
+
+    /* contiguous access across segment boundaries */
+    p = buffer_chain_pullup(&chain, BIG);
+    if ((NULL == p) || check(p, BIG, 0)) errors++;
+    if (buffer_chain_pullup(&chain, BIG + 1)) errors++;
+    memset(copy, 0, sizeof(copy));
+    if (buffer_chain_linearize(&chain, copy) != (int) sizeof(copy)) errors++;
+    if (check(copy, sizeof(message), 0) ||
+        (copy[sizeof(message)] != 0xEE) ||
+        check(&copy[sizeof(message) + 100], 10, 0)) {
+            errors++;
+    }
+
+    buffer_chain_destroy(&chain);
+
+    /* every single buffer must be back in its pool */
+    if (buffer_allocate_bulk(&bm, 1, all, 2 * COUNT) != 2 * COUNT) errors++;
+    buffer_free_bulk(all, 2 * COUNT);
+    buffer_manager_destroy(&bm);
+
+    printf("buffer chain test: %d errors\n", errors);
+    return errors ? -1 : 0;
+}
+
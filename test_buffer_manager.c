@@ -0,0 +1,407 @@
+
+#include <stdio.h>
+#include <pthread.h>
+#include "buffer_manager.h"
+
+#define THREADS                 8
+#define THREAD_BUFFERS          256
+#define THREAD_LOOP             2000
+
+static size_count_tuple_t tuples [] = {
+    { 128, 4096 },
+    { 1500, THREADS * THREAD_BUFFERS },
+    { 9000, THREADS * THREAD_BUFFERS },
+    { -1, -1 }
+};
+
+static int sizes [] = { 100, 1500, 9000 };
+
+static buffer_manager_t bm;
+static volatile int thread_errors = 0;
+timer_obj_t tp;
+
+/*
+ * every thread keeps allocating & freeing its own buffers of one
+ * size, writing a pattern into each and checking nobody else did.
+ */
+static void *
+thread_alloc_free (void *arg)
+{
+    int t = pointer2integer(arg);
+    int size = sizes[t % 3];
+    byte *my_buffers [THREAD_BUFFERS];
+    int i, j;
+
+    for (j = 0; j < THREAD_LOOP; j++) {
+        for (i = 0; i < THREAD_BUFFERS; i++) {
+            my_buffers[i] = buffer_allocate(&bm, size);
+            if (NULL == my_buffers[i]) {
+                __sync_fetch_and_add(&thread_errors, 1);
+                continue;
+            }
+            my_buffers[i][0] = t;
+            my_buffers[i][size - 1] = i;
+        }
+        for (i = 0; i < THREAD_BUFFERS; i++) {
+            if (NULL == my_buffers[i]) continue;
+            if ((my_buffers[i][0] != t) ||
+                (my_buffers[i][size - 1] != (byte) i)) {
+                    __sync_fetch_and_add(&thread_errors, 1);
+            }
+            buffer_free(my_buffers[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * same as above, but allocates & frees BULK buffers at a time
+ */
+#define BULK                    32
+
+static void *
+thread_alloc_free_bulk (void *arg)
+{
+    int t = pointer2integer(arg);
+    int size = sizes[t % 3];
+    byte *my_buffers [THREAD_BUFFERS];
+    int i, j;
+
+    for (j = 0; j < THREAD_LOOP; j++) {
+        for (i = 0; i < THREAD_BUFFERS; i += BULK) {
+            if (buffer_allocate_bulk(&bm, size,
+                    (void**) &my_buffers[i], BULK) != BULK) {
+                __sync_fetch_and_add(&thread_errors, 1);
+                return NULL;
+            }
+        }
+        for (i = 0; i < THREAD_BUFFERS; i++) {
+            my_buffers[i][0] = t;
+            my_buffers[i][size - 1] = i;
+        }
+        for (i = 0; i < THREAD_BUFFERS; i++) {
+            if ((my_buffers[i][0] != t) ||
+                (my_buffers[i][size - 1] != (byte) i)) {
+                    __sync_fetch_and_add(&thread_errors, 1);
+            }
+        }
+        for (i = 0; i < THREAD_BUFFERS; i += BULK) {
+            buffer_free_bulk((void**) &my_buffers[i], BULK);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * once a pool is exhausted, the next bigger one must be used
+ * and once they are all exhausted, allocation must fail.
+ */
+static int
+exhaustion_test (void)
+{
+    static void *buffers [4096 + 1];
+    int i, errors = 0;
+
+    for (i = 0; i < 4096; i++) {
+        buffers[i] = buffer_allocate(&bm, 128);
+        if (NULL == buffers[i]) errors++;
+    }
+    buffers[i] = buffer_allocate(&bm, 128);
+    if (NULL == buffers[i]) errors++;
+    else buffer_free(buffers[i]);
+    if (buffer_allocate(&bm, 9001)) errors++;
+    for (i = 0; i < 4096; i++) {
+        if (buffers[i]) buffer_free(buffers[i]);
+    }
+
+    /* a bulk allocation spilling over into the next pool */
+    if (buffer_allocate_bulk(&bm, 128, buffers, 4096 + 1) != 4096 + 1) {
+        errors++;
+    } else {
+        buffer_free_bulk(buffers, 4096 + 1);
+    }
+    printf("exhaustion test: %d errors\n", errors);
+    return errors;
+}
+
+/*
+ * a buffer is fanned out to many consumers as clones & slices, which
+ * drop their references from different threads.  At the end, every
+ * single buffer must have gone back to its pool exactly once.
+ */
+#define FANOUT                  4
+#define FANOUT_ROUNDS           2000
+
+static buffer_slice_t slices [FANOUT][FANOUT_ROUNDS];
+
+static void *
+consumer (void *arg)
+{
+    int c = pointer2integer(arg);
+    int r, errors = 0;
+
+    for (r = 0; r < FANOUT_ROUNDS; r++) {
+        if ((slices[c][r].length != 100) ||
+            (((byte*) slices[c][r].data)[0] != (byte) (r + c))) {
+                errors++;
+        }
+        buffer_slice_put(&slices[c][r]);
+    }
+    __sync_fetch_and_add(&thread_errors, errors);
+    return NULL;
+}
+
+static int
+refcount_test (void)
+{
+    pthread_t consumers [FANOUT];
+    static void *all [4096];
+    byte *buffer, *clone;
+    buffer_slice_t slice;
+    int c, r, errors = 0;
+
+    buffer = buffer_allocate(&bm, 1000);
+    clone = buffer_clone(buffer);
+    if (clone != buffer) errors++;
+    if (buffer_slice(buffer, 1000, 501, &slice) != EINVAL) errors++;
+    buffer_put(buffer);
+    buffer_put(clone);
+
+    for (r = 0; r < FANOUT_ROUNDS; r++) {
+        buffer = buffer_allocate(&bm, 1000);
+        if (NULL == buffer) return 1;
+        for (c = 0; c < FANOUT; c++) {
+            buffer[c * 100] = r + c;
+            if (buffer_slice(buffer, c * 100, 100, &slices[c][r])) errors++;
+        }
+        buffer_put(buffer);
+    }
+    thread_errors = 0;
+    for (c = 0; c < FANOUT; c++) {
+        pthread_create(&consumers[c], NULL, consumer, integer2pointer(c));
+    }
+    for (c = 0; c < FANOUT; c++) pthread_join(consumers[c], NULL);
+    errors += thread_errors;
+
+    /* both pools must be complete again */
+    if (buffer_allocate_bulk(&bm, 1000, all, 2 * THREADS * THREAD_BUFFERS)
+            != 2 * THREADS * THREAD_BUFFERS) {
+        errors++;
+    }
+    if (buffer_allocate(&bm, 1000)) errors++;
+    buffer_free_bulk(all, 2 * THREADS * THREAD_BUFFERS);
+
+    printf("reference count test: %d errors\n", errors);
+    return errors;
+}
+
+/*
+ * an elastic pool must grow (up to its high watermark) rather than
+ * spill over to the next pool and give its idle blocks back when
+ * trimmed, even while other threads keep using it.
+ */
+#define ELASTIC_COUNT           64
+#define ELASTIC_BLOCKS          8
+
+static size_count_tuple_t elastic_tuples [] = {
+    { 256, ELASTIC_COUNT },
+    { 2048, ELASTIC_COUNT },
+    { -1, -1 }
+};
+
+static buffer_manager_t ebm;
+static volatile int elastic_done = 0;
+
+static void *
+elastic_user (void *arg)
+{
+    void *buffers [ELASTIC_COUNT * 2];
+    int i, n;
+
+    while (!elastic_done) {
+        n = buffer_allocate_bulk(&ebm, 200, buffers, ELASTIC_COUNT * 2);
+        for (i = 0; i < n; i++) ((byte*) buffers[i])[199] = i;
+        for (i = 0; i < n; i++) {
+            if (((byte*) buffers[i])[199] != (byte) i) {
+                __sync_fetch_and_add(&thread_errors, 1);
+            }
+        }
+        buffer_free_bulk(buffers, n);
+    }
+    return NULL;
+}
+
+static int
+elastic_test (void)
+{
+    static void *buffers [ELASTIC_COUNT * ELASTIC_BLOCKS + 1];
+    buffer_pool_t *poolp = &ebm.pools[0];
+    pthread_t users [THREADS];
+    int i, errors = 0;
+
+    if (buffer_manager_initialize_options(&ebm, true,
+            BUFFER_MANAGER_ELASTIC, elastic_tuples, NULL)) {
+        return 1;
+    }
+    if (buffer_manager_set_watermarks(&ebm, 0, 10, 5) != EINVAL) errors++;
+    if (buffer_manager_set_watermarks(&ebm, 2, 0, 5) != EINVAL) errors++;
+    buffer_manager_set_watermarks(&ebm, 0, ELASTIC_COUNT,
+        ELASTIC_COUNT * ELASTIC_BLOCKS);
+
+    /* grows up to the high watermark, then spills over */
+    for (i = 0; i <= ELASTIC_COUNT * ELASTIC_BLOCKS; i++) {
+        buffers[i] = buffer_allocate(&ebm, 200);
+        if (NULL == buffers[i]) errors++;
+    }
+    if (buffer_of(buffers[i - 1])->poolp != &ebm.pools[1]) errors++;
+    if (poolp->grows != ELASTIC_BLOCKS - 1) errors++;
+    if (poolp->total_buffers != ELASTIC_COUNT * ELASTIC_BLOCKS) errors++;
+    if (poolp->peak_in_use != ELASTIC_COUNT * ELASTIC_BLOCKS) errors++;
+    if (poolp->exhaustions != ELASTIC_BLOCKS) errors++;
+
+    /* nothing can be trimmed while in use */
+    if (buffer_manager_trim(&ebm)) errors++;
+    buffer_free_bulk(buffers, ELASTIC_COUNT * ELASTIC_BLOCKS + 1);
+    if (poolp->in_use) errors++;
+
+    /* everything but the low watermark goes back */
+    if (buffer_manager_trim(&ebm) != ELASTIC_BLOCKS - 1) errors++;
+    if (poolp->total_buffers != ELASTIC_COUNT) errors++;
+    if (buffer_allocate_bulk(&ebm, 200, buffers, ELASTIC_COUNT)
+            != ELASTIC_COUNT) {
+        errors++;
+    }
+    buffer_free_bulk(buffers, ELASTIC_COUNT);
+
+    /* now trim in the middle of threads growing the pool */
+    thread_errors = 0;
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&users[i], NULL, elastic_user, NULL);
+    }
+    for (i = 0; i < 1000; i++) {
+        buffer_manager_trim(&ebm);
+        sched_yield();
+    }
+    elastic_done = 1;
+    for (i = 0; i < THREADS; i++) pthread_join(users[i], NULL);
+    errors += thread_errors;
+    if (poolp->in_use) errors++;
+    buffer_manager_trim(&ebm);
+    if (poolp->total_buffers != ELASTIC_COUNT) errors++;
+
+    printf("elastic test: %llu grows %llu shrinks %d peak, %d errors\n",
+        poolp->grows, poolp->shrinks, poolp->peak_in_use, errors);
+    buffer_manager_destroy(&ebm);
+    return errors;
+}
+
+/*
+ * telemetry must count everything and the histogram it records must
+ * lead to the obvious tuples
+ */
+static size_count_tuple_t telemetry_tuples [] = {
+    { 1000, 100 },
+    { 4000, 100 },
+    { -1, -1 }
+};
+
+static int
+telemetry_test (void)
+{
+    static void *buffers [200];
+    buffer_manager_t tbm;
+    buffer_pool_stats_t stats [2];
+    buffer_size_sample_t samples [2 * BUFFER_HISTOGRAM_BUCKETS];
+    size_count_tuple_t suggested [3];
+    int i, n, errors = 0;
+
+    if (buffer_manager_initialize_options(&tbm, true,
+            BUFFER_MANAGER_TELEMETRY, telemetry_tuples, NULL)) {
+        return 1;
+    }
+    for (i = 0; i < 50; i++) buffers[i] = buffer_allocate(&tbm, 100);
+    if (buffer_allocate_bulk(&tbm, 3000, &buffers[50], 101) != 100) {
+        errors++;
+    }
+    for (i = 0; i < 2; i++) buffer_manager_pool_stats(&tbm, i, &stats[i]);
+    if ((stats[0].allocations != 50) || (stats[0].peak_in_use != 50) ||
+        (stats[0].requests != 50) || (stats[0].failures != 0) ||
+        (stats[0].wasted_bytes != 50 * (1000 - 125))) {
+            errors++;
+    }
+    if ((stats[1].allocations != 100) || (stats[1].in_use != 100) ||
+        (stats[1].requests != 101) || (stats[1].failures != 1)) {
+            errors++;
+    }
+    buffer_free_bulk(buffers, 150);
+    buffer_manager_pool_stats(&tbm, 1, &stats[1]);
+    if ((stats[1].frees != 100) || stats[1].in_use) errors++;
+    if (buffer_manager_pool_stats(&tbm, 2, &stats[1]) != EINVAL) errors++;
+
+    n = buffer_manager_export_histogram(&tbm, samples,
+            2 * BUFFER_HISTOGRAM_BUCKETS);
+    if ((n != 2) || (samples[0].size != 125) || (samples[0].count != 50) ||
+        (samples[1].size != 3063) || (samples[1].count != 101)) {
+            errors++;
+    }
+    if (buffer_manager_suggest_tuples(samples, n, 2, 200, suggested) ||
+        (suggested[0].size != 125) || (suggested[0].count != 66) ||
+        (suggested[1].size != 3063) || (suggested[1].count != 134) ||
+        (suggested[2].size != -1)) {
+            errors++;
+    }
+    if (buffer_manager_suggest_tuples(samples, n, 1, 200, suggested) ||
+        (suggested[0].size != 3063) || (suggested[0].count != 200)) {
+            errors++;
+    }
+
+    /* the big outlier gets a pool of its own, 100 & 200 share one */
+    samples[0].size = 100; samples[0].count = 10;
+    samples[1].size = 200; samples[1].count = 10;
+    samples[2].size = 1000; samples[2].count = 1;
+    if (buffer_manager_suggest_tuples(samples, 3, 2, 21, suggested) ||
+        (suggested[0].size != 200) || (suggested[0].count != 20) ||
+        (suggested[1].size != 1000) || (suggested[1].count != 1)) {
+            errors++;
+    }
+    if (buffer_manager_suggest_tuples(samples, 0, 1, 200, suggested)
+            != EINVAL) {
+        errors++;
+    }
+
+    printf("telemetry test: %d errors\n", errors);
+    buffer_manager_destroy(&tbm);
+    return errors;
+}
+
+int main (int argc, char *argv[])
+{
+    pthread_t threads [THREADS];
+    int i;
+
+    if (buffer_manager_initialize(&bm, true, tuples, NULL)) {
+        printf("buffer_manager_initialize failed\n");
+        return -1;
+    }
+    if (exhaustion_test()) return -1;
+    if (refcount_test()) return -1;
+    if (elastic_test()) return -1;
+    if (telemetry_test()) return -1;
+
+    timer_start(&tp);
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL,
+            (i & 1) ? thread_alloc_free_bulk : thread_alloc_free,
+            integer2pointer(i));
+    }
+    for (i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+    timer_end(&tp);
+    timer_report(&tp,
+        (unsigned long long) THREADS * THREAD_LOOP * THREAD_BUFFERS * 2,
+        NULL);
+    printf("%d threads: %d errors\n", THREADS, thread_errors);
+
+    buffer_manager_destroy(&bm);
+    return thread_errors ? -1 : 0;
+}
+
@@ -1,10 +1,18 @@
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <sched.h>
+#include <pthread.h>
 #include "chunk_manager.h"
 
 #define CHUNK_SIZE              128
 #define MAX_CHUNKS              (2*1024*1024)
 #define LOOP                    50
+#define THREADS                 8
+#define THREAD_CHUNKS           (64*1024)
+#define THREAD_LOOP             20
+#define TRIM_CHUNKS             (64*1024)
+#define REMOTE_CHUNKS           (64*1024)
 
 unsigned char *chunks [MAX_CHUNKS];
 chunk_manager_t cmgr;
@@ -39,6 +47,317 @@ validate_chunk (void *chunk, int starting_value)
     return 0;
 }
 
+/*
+ * every thread allocates & frees its own chunks from the same thread
+ * safe manager, which goes thru the per thread magazines or the lock
+ * free stack, while another thread keeps trimming the manager.
+ */
+static chunk_manager_t shared_cmgr;
+static volatile int thread_errors = 0;
+static volatile int threads_running = 0;
+
+static void *
+thread_trim (void *arg)
+{
+    while (threads_running) {
+        chunk_manager_trim(&shared_cmgr);
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static void *
+thread_alloc_free (void *arg)
+{
+    unsigned char **my_chunks;
+    int i, j, base = pointer2integer(arg) * THREAD_CHUNKS;
+
+    my_chunks = malloc(THREAD_CHUNKS * sizeof(unsigned char*));
+    for (j = 0; j < THREAD_LOOP; j++) {
+        for (i = 0; i < THREAD_CHUNKS; i++) {
+            my_chunks[i] = chunk_alloc(&shared_cmgr);
+            if (NULL == my_chunks[i]) {
+                __sync_fetch_and_add(&thread_errors, 1);
+            } else {
+                fill_chunk(my_chunks[i], base + i);
+            }
+        }
+        for (i = 0; i < THREAD_CHUNKS; i++) {
+            if (my_chunks[i]) {
+                if (validate_chunk(my_chunks[i], base + i)) {
+                    __sync_fetch_and_add(&thread_errors, 1);
+                }
+                chunk_free(my_chunks[i]);
+            }
+        }
+    }
+    free(my_chunks);
+    return NULL;
+}
+
+/*
+ * same as above, but allocates & frees BULK chunks at a time
+ */
+#define BULK                    32
+
+static void *
+thread_alloc_free_bulk (void *arg)
+{
+    unsigned char **my_chunks;
+    int i, j, k, got, base = pointer2integer(arg) * THREAD_CHUNKS;
+
+    my_chunks = malloc(THREAD_CHUNKS * sizeof(unsigned char*));
+    for (j = 0; j < THREAD_LOOP; j++) {
+        for (i = 0; i < THREAD_CHUNKS; i += got) {
+            got = chunk_alloc_bulk(&shared_cmgr, (void**) &my_chunks[i],
+                    THREAD_CHUNKS - i < BULK ? THREAD_CHUNKS - i : BULK);
+            if (0 == got) {
+                __sync_fetch_and_add(&thread_errors, 1);
+                break;
+            }
+        }
+        for (k = 0; k < i; k++) fill_chunk(my_chunks[k], base + k);
+        for (k = 0; k < i; k++) {
+            if (validate_chunk(my_chunks[k], base + k)) {
+                __sync_fetch_and_add(&thread_errors, 1);
+            }
+        }
+        for (k = 0; k < i; k += BULK) {
+            chunk_free_bulk((void**) &my_chunks[k],
+                i - k < BULK ? i - k : BULK);
+        }
+    }
+    free(my_chunks);
+    return NULL;
+}
+
+#define MAGAZINES       0
+#define LOCK_FREE       1
+#define NUMA            2
+
+static char *mode_names [] = { "magazines", "lock free", "numa" };
+
+static int
+thread_safe_integrity_test (int mode)
+{
+    pthread_t threads [THREADS], trimmer;
+    int i, rc, groups;
+
+    if (LOCK_FREE == mode) {
+        rc = chunk_manager_init_lock_free(&shared_cmgr,
+                CHUNK_SIZE, 1024, NULL);
+    } else if (NUMA == mode) {
+        rc = chunk_manager_init_numa(&shared_cmgr, true,
+                CHUNK_SIZE, 1024, NULL);
+    } else {
+        rc = chunk_manager_init(&shared_cmgr, true, CHUNK_SIZE, 1024, NULL);
+    }
+    if (rc) {
+        printf("thread safe chunk_manager_init failed\n");
+        return -1;
+    }
+    thread_errors = 0;
+    threads_running = 1;
+    pthread_create(&trimmer, NULL, thread_trim, NULL);
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL,
+            (i & 1) ? thread_alloc_free_bulk : thread_alloc_free,
+            integer2pointer(i));
+    }
+    for (i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+    threads_running = 0;
+    pthread_join(trimmer, NULL);
+
+    /* everything was freed, so trim must return every single group */
+    groups = chunk_manager_trim(&shared_cmgr);
+    printf("%d threads (%s): %d errors, %d groups trimmed\n",
+        THREADS, mode_names[mode], thread_errors, groups);
+    for (i = 0; (NUMA == mode) && (i < CHUNK_MAX_NUMA_NODES); i++) {
+        if (mem_monitor_bytes_used(
+                chunk_manager_node_mem_monitor(&shared_cmgr, i))) {
+            printf("node %d still has memory\n", i);
+            thread_errors++;
+        }
+    }
+    if (thread_errors || shared_cmgr.n_groups) {
+        printf("thread safe chunk integrity test failed\n");
+        return -1;
+    }
+    chunk_manager_destroy(&shared_cmgr);
+    return 0;
+}
+
+/*
+ * In NUMA mode, chunks allocated by a thread on one cpu (and hence
+ * node) and freed by a thread on the last cpu must go straight back
+ * into their own groups, not into a magazine of the freeing thread.
+ */
+static void
+run_on_cpu (int cpu)
+{
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    (void) sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+static void *
+thread_remote_alloc (void *arg)
+{
+    int i;
+
+    run_on_cpu(0);
+    for (i = 0; i < REMOTE_CHUNKS; i++) {
+        chunks[i] = chunk_alloc(&shared_cmgr);
+        if (NULL == chunks[i]) break;
+        fill_chunk(chunks[i], i);
+    }
+    return NULL;
+}
+
+static void *
+thread_remote_free (void *arg)
+{
+    int i;
+
+    run_on_cpu(pointer2integer(arg));
+    for (i = 0; (i < REMOTE_CHUNKS) && chunks[i]; i++) {
+        if (validate_chunk(chunks[i], i)) thread_errors++;
+        chunk_free(chunks[i]);
+    }
+    return NULL;
+}
+
+static int
+numa_remote_free_test (void)
+{
+    pthread_t thread;
+    int groups, trimmed, errors = 0;
+    int last_cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+    if (chunk_manager_init_numa(&shared_cmgr, true,
+            CHUNK_SIZE, 1024, NULL)) {
+                printf("chunk_manager_init_numa failed\n");
+                return -1;
+    }
+    memset(chunks, 0, REMOTE_CHUNKS * sizeof(unsigned char*));
+    thread_errors = 0;
+    pthread_create(&thread, NULL, thread_remote_alloc, NULL);
+    pthread_join(thread, NULL);
+    if (NULL == chunks[REMOTE_CHUNKS - 1]) errors++;
+    pthread_create(&thread, NULL, thread_remote_free,
+        integer2pointer(last_cpu > 0 ? last_cpu : 0));
+    pthread_join(thread, NULL);
+
+    /* no chunk may be held back, so every group must be free again */
+    groups = shared_cmgr.n_groups;
+    if (shared_cmgr.magazines ||
+        (shared_cmgr.n_empty_groups != groups)) {
+            errors++;
+    }
+    trimmed = chunk_manager_trim(&shared_cmgr);
+    if ((trimmed != groups) || shared_cmgr.n_groups) errors++;
+    errors += thread_errors;
+    printf("numa remote free of %d chunks (cpu 0 -> cpu %d): %d errors\n",
+        REMOTE_CHUNKS, last_cpu, errors);
+    chunk_manager_destroy(&shared_cmgr);
+    return errors;
+}
+
+/*
+ * Two managers share a monitor with a budget whose reclaim function
+ * trims both of them.  It is called while a manager is adding a group,
+ * so it must only run once the manager lock has been released.
+ */
+static chunk_manager_t reclaim_cmgrs [2];
+
+static void
+trim_managers (void *arg, mem_monitor_t *mmp, long long bytes_needed)
+{
+    chunk_manager_trim(&reclaim_cmgrs[0]);
+    chunk_manager_trim(&reclaim_cmgrs[1]);
+}
+
+static int
+reclaim_trim_test (void)
+{
+    mem_monitor_t budgeted;
+    void *chunk;
+    int i, n, groups, group_size, errors = 0;
+
+    mem_monitor_init(&budgeted, NULL);
+    for (i = 0; i < 2; i++) {
+        if (chunk_manager_init(&reclaim_cmgrs[i], true,
+                CHUNK_SIZE, 1024, &budgeted)) {
+                    printf("chunk_manager_init failed for the reclaim test\n");
+                    return -1;
+        }
+    }
+    group_size = reclaim_cmgrs[0].pages_per_group * CHUNK_PAGE_SIZE;
+    mem_monitor_set_budget(&budgeted,
+        mem_monitor_bytes_used(&budgeted) + 4 * group_size + 4096,
+        trim_managers, NULL);
+
+    /* fill up the budget with the first manager, then free it all */
+    for (n = 0; n < MAX_CHUNKS; n++) {
+        chunks[n] = chunk_alloc(&reclaim_cmgrs[0]);
+        if (NULL == chunks[n]) break;
+    }
+    groups = reclaim_cmgrs[0].n_groups;
+    if ((n == MAX_CHUNKS) || (groups < 3)) errors++;
+    for (i = 0; i < n; i++) chunk_free(chunks[i]);
+
+    /* the second manager only gets a group once the first is trimmed */
+    chunk = chunk_alloc(&reclaim_cmgrs[1]);
+    if ((NULL == chunk) || reclaim_cmgrs[0].n_groups) errors++;
+    if (chunk) chunk_free(chunk);
+
+    printf("reclaim by trimming %d groups: %d errors\n", groups, errors);
+    chunk_manager_destroy(&reclaim_cmgrs[0]);
+    chunk_manager_destroy(&reclaim_cmgrs[1]);
+    return errors;
+}
+
+/*
+ * completely free groups must be released a few at a time by the
+ * budget trim and right away once there are too many of them.
+ */
+static int
+incremental_trim_test (void)
+{
+    chunk_manager_t icmgr;
+    int i, groups, trimmed, errors = 0;
+
+    if (chunk_manager_init(&icmgr, false, CHUNK_SIZE, 1024, NULL)) {
+        printf("chunk_manager_init failed for the trim test\n");
+        return -1;
+    }
+    for (i = 0; i < TRIM_CHUNKS; i++) chunks[i] = chunk_alloc(&icmgr);
+    groups = icmgr.n_groups;
+    for (i = 0; i < TRIM_CHUNKS; i++) chunk_free(chunks[i]);
+    if (icmgr.n_empty_groups != groups) errors++;
+
+    trimmed = chunk_manager_trim_budget(&icmgr, 1);
+    if ((trimmed != 1) || (icmgr.n_groups != groups - 1)) errors++;
+
+    chunk_manager_set_max_empty_groups(&icmgr, 2);
+    if (icmgr.n_groups != 2) errors++;
+    for (i = 0; i < TRIM_CHUNKS; i++) chunks[i] = chunk_alloc(&icmgr);
+    for (i = 0; i < TRIM_CHUNKS; i++) chunk_free(chunks[i]);
+    if (icmgr.n_groups != 2) errors++;
+
+    trimmed = chunk_manager_trim(&icmgr);
+    if ((trimmed != 2) || icmgr.n_groups ||
+        chunk_manager_node_mem_monitor(&icmgr, 0) ||
+        mem_monitor_bytes_used(icmgr.mem_mon_p)) {
+            errors++;
+    }
+    printf("incremental trim of %d groups: %d errors\n", groups, errors);
+    chunk_manager_destroy(&icmgr);
+    return errors;
+}
+
 int main (int argc, char *argv[])
 {
     int i, j;
@@ -84,6 +403,13 @@ int main (int argc, char *argv[])
     timer_report(&tp, iter, NULL);
     chunk_manager_trim(&cmgr);
     chunk_manager_destroy(&cmgr);
-    return 0;
+
+    if (incremental_trim_test()) return -1;
+    if (reclaim_trim_test()) return -1;
+    if (thread_safe_integrity_test(MAGAZINES)) return -1;
+    if (thread_safe_integrity_test(LOCK_FREE)) return -1;
+    if (thread_safe_integrity_test(NUMA)) return -1;
+    return
+        numa_remote_free_test();
 } 
 
@@ -17,6 +17,62 @@ timer_obj_t tp;
     #define freeup(ptr)         chunk_free(ptr)
 #endif /* USE_MALLOC */
 
+#ifndef USE_MALLOC
+
+/*
+ * compares normal & huge page backed groups with lots of chunks
+ * touched in random order, which is where the TLB misses show up.
+ */
+#define BENCH_CHUNKS            (2 * 1024 * 1024)
+#define BENCH_TOUCHES           (16 * 1024 * 1024)
+
+static unsigned char *bench_chunks [BENCH_CHUNKS];
+
+static void
+tlb_benchmark (char *name, int options)
+{
+    chunk_manager_t bcmgr;
+    unsigned int r = 1;
+    int i;
+
+    if (chunk_manager_init_options(&bcmgr, false, options,
+            64, MAX_CHUNKS_PER_GROUP, NULL)) {
+        printf("chunk_manager_init_options failed for %s\n", name);
+        return;
+    }
+
+    /* this includes faulting in all the pages */
+    printf("%s, first allocation: ", name);
+    timer_start(&tp);
+    for (i = 0; i < BENCH_CHUNKS; i++) {
+        bench_chunks[i] = chunk_alloc(&bcmgr);
+    }
+    timer_end(&tp);
+    timer_report(&tp, BENCH_CHUNKS, NULL);
+
+    printf("%s, random chunk access: ", name);
+    timer_start(&tp);
+    for (i = 0; i < BENCH_TOUCHES; i++) {
+        r = (r * 1103515245) + 12345;
+        bench_chunks[(r >> 4) % BENCH_CHUNKS][0]++;
+    }
+    timer_end(&tp);
+    timer_report(&tp, BENCH_TOUCHES, NULL);
+
+    printf("%s, free & re allocate: ", name);
+    timer_start(&tp);
+    for (i = 0; i < BENCH_CHUNKS; i++) chunk_free(bench_chunks[i]);
+    for (i = 0; i < BENCH_CHUNKS; i++) {
+        bench_chunks[i] = chunk_alloc(&bcmgr);
+    }
+    timer_end(&tp);
+    timer_report(&tp, 2 * BENCH_CHUNKS, NULL);
+
+    chunk_manager_destroy(&bcmgr);
+}
+
+#endif /* USE_MALLOC */
+
 int main (int argc, char *argv[])
 {
     int i, j;
@@ -79,6 +135,9 @@ int main (int argc, char *argv[])
     printf("3: trimmed %d groups\n", trim);
     trim = chunk_manager_trim(&cmgr);
     printf("4: trimmed %d groups\n", trim);
+
+    tlb_benchmark("normal pages", 0);
+    tlb_benchmark("huge pages", CHUNK_MANAGER_HUGE_PAGES);
 #endif
     return 0;
 } 
@@ -0,0 +1,113 @@
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "epoch_manager.h"
+
+#define READERS         4
+#define REPLACEMENTS    200000
+#define NODE_MAGIC      0x5A5A5A5A
+
+typedef struct node_s {
+    int magic;
+    int value;
+} node_t;
+
+static epoch_manager_t epoch_manager;
+static epoch_manager_t *emp = &epoch_manager;
+static node_t * volatile shared_node;
+static volatile int done = 0;
+static volatile long long bad_reads = 0;
+
+static node_t *
+new_node (int value)
+{
+    node_t *node = MEM_MONITOR_ALLOC(emp, sizeof(node_t));
+
+    if (node) {
+        node->magic = NODE_MAGIC;
+        node->value = value;
+    }
+    return node;
+}
+
+static void *
+reader (void *arg)
+{
+    epoch_thread_t *etp;
+    node_t *node;
+    long long reads = 0;
+
+    if (epoch_thread_register(&epoch_manager, &etp)) {
+        fprintf(stderr, "reader could not register\n");
+        return NULL;
+    }
+    while (!done) {
+        epoch_enter(etp);
+        node = shared_node;
+        if ((node->magic != NODE_MAGIC) || (node->value < 0)) {
+            __sync_fetch_and_add(&bad_reads, 1);
+        }
+        epoch_exit(etp);
+        reads++;
+    }
+    epoch_thread_unregister(etp);
+    fprintf(stderr, "reader done after %lld reads\n", reads);
+    return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+    pthread_t readers [READERS];
+    epoch_thread_t *etp;
+    mem_monitor_shard_t totals;
+    node_t *old, *node;
+    unsigned long long baseline;
+    int i;
+
+    if (epoch_manager_init(&epoch_manager, READERS + 1, NULL)) {
+        fprintf(stderr, "epoch_manager_init failed\n");
+        return -1;
+    }
+    baseline = mem_monitor_bytes_used(&epoch_manager.mem_mon);
+    shared_node = new_node(0);
+    for (i = 0; i < READERS; i++) {
+        pthread_create(&readers[i], NULL, reader, NULL);
+    }
+
+    if (epoch_thread_register(&epoch_manager, &etp)) {
+        fprintf(stderr, "writer could not register\n");
+        return -1;
+    }
+    fprintf(stderr, "replacing the shared node %d times\n", REPLACEMENTS);
+    for (i = 1; i <= REPLACEMENTS; i++) {
+        node = new_node(i);
+        assert(node);
+        old = shared_node;
+        __sync_synchronize();
+        shared_node = node;
+        if (epoch_retire(etp, old)) {
+            fprintf(stderr, "epoch_retire failed\n");
+            return -1;
+        }
+    }
+    done = 1;
+    for (i = 0; i < READERS; i++) pthread_join(readers[i], NULL);
+    epoch_thread_unregister(etp);
+
+    fprintf(stderr, "global epoch advanced to %llu\n",
+        epoch_manager.global_epoch);
+    fprintf(stderr, "bad reads %lld\n", bad_reads);
+    assert(bad_reads == 0);
+
+    /* everything retired must have been freed by now */
+    mem_monitor_totals(&epoch_manager.mem_mon, &totals);
+    assert(totals.deferred_bytes == 0);
+    assert(totals.deferred_blocks == 0);
+    MEM_MONITOR_FREE(shared_node);
+    assert(mem_monitor_bytes_used(&epoch_manager.mem_mon) == baseline);
+
+    epoch_manager_destroy(&epoch_manager);
+    return 0;
+}
+
@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <pthread.h>
 
 #include "timer_object.h"
 #include "index_object.h"
@@ -32,6 +33,118 @@ int compareData (void *p1, void *p2)
     return d1->second - d2->second;
 }
 
+/*
+ * Optimistic (lockless) searches running while writers insert, remove,
+ * grow & trim the index.  The even keys are always in the index, the
+ * odd ones come & go.  The odd ones are malloced every time they are
+ * inserted and are freed thru 'index_obj_remove_retire', so a search
+ * comparing against one which was freed too early trips the address
+ * sanitizer.
+ */
+#define OPT_KEYS                4096
+#define OPT_READERS             4
+#define OPT_ROUNDS              200
+
+Data opt_data [OPT_KEYS];
+index_obj_t opt_index;
+volatile int opt_done;
+int opt_errors;
+int opt_freed;
+
+static void
+opt_data_free (void *user_data, void *extra_arg)
+{
+    __sync_fetch_and_add((int*) extra_arg, 1);
+    free(user_data);
+}
+
+static void *
+optimistic_reader (void *arg)
+{
+    unsigned int seed = pointer2integer(arg);
+    Data key;
+    void *found;
+    int k;
+
+    while (!opt_done) {
+        k = rand_r(&seed) % OPT_KEYS;
+        key.first = key.second = k;
+        if (index_obj_search(&opt_index, &key, &found) == 0) {
+            if ((0 == (k & 1)) && (found != &opt_data[k])) {
+                __sync_fetch_and_add(&opt_errors, 1);
+            }
+        } else if (0 == (k & 1)) {
+            __sync_fetch_and_add(&opt_errors, 1);
+        }
+    }
+    return NULL;
+}
+
+static int
+optimistic_test (void)
+{
+    pthread_t readers [OPT_READERS];
+    mem_monitor_t mon;
+    mem_monitor_shard_t totals;
+    Data *dp;
+    void *found;
+    int i, r, round;
+
+    mem_monitor_init(&mon, NULL);
+    if (index_obj_init(&opt_index, LOCK_TYPE_SEQLOCK, false, compareData,
+            16, 16, &mon)) {
+        printf("could not create optimistic index\n");
+        return 1;
+    }
+    for (i = 0; i < OPT_KEYS; i++) {
+        opt_data[i].first = opt_data[i].second = i;
+        if ((0 == (i & 1)) &&
+            index_obj_insert(&opt_index, &opt_data[i], &found, false)) {
+                opt_errors++;
+        }
+    }
+    index_obj_trim(&opt_index);
+    for (r = 0; r < OPT_READERS; r++) {
+        pthread_create(&readers[r], NULL, optimistic_reader,
+            integer2pointer(r + 1));
+    }
+    for (round = 0; round < OPT_ROUNDS; round++) {
+        for (i = 1; i < OPT_KEYS; i += 2) {
+            dp = malloc(sizeof(Data));
+            dp->first = dp->second = i;
+            if (index_obj_insert(&opt_index, dp, &found, false)) {
+                opt_errors++;
+            }
+        }
+        for (i = 1; i < OPT_KEYS; i += 2) {
+            if (index_obj_remove_retire(&opt_index, &opt_data[i],
+                    opt_data_free, &opt_freed)) {
+                opt_errors++;
+            }
+        }
+        if (index_obj_trim(&opt_index)) opt_errors++;
+    }
+    opt_done = 1;
+    for (r = 0; r < OPT_READERS; r++) pthread_join(readers[r], NULL);
+
+    /* every retired array must have been freed by now */
+    index_obj_destroy(&opt_index, NULL, NULL);
+    if (opt_freed != (OPT_ROUNDS * (OPT_KEYS / 2))) {
+        printf("%d of %d removed data freed\n",
+            opt_freed, OPT_ROUNDS * (OPT_KEYS / 2));
+        opt_errors++;
+    }
+    mem_monitor_totals(&mon, &totals);
+    if (totals.bytes_used || totals.deferred_blocks ||
+        (totals.allocations != totals.frees)) {
+            printf("%llu bytes in %llu retired blocks left\n",
+                totals.bytes_used, totals.deferred_blocks);
+            opt_errors++;
+    }
+    printf("optimistic search test: %d errors\n", opt_errors);
+    return opt_errors;
+}
+
 int main (int argc, char *argv[])
 {
     register int i;
@@ -43,6 +156,8 @@ int main (int argc, char *argv[])
     int iter;
     long long int count;
 
+    if (optimistic_test()) return -1;
+
     /* create the index first */
     if (index_obj_init(&index, 
             true, false, compareData, MAX_SZ/4, 1000, NULL) != 0) {
@@ -142,6 +257,7 @@ printf ("WORST CASE INSERT/DELETE for %d entries\n", MAX_SZ);
     }
     timer_end(&timr);
     timer_report(&timr, ITER * 2 * 200, NULL);
+    index_obj_destroy(&index, NULL, NULL);
 
     printf ("\n\n\n");
     return 0;
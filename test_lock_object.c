@@ -19,6 +19,137 @@ pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 char thread_complete_array [MAX_THREADS] = { 0 };
 int max_threads = 0;
 
+/*
+ * Correctness test of one specific lock type.  Every thread does
+ * 'iterations' critical sections, 'read_percent' of them under the
+ * read lock and the rest under the write lock.  A writer checks that
+ * nobody else is inside with it and increments the shared counter
+ * non atomically, taking 'write_spin' loops to do so.  A reader checks
+ * that no writer is inside with it.  At the end, the counter must be
+ * exactly the number of write sections done by all the threads.
+ */
+typedef struct type_test_arg_s {
+    int read_percent;
+    int iterations;
+    int write_spin;
+    unsigned int seed;
+    long long int writes;
+} type_test_arg_t;
+
+static lock_obj_t type_lock;
+static volatile int writers_inside = 0;
+static volatile int readers_inside = 0;
+static volatile int type_test_errors = 0;
+static volatile long long int type_test_counter = 0;
+
+static void
+spin_a_while (int loops)
+{
+    volatile int i;
+
+    for (i = 0; i < loops; i++);
+}
+
+static void
+type_test_write (type_test_arg_t *tap)
+{
+    long long int value;
+
+    grab_write_lock(&type_lock);
+    if ((__sync_add_and_fetch(&writers_inside, 1) != 1) || readers_inside) {
+        __sync_fetch_and_add(&type_test_errors, 1);
+    }
+    value = type_test_counter;
+    spin_a_while(tap->write_spin);
+    type_test_counter = value + 1;
+    if ((writers_inside != 1) || readers_inside) {
+        __sync_fetch_and_add(&type_test_errors, 1);
+    }
+    __sync_sub_and_fetch(&writers_inside, 1);
+    release_write_lock(&type_lock);
+    tap->writes++;
+}
+
+static void
+type_test_read (type_test_arg_t *tap)
+{
+    long long int value;
+
+    grab_read_lock(&type_lock);
+    __sync_add_and_fetch(&readers_inside, 1);
+    value = type_test_counter;
+    spin_a_while(tap->write_spin / 4);
+    if (writers_inside || (value != type_test_counter)) {
+        __sync_fetch_and_add(&type_test_errors, 1);
+    }
+    __sync_sub_and_fetch(&readers_inside, 1);
+    release_read_lock(&type_lock);
+}
+
+static void *
+type_test_thread (void *arg)
+{
+    type_test_arg_t *tap = (type_test_arg_t*) arg;
+    int i;
+
+    for (i = 0; i < tap->iterations; i++) {
+        if ((int) (rand_r(&tap->seed) % 100) < tap->read_percent) {
+            type_test_read(tap);
+        } else {
+            type_test_write(tap);
+        }
+    }
+    return NULL;
+}
+
+static int
+lock_type_test (char *name, int type, int thread_count,
+    int read_percent, int iterations, int write_spin)
+{
+    pthread_t *tids;
+    type_test_arg_t *args;
+    long long int writes = 0;
+    int i, created;
+
+    if (lock_obj_init_type(&type_lock, type)) {
+        printf("lock_obj_init_type failed for %s\n", name);
+        return -1;
+    }
+    tids = malloc(thread_count * sizeof(pthread_t));
+    args = calloc(thread_count, sizeof(type_test_arg_t));
+    if ((NULL == tids) || (NULL == args)) {
+        printf("malloc FAILED\n");
+        return -1;
+    }
+    writers_inside = readers_inside = type_test_errors = 0;
+    type_test_counter = 0;
+    for (created = 0; created < thread_count; created++) {
+        args[created].read_percent = read_percent;
+        args[created].iterations = iterations;
+        args[created].write_spin = write_spin;
+        args[created].seed = created + 1;
+        if (pthread_create(&tids[created], NULL,
+                type_test_thread, &args[created])) break;
+    }
+    for (i = 0; i < created; i++) {
+        pthread_join(tids[i], NULL);
+        writes += args[i].writes;
+    }
+    lock_obj_destroy(&type_lock);
+    free(tids);
+    free(args);
+
+    printf("%s lock, %d threads, %d%% reads: %lld writes, "
+        "counter %lld, %d errors\n", name, created, read_percent,
+        writes, type_test_counter, type_test_errors);
+    if ((created != thread_count) || type_test_errors ||
+        (type_test_counter != writes)) {
+            printf("%s lock test FAILED\n", name);
+            return -1;
+    }
+    return 0;
+}
+
 void *thread_function (void *arg)
 {
     int tid = *((int*) arg);
@@ -93,13 +224,36 @@ int main (int argc, char *argv[])
 {
     int failed;
     pthread_t tid;
-    int i;
+    int i, oversubscribed;
     int *intp;
     timer_obj_t timr;
 
     printf("\nsize of mutex object is %ld lock object is %ld bytes\n",
         sizeof(pthread_mutex_t), sizeof(lock_obj_t));
 
+    /* mutual exclusion & reader/writer tests of the specific lock types */
+    if (lock_type_test("phase fair", LOCK_TYPE_PHASE_FAIR,
+            16, 0, 20000, 50)) return -1;
+    if (lock_type_test("phase fair", LOCK_TYPE_PHASE_FAIR,
+            16, 90, 20000, 50)) return -1;
+
+    /*
+     * many more threads than cpus & long write sections, so the
+     * waiters run out of spins and have to park in the kernel
+     */
+    oversubscribed = 4 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (oversubscribed < 16) oversubscribed = 16;
+    if (lock_type_test("futex", LOCK_TYPE_FUTEX,
+            oversubscribed, 0, 50, 100000)) return -1;
+    if (lock_type_test("futex", LOCK_TYPE_FUTEX,
+            oversubscribed, 50, 50, 100000)) return -1;
+
+    /* more threads than reader slots, so some of them share a slot */
+    if (lock_type_test("big reader", LOCK_TYPE_BIG_READER,
+            2 * MAX_THREAD_SLOTS, 90, 2000, 50)) return -1;
+    if (lock_type_test("sequence", LOCK_TYPE_SEQLOCK,
+            2 * MAX_THREAD_SLOTS, 90, 2000, 50)) return -1;
+
     failed = lock_obj_init(&lock);
     if (failed) {
         printf("lock_obj_init failed: <%s>\n", strerror(failed));
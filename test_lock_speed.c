@@ -9,6 +9,10 @@
 #define MAX_THREADS         (16 * 1024)
 #define MAX_ITERATION       10000
 
+/* read/write ratio sweep parameters */
+#define SWEEP_MAX_THREADS   (2 * MAX_THREAD_SLOTS)
+#define SWEEP_ITERATION     100000
+
 lock_obj_t lock;
 lock_obj_t protect_globals;
 char thread_complete_array [MAX_THREADS] = { 0 };
@@ -48,6 +52,113 @@ void *contention_thread (void *arg)
     return NULL;
 }
 
+/*
+ * Read/write ratio sweep.  Every thread does SWEEP_ITERATION lock/unlock
+ * pairs on the same lock, 'read_percent' of them are read locks and the
+ * rest are write locks.  A tiny bit of work is done while holding the
+ * lock so the critical section is not completely empty.
+ */
+typedef struct sweep_arg_s {
+    lock_obj_t *lck;
+    int read_percent;
+    unsigned int seed;
+    long long int writes;
+} sweep_arg_t;
+
+volatile int sweep_start = 0;
+volatile long long int sweep_shared_counter = 0;
+int sweep_failures = 0;
+
+void *sweep_thread (void *arg)
+{
+    sweep_arg_t *sap = (sweep_arg_t*) arg;
+    long long int value;
+    int i;
+
+    while (sweep_start == 0);
+    for (i = 0; i < SWEEP_ITERATION; i++) {
+        if ((int) (rand_r(&sap->seed) % 100) < sap->read_percent) {
+            grab_read_lock(sap->lck);
+            value = sweep_shared_counter;
+            SUPPRESS_UNUSED_VARIABLE_COMPILER_WARNING(value);
+            release_read_lock(sap->lck);
+        } else {
+            grab_write_lock(sap->lck);
+            sweep_shared_counter++;
+            release_write_lock(sap->lck);
+            sap->writes++;
+        }
+    }
+    return NULL;
+}
+
+static double
+sweep_one (int lock_type, int thread_count, int read_percent)
+{
+    lock_obj_t lck;
+    pthread_t tids [SWEEP_MAX_THREADS];
+    sweep_arg_t args [SWEEP_MAX_THREADS];
+    timer_obj_t tmr;
+    long long int writes = 0;
+    int i, created;
+
+    lock_obj_init_type(&lck, lock_type);
+    sweep_start = 0;
+    sweep_shared_counter = 0;
+    for (created = 0; created < thread_count; created++) {
+        args[created].lck = &lck;
+        args[created].read_percent = read_percent;
+        args[created].seed = created + 1;
+        args[created].writes = 0;
+        if (pthread_create(&tids[created], NULL,
+                sweep_thread, &args[created])) break;
+    }
+    timer_start(&tmr);
+    sweep_start = 1;
+    for (i = 0; i < created; i++) pthread_join(tids[i], NULL);
+    timer_end(&tmr);
+    lock_obj_destroy(&lck);
+
+    /* every write section must have been mutually exclusive */
+    for (i = 0; i < created; i++) writes += args[i].writes;
+    if (sweep_shared_counter != writes) {
+        printf("lock type %d, %d threads, %d%% reads: counter is %lld "
+            "after %lld write sections\n", lock_type, created,
+            read_percent, sweep_shared_counter, writes);
+        sweep_failures++;
+    }
+
+    /* average nano seconds per lock/unlock pair */
+    return
+        (double) timer_delay_nsecs(&tmr) /
+        (double) ((long long int) SWEEP_ITERATION * created);
+}
+
+static void
+read_write_ratio_sweep (void)
+{
+    static int threads [] = { 1, 2, 4, 8, 16, 32, 64, SWEEP_MAX_THREADS };
+    static int read_percents [] = { 0, 50, 90, 99, 100 };
+    int t, r;
+
+    printf("\nread/write ratio sweep, nano seconds per lock/unlock pair\n");
+    printf("%8s %6s %14s %14s %14s %14s %14s\n",
+        "threads", "read%", "spin_yield", "phase_fair", "futex",
+        "big_reader", "seqlock");
+    for (t = 0; t < (int) (sizeof(threads) / sizeof(int)); t++) {
+        for (r = 0; r < (int) (sizeof(read_percents) / sizeof(int)); r++) {
+            printf("%8d %6d %14.2lf %14.2lf %14.2lf %14.2lf %14.2lf\n",
+                threads[t], read_percents[r],
+                sweep_one(LOCK_TYPE_SPIN_YIELD, threads[t], read_percents[r]),
+                sweep_one(LOCK_TYPE_PHASE_FAIR, threads[t], read_percents[r]),
+                sweep_one(LOCK_TYPE_FUTEX, threads[t], read_percents[r]),
+                sweep_one(LOCK_TYPE_BIG_READER, threads[t], read_percents[r]),
+                sweep_one(LOCK_TYPE_SEQLOCK, threads[t], read_percents[r]));
+            fflush(stdout);
+        }
+    }
+}
+
 int main (int argc, char *argv[])
 {
     int failed;
@@ -87,6 +198,12 @@ not_all_threads_complete:
     /* everything should be updated now */
     printf("%lld nano seconds used in %lld iterations, average is %lld\n",
         total_time, total_iterations, (total_time/total_iterations));
+
+    read_write_ratio_sweep();
+    if (sweep_failures) {
+        printf("%d read/write ratio sweeps FAILED\n", sweep_failures);
+        return -1;
+    }
     return 0;
 }
 
@@ -0,0 +1,207 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "mem_monitor_object.h"
+
+#define THREADS                 16
+#define BLOCKS                  64
+#define LOOP                    20000
+
+/*
+ * many threads (more than there are shards) share one monitor,
+ * freeing each others blocks.  The totals must come out exact.
+ */
+static mem_monitor_t shared_mem_mon;
+static void * volatile handoff [THREADS][BLOCKS];
+
+static void *
+thread_alloc_free (void *arg)
+{
+    int t = pointer2integer(arg);
+    int other = (t + 1) % THREADS;
+    void *block;
+    int i, b;
+
+    for (i = 0; i < LOOP; i++) {
+        b = i % BLOCKS;
+        block = mem_monitor_allocate(&shared_mem_mon, 1 + (i % 100), false);
+        block = __sync_lock_test_and_set(&handoff[t][b], block);
+        if (block) mem_monitor_free(block);
+        block = __sync_lock_test_and_set(&handoff[other][b], NULL);
+        if (block) mem_monitor_free(block);
+    }
+    return NULL;
+}
+
+/*
+ * process -> subsystem -> object, where the object & the subsystem
+ * have budgets and the subsystem has a cache it can give up when
+ * it is asked to reclaim memory.
+ */
+#define CACHE_SIZE              32
+
+static void *cache [CACHE_SIZE];
+static int cached = 0;
+
+static void
+reclaim_cache (void *arg, mem_monitor_t *mmp, long long bytes_needed)
+{
+    while (cached > CACHE_SIZE / 2) mem_monitor_free(cache[--cached]);
+}
+
+static int
+budget_test (void)
+{
+    mem_monitor_t process, subsystem, object;
+    void *blocks [100], *block;
+    int n, errors = 0;
+
+    mem_monitor_init(&process, NULL);
+    mem_monitor_init(&subsystem, &process);
+    mem_monitor_init(&object, &subsystem);
+    mem_monitor_set_budget(&subsystem, 100 * 100, NULL, NULL);
+    mem_monitor_set_budget(&object, 40 * 100, NULL, NULL);
+
+    /* the object fails fast at its own budget */
+    for (n = 0; n < 100; n++) {
+        blocks[n] = mem_monitor_allocate(&object,
+                        100 - sizeof(void*) - 8, false);
+        if (NULL == blocks[n]) break;
+    }
+    if ((n != 40) || (object.budget_failures != 1) ||
+        (object.charged != 40 * 100) || (subsystem.charged != 40 * 100) ||
+        (mem_monitor_bytes_used(&process) != 40 * 100)) {
+            errors++;
+    }
+
+    /* the subsystem has the rest, for its cache */
+    while (cached < CACHE_SIZE) {
+        block = mem_monitor_allocate(&subsystem, 100 - sizeof(void*) - 8,
+                    false);
+        if (NULL == block) break;
+        cache[cached++] = block;
+    }
+    if ((cached != CACHE_SIZE) ||
+        mem_monitor_allocate(&subsystem, 30 * 100, false)) {
+            errors++;
+    }
+
+    /* which it gives up once it can reclaim */
+    mem_monitor_set_budget(&subsystem, 100 * 100, reclaim_cache, NULL);
+    block = mem_monitor_allocate(&subsystem, 30 * 100, false);
+    if ((NULL == block) || (cached != CACHE_SIZE / 2)) errors++;
+    if (mem_monitor_allocate(&subsystem, 100 * 100, false)) errors++;
+
+    /* growing by realloc is charged too */
+    if (mem_monitor_reallocate(&subsystem, block, 100 * 100, false)) {
+        errors++;
+    }
+    mem_monitor_free(block);
+
+    while (n > 0) mem_monitor_free(blocks[--n]);
+    while (cached > 0) mem_monitor_free(cache[--cached]);
+    if (subsystem.charged || object.charged ||
+        mem_monitor_bytes_used(&process)) {
+            errors++;
+    }
+
+    printf("budget test: %d errors\n", errors);
+    return errors;
+}
+
+/*
+ * the live bytes the profiler estimates must be close to reality, as
+ * blocks are allocated & freed
+ */
+#define PROFILE_PERIOD          4096
+#define PROFILE_BLOCKS          1000
+#define PROFILE_SIZE            1000
+
+static void *profiled [PROFILE_BLOCKS];
+
+static long long
+profiled_bytes (int *sites)
+{
+    FILE *fp = tmpfile();
+    char line [4096], *bytes;
+    long long total = 0;
+
+    *sites = mem_monitor_profile_dump(fp);
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        bytes = strrchr(line, ' ');
+        if (bytes) total += atoll(bytes + 1);
+    }
+    fclose(fp);
+    return total;
+}
+
+static int
+profile_test (void)
+{
+    long long expected, estimated;
+    int i, sites, errors = 0;
+
+    if (mem_monitor_profile_start(PROFILE_PERIOD)) return 1;
+    for (i = 0; i < PROFILE_BLOCKS; i++) {
+        profiled[i] = mem_monitor_allocate(NULL, PROFILE_SIZE, false);
+    }
+    mem_monitor_profile_stop();
+    if (mem_monitor_profile_start(PROFILE_PERIOD * 2) != EBUSY) errors++;
+
+    /* every block has a header too */
+    expected = (long long) PROFILE_BLOCKS * (PROFILE_SIZE + 16);
+    estimated = profiled_bytes(&sites);
+    if ((sites < 1) || (llabs(estimated - expected) > 2 * PROFILE_PERIOD)) {
+        errors++;
+    }
+    printf("profiled %lld bytes in %d sites, expected %lld\n",
+        estimated, sites, expected);
+
+    for (i = 0; i < PROFILE_BLOCKS / 2; i++) mem_monitor_free(profiled[i]);
+    estimated = profiled_bytes(&sites);
+    if (llabs(estimated - expected / 2) > 2 * PROFILE_PERIOD) errors++;
+
+    for (; i < PROFILE_BLOCKS; i++) mem_monitor_free(profiled[i]);
+    if (profiled_bytes(&sites) || sites) errors++;
+    if (mem_monitor_profile_start(PROFILE_PERIOD * 2)) errors++;
+    mem_monitor_profile_stop();
+
+    printf("profile test: %d errors\n", errors);
+    return errors;
+}
+
+int main (int argc, char *argv[])
+{
+    pthread_t threads [THREADS];
+    mem_monitor_shard_t totals;
+    int t, b;
+
+    if (budget_test()) return -1;
+    if (profile_test()) return -1;
+
+    for (t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, thread_alloc_free,
+            integer2pointer(t));
+    }
+    for (t = 0; t < THREADS; t++) pthread_join(threads[t], NULL);
+    for (t = 0; t < THREADS; t++) {
+        for (b = 0; b < BLOCKS; b++) {
+            if (handoff[t][b]) mem_monitor_free(handoff[t][b]);
+        }
+    }
+
+    mem_monitor_totals(&shared_mem_mon, &totals);
+    printf("%llu allocations, %llu frees, %llu bytes left\n",
+        totals.allocations, totals.frees, totals.bytes_used);
+    if ((totals.allocations != (unsigned long long) THREADS * LOOP) ||
+        (totals.frees != totals.allocations) ||
+        totals.bytes_used ||
+        mem_monitor_bytes_used(&shared_mem_mon)) {
+            printf("mem monitor totals are wrong\n");
+            return -1;
+    }
+    return 0;
+}
+
@@ -0,0 +1,219 @@
+
+#include <stdio.h>
+#include "slab_allocator.h"
+#include "avl_tree_object.h"
+
+#define BLOCKS          (256 * 1024)
+#define LOOP            20
+#define TREE_NODES      (128 * 1024)
+
+byte *blocks [BLOCKS];
+int sizes [BLOCKS];
+slab_allocator_t slab;
+timer_obj_t tp;
+
+static int
+int_compare (void *v1, void *v2)
+{
+    return
+        pointer2integer(v1) - pointer2integer(v2);
+}
+
+static int
+slab_alloc_free_test (void)
+{
+    int i, j, b, errors = 0;
+    unsigned long long iter = 0;
+
+    timer_start(&tp);
+    for (j = 0; j < LOOP; j++) {
+        for (i = 0; i < BLOCKS; i++) {
+            sizes[i] = 1 + ((i * 7919 + j) % SLAB_MAX_SIZE);
+            blocks[i] = slab_alloc(&slab, sizes[i]);
+            if (NULL == blocks[i]) {
+                errors++;
+                continue;
+            }
+            memset(blocks[i], i & 0xFF, sizes[i]);
+            iter++;
+        }
+        for (i = 0; i < BLOCKS; i++) {
+            if (NULL == blocks[i]) continue;
+            for (b = 0; b < sizes[i]; b++) {
+                if (blocks[i][b] != (i & 0xFF)) {
+                    errors++;
+                    break;
+                }
+            }
+            slab_free(blocks[i]);
+            iter++;
+        }
+    }
+    timer_end(&tp);
+    timer_report(&tp, iter, NULL);
+
+    if (slab_alloc(&slab, SLAB_MAX_SIZE + 1)) {
+        fprintf(stderr, "slab_alloc served a size bigger than max\n");
+        errors++;
+    }
+    return errors;
+}
+
+/*
+ * all the nodes of the tree now come from the slab allocator
+ */
+static int
+mem_monitor_backend_test (void)
+{
+    avl_tree_t tree;
+    void *found, *big;
+    int i, errors = 0;
+
+    if (slab_allocator_use_for_mem_monitor(&slab)) {
+        fprintf(stderr, "slab_allocator_use_for_mem_monitor failed\n");
+        return 1;
+    }
+
+    if (avl_tree_init(&tree, false, false, int_compare, NULL)) {
+        fprintf(stderr, "avl_tree_init failed\n");
+        return 1;
+    }
+
+    /* the backend can not also serve a monitor with no headers */
+    if (slab_allocator_serve_mem_monitor(&slab, &tree.mem_mon) != EBUSY) {
+        errors++;
+    }
+    for (i = 1; i <= TREE_NODES; i++) {
+        if (avl_tree_insert(&tree, integer2pointer(i), &found, false)) {
+            errors++;
+        }
+    }
+    for (i = 1; i <= TREE_NODES; i++) {
+        if (avl_tree_search(&tree, integer2pointer(i), &found) ||
+            (found != integer2pointer(i))) {
+                errors++;
+        }
+    }
+
+    /* too big for the slab, must silently come from malloc */
+    big = MEM_MONITOR_ZALLOC((&tree), 4 * SLAB_MAX_SIZE);
+    if (NULL == big) errors++;
+    big = MEM_MONITOR_ZREALLOC((&tree), big, 8 * SLAB_MAX_SIZE);
+    if (NULL == big) errors++;
+    MEM_MONITOR_FREE(big);
+
+    for (i = 1; i <= TREE_NODES; i++) {
+        if (avl_tree_remove(&tree, integer2pointer(i), &found)) errors++;
+    }
+    if (mem_monitor_bytes_used(&tree.mem_mon) != 0) {
+        fprintf(stderr, "tree still has %llu bytes\n",
+            mem_monitor_bytes_used(&tree.mem_mon));
+        errors++;
+    }
+    avl_tree_destroy(&tree, NULL, NULL);
+
+    slab_allocator_use_for_mem_monitor(NULL);
+    return errors;
+}
+
+/*
+ * the tree nodes now come from a slab allocator of the tree's own
+ * monitor with no hidden headers
+ */
+static int
+headerless_test (void)
+{
+    slab_allocator_t tree_slab, other_slab;
+    mem_monitor_t process, subsystem, object;
+    avl_tree_t tree;
+    void *found, *big;
+    unsigned long long per_node;
+    int i, errors = 0;
+
+    if (avl_tree_init(&tree, false, false, int_compare, NULL) ||
+        slab_allocator_init(&tree_slab, false, NULL) ||
+        slab_allocator_serve_mem_monitor(&tree_slab, &tree.mem_mon)) {
+            fprintf(stderr, "headerless test init failed\n");
+            return 1;
+    }
+    for (i = 1; i <= TREE_NODES; i++) {
+        if (avl_tree_insert(&tree, integer2pointer(i), &found, false)) {
+            errors++;
+        }
+    }
+
+    /* a node takes no more than its size class, less than a header */
+    per_node = mem_monitor_bytes_used(&tree.mem_mon) / TREE_NODES;
+    if (per_node >= sizeof(avl_node_t) + sizeof(void*) + 8) errors++;
+    fprintf(stderr, "%llu bytes per %d byte tree node\n",
+        per_node, (int) sizeof(avl_node_t));
+
+    /* once registered, the slabs cannot change */
+    if (slab_allocator_serve_mem_monitor(&tree_slab, &tree.mem_mon)
+            != EBUSY) {
+        errors++;
+    }
+
+    /* the slabs may not be charged to the very monitor they serve */
+    mem_monitor_init(&process, NULL);
+    mem_monitor_init(&subsystem, &process);
+    if (slab_allocator_init(&other_slab, false, &subsystem)) errors++;
+    if ((slab_allocator_serve_mem_monitor(&other_slab, &subsystem)
+            != EINVAL) ||
+        (slab_allocator_serve_mem_monitor(&other_slab, &process)
+            != EINVAL) ||
+        (slab_allocator_serve_mem_monitor(&tree_slab, &tree_slab.mem_mon)
+            != EINVAL)) {
+                errors++;
+    }
+    mem_monitor_init(&object, &subsystem);
+    if (slab_allocator_serve_mem_monitor(&other_slab, &object) != EINVAL) {
+        errors++;
+    }
+    slab_allocator_destroy(&other_slab);
+
+    /* nor can a headerless slab allocator become the backend */
+    if (slab_allocator_use_for_mem_monitor(&tree_slab) != EBUSY) errors++;
+
+    /* mixed with blocks which do have headers */
+    big = MEM_MONITOR_ZALLOC((&tree), 4 * SLAB_MAX_SIZE);
+    big = MEM_MONITOR_ZREALLOC((&tree), big, 8 * SLAB_MAX_SIZE);
+    if (NULL == big) errors++;
+    MEM_MONITOR_FREE(big);
+    big = MEM_MONITOR_ZALLOC((&tree), 10);
+    big = MEM_MONITOR_ZREALLOC((&tree), big, 2 * SLAB_MAX_SIZE);
+    if ((NULL == big) || ((byte*) big)[2 * SLAB_MAX_SIZE - 1]) errors++;
+    MEM_MONITOR_FREE(big);
+
+    for (i = 1; i <= TREE_NODES; i++) {
+        if (avl_tree_remove(&tree, integer2pointer(i), &found)) errors++;
+    }
+    if (mem_monitor_bytes_used(&tree.mem_mon) != 0) {
+        fprintf(stderr, "tree still has %llu bytes\n",
+            mem_monitor_bytes_used(&tree.mem_mon));
+        errors++;
+    }
+    avl_tree_destroy(&tree, NULL, NULL);
+    slab_allocator_destroy(&tree_slab);
+
+    return errors;
+}
+
+int main (int argc, char *argv[])
+{
+    int errors;
+
+    if (slab_allocator_init(&slab, false, NULL)) {
+        fprintf(stderr, "slab_allocator_init failed\n");
+        return -1;
+    }
+    errors = slab_alloc_free_test();
+    errors += mem_monitor_backend_test();
+    errors += headerless_test();
+    fprintf(stderr, "%d groups trimmed\n", slab_allocator_trim(&slab));
+    slab_allocator_destroy(&slab);
+
+    fprintf(stderr, "%d errors\n", errors);
+    return errors ? -1 : 0;
+}
+
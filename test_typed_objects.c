@@ -0,0 +1,245 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timer_object.h"
+#include "index_object.h"
+#include "typed_objects.h"
+
+#define COUNT           (1024 * 1024)
+
+typedef struct key16_s {
+    char bytes [16];
+} key16_t;
+
+static inline int
+key16_compare (key16_t k1, key16_t k2)
+{
+    return memcmp(k1.bytes, k2.bytes, sizeof(k1.bytes));
+}
+
+DEFINE_TYPED_AVL_TREE(int_tree, int, int, TYPED_COMPARE_NUMBERS)
+DEFINE_TYPED_INDEX(int_index, int, int, TYPED_COMPARE_NUMBERS)
+DEFINE_TYPED_INDEX(key16_index, key16_t, int, key16_compare)
+
+int values [COUNT];
+int order [COUNT];
+timer_obj_t tmr;
+
+static int
+int_compare (void *v1, void *v2)
+{
+    return *((int*) v1) - *((int*) v2);
+}
+
+static void
+shuffle_some (int count)
+{
+    int i, j, t;
+
+    for (i = count - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+static void
+shuffle (void)
+{
+    shuffle_some(COUNT);
+}
+
+static int
+int_tree_test (void)
+{
+    int_tree_t tree;
+    int i, value = 0, errors = 0;
+
+    if (int_tree_init(&tree, false, NULL)) return 1;
+    shuffle();
+    for (i = 0; i < COUNT; i++) {
+        if (int_tree_insert(&tree, order[i], -order[i], NULL, false)) {
+            errors++;
+        }
+    }
+    if ((int_tree_insert(&tree, 5, 55, &value, true) != EEXIST) ||
+        (value != -5) || int_tree_search(&tree, 5, &value) || (value != 55)) {
+            errors++;
+    }
+    for (i = 0; i < COUNT; i += 2) {
+        if (int_tree_remove(&tree, i, &value) || (value != -i)) errors++;
+    }
+    for (i = 0; i < COUNT; i++) {
+        if (i & 1) {
+            if (int_tree_search(&tree, i, &value)) errors++;
+            if ((i != 5) && (value != -i)) errors++;
+        } else if (int_tree_search(&tree, i, NULL) != ENODATA) {
+            errors++;
+        }
+    }
+    for (i = 1; i < COUNT; i += 2) {
+        if (int_tree_remove(&tree, i, NULL)) errors++;
+    }
+    if (int_tree_size(&tree) || mem_monitor_bytes_used(&tree.tree.mem_mon)) {
+        errors++;
+    }
+    for (i = 0; i < 1000; i++) int_tree_insert(&tree, i, i, NULL, false);
+    int_tree_destroy(&tree);
+
+    printf("typed avl tree: %d errors\n", errors);
+    return errors;
+}
+
+static int
+typed_index_test (void)
+{
+    int_index_t idx;
+    key16_index_t kidx;
+    key16_t key;
+    int i, value, errors = 0;
+
+    /* starts small & expands */
+    if (int_index_init(&idx, false, 2, 16, NULL)) return 1;
+    shuffle();
+    for (i = 0; i < COUNT / 16; i++) {
+        if (int_index_insert(&idx, order[i], -order[i], NULL, false)) {
+            errors++;
+        }
+    }
+    for (i = 1; i < int_index_size(&idx); i++) {
+        if (idx.keys[i - 1] >= idx.keys[i]) errors++;
+    }
+    for (i = 0; i < COUNT / 16; i++) {
+        if (int_index_search(&idx, order[i], &value) ||
+            (value != -order[i])) {
+                errors++;
+        }
+        if (int_index_remove(&idx, order[i], NULL)) errors++;
+        if (int_index_search(&idx, order[i], NULL) != ENODATA) errors++;
+    }
+    int_index_destroy(&idx);
+
+    /* fixed size, no expansion */
+    if (int_index_init(&idx, false, 4, 0, NULL)) return 1;
+    for (i = 0; i < 4; i++) int_index_insert(&idx, i, i, NULL, false);
+    if (int_index_insert(&idx, 4, 4, NULL, false) != ENOSPC) errors++;
+    if ((int_index_insert(&idx, 2, 20, &value, true) != EEXIST) ||
+        (value != 2) || (idx.values[2] != 20)) {
+            errors++;
+    }
+    int_index_destroy(&idx);
+
+    /* fixed length keys */
+    if (key16_index_init(&kidx, false, 16, 16, NULL)) return 1;
+    for (i = 0; i < 1000; i++) {
+        memset(&key, 0, sizeof(key));
+        snprintf(key.bytes, sizeof(key.bytes), "key%08d", order[i]);
+        if (key16_index_insert(&kidx, key, order[i], NULL, false)) errors++;
+    }
+    for (i = 0; i < 1000; i++) {
+        memset(&key, 0, sizeof(key));
+        snprintf(key.bytes, sizeof(key.bytes), "key%08d", order[i]);
+        if (key16_index_search(&kidx, key, &value) || (value != order[i])) {
+            errors++;
+        }
+    }
+    key16_index_destroy(&kidx);
+
+    printf("typed index: %d errors\n", errors);
+    return errors;
+}
+
+/*
+ * generic (comparer function & user data pointer) against typed
+ * (inlined comparison, keys stored inline) lookups of integer keys
+ */
+static int
+benchmark (int count)
+{
+    avl_tree_t avl;
+    int_tree_t tree;
+    index_obj_t index;
+    int_index_t idx;
+    void *found;
+    int i, value, errors = 0;
+
+    avl_tree_init(&avl, false, false, int_compare, NULL);
+    int_tree_init(&tree, false, NULL);
+    index_obj_init(&index, false, false, int_compare, count, 0, NULL);
+    int_index_init(&idx, false, count, 0, NULL);
+    for (i = 0; i < COUNT; i++) order[i] = i;
+    shuffle_some(count);
+    for (i = 0; i < count; i++) {
+        if (avl_tree_insert(&avl, &values[order[i]], &found, false) ||
+            int_tree_insert(&tree, order[i], order[i], NULL, false)) {
+                errors++;
+        }
+    }
+
+    /* ascending, so that the indexes only ever append */
+    for (i = 0; i < count; i++) {
+        if (index_obj_insert(&index, &values[i], &found, false) ||
+            int_index_insert(&idx, i, i, NULL, false)) {
+                errors++;
+        }
+    }
+    shuffle_some(count);
+
+    printf("\ngeneric avl tree: searching %d keys\n", count);
+    timer_start(&tmr);
+    for (i = 0; i < count; i++) {
+        if (avl_tree_search(&avl, &values[order[i]], &found)) errors++;
+    }
+    timer_end(&tmr);
+    timer_report(&tmr, count, NULL);
+
+    printf("\ntyped avl tree: searching %d keys\n", count);
+    timer_start(&tmr);
+    for (i = 0; i < count; i++) {
+        if (int_tree_search(&tree, order[i], &value)) errors++;
+    }
+    timer_end(&tmr);
+    timer_report(&tmr, count, NULL);
+
+    printf("\ngeneric index: searching %d keys\n", count);
+    timer_start(&tmr);
+    for (i = 0; i < count; i++) {
+        if (index_obj_search(&index, &values[order[i]], &found)) errors++;
+    }
+    timer_end(&tmr);
+    timer_report(&tmr, count, NULL);
+
+    printf("\ntyped index: searching %d keys\n", count);
+    timer_start(&tmr);
+    for (i = 0; i < count; i++) {
+        if (int_index_search(&idx, order[i], &value)) errors++;
+    }
+    timer_end(&tmr);
+    timer_report(&tmr, count, NULL);
+
+    avl_tree_destroy(&avl, NULL, NULL);
+    int_tree_destroy(&tree);
+    index_obj_destroy(&index, NULL, NULL);
+    int_index_destroy(&idx);
+
+    printf("\nbenchmark: %d errors\n", errors);
+    return errors;
+}
+
+int main (int argc, char *argv[])
+{
+    int i, errors;
+
+    for (i = 0; i < COUNT; i++) {
+        values[i] = order[i] = i;
+    }
+    srand(1);
+    errors = int_tree_test();
+    errors += typed_index_test();
+    errors += benchmark(COUNT / 16);
+    errors += benchmark(COUNT);
+    return errors ? -1 : 0;
+}
+
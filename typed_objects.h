@@ -0,0 +1,428 @@
+
+/******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+**
+** Author: Cihangir Metin Akyol, gee.akyol@gmail.com, gee_akyol@yahoo.com
+** Copyright: Cihangir Metin Akyol, April 2014 -> ....
+**
+** All this code has been personally developed by and belongs to 
+** Mr. Cihangir Metin Akyol.  It has been developed in his own 
+** personal time using his own personal resources.  Therefore,
+** it is NOT owned by any establishment, group, company or 
+** consortium.  It is the sole property and work of the named
+** individual.
+**
+** It CAN be used by ANYONE or ANY company for ANY purpose as long 
+** as ownership and/or patent claims are NOT made to it by ANYONE
+** or ANY ENTITY.
+**
+** It ALWAYS is and WILL remain the sole property of Cihangir Metin Akyol.
+**
+** For proper indentation/viewing, regardless of which editor is being used,
+** no tabs are used, ONLY spaces are used and the width of lines never
+** exceed 80 characters.  This way, every text editor/terminal should
+** display the code properly.  If modifying, please stick to this
+** convention.
+**
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+*******************************************************************************
+******************************************************************************/
+
+#ifndef __TYPED_OBJECTS_H__
+#define __TYPED_OBJECTS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "avl_tree_object.h"
+
+/*
+ * Templates which generate type specialized versions of the avl tree
+ * and the index object.  The generic objects store 'void*' user data
+ * and compare through the 'object_comparer' function pointer, so every
+ * comparison is an indirect call plus a dereference of the user data.
+ * Here the keys are stored inline (in the tree nodes or in a sorted
+ * array) and 'compare' is expanded right into the search loops so that
+ * the compiler can inline it.
+ *
+ * 'compare' can be a function like macro or a (static inline) function
+ * taking two 'key_type' VALUES and returning < 0, 0 or > 0 like strcmp.
+ * TYPED_COMPARE_NUMBERS can be used for all integer & floating point
+ * keys.  Fixed length keys (structures, char arrays wrapped in a
+ * structure) work the same way, with for example a memcmp.
+ *
+ * For each object, everything is prefixed with the 'typename' given:
+ *
+ *  DEFINE_TYPED_AVL_TREE(int_tree, int, void*, TYPED_COMPARE_NUMBERS)
+ *
+ * generates 'int_tree_t' & 'int_tree_init', 'int_tree_insert' etc.
+ *
+ * All functions return 0 or an errno.  Insertion of a key which is
+ * already present returns EEXIST, returning the present value in
+ * 'present_value' (if not NULL) and overwriting it with 'value' if
+ * 'overwrite_if_present' is set.  Search & remove return ENODATA if
+ * the key is not there.
+ */
+#define TYPED_COMPARE_NUMBERS(a, b)     (((a) > (b)) - ((a) < (b)))
+
+/*
+ * The typed tree is an intrusive avl_tree_t whose nodes carry the key
+ * & value right after the avl node, so re-balancing is shared with
+ * the generic tree and only the lookups are generated.  The generic
+ * traversal functions can be used on 't->tree', the user data passed
+ * to the traversal function being the 'typename_node_t'.
+ */
+#define DEFINE_TYPED_AVL_TREE(typename, key_type, value_type, compare) \
+    \
+    typedef struct typename ## _node_s { \
+        avl_node_t avl; \
+        key_type key; \
+        value_type value; \
+    } typename ## _node_t; \
+    \
+    typedef struct typename ## _s { \
+        avl_tree_t tree; \
+    } typename ## _t; \
+    \
+    static inline int \
+    typename ## _size (typename ## _t *t) \
+    { return t->tree.n; } \
+    \
+    static inline int \
+    typename ## _node_compare (void *n1, void *n2) \
+    { \
+        return \
+            compare(((typename ## _node_t*) n1)->key, \
+                ((typename ## _node_t*) n2)->key); \
+    } \
+    \
+    static inline void \
+    typename ## _free_node (void *node, void *unused) \
+    { \
+        mem_monitor_free(node); \
+    } \
+    \
+    static inline int \
+    typename ## _init (typename ## _t *t, \
+            boolean make_it_thread_safe, \
+            mem_monitor_t *parent_mem_monitor) \
+    { \
+        return \
+            avl_tree_init_intrusive(&t->tree, make_it_thread_safe, false, \
+                typename ## _node_compare, \
+                AVL_NODE_OFFSET(typename ## _node_t, avl), \
+                parent_mem_monitor); \
+    } \
+    \
+    static inline typename ## _node_t * \
+    typename ## _lookup (typename ## _t *t, key_type key, \
+            avl_node_t **parent, avl_node_t **unbalanced, int *is_left) \
+    { \
+        avl_node_t *node = t->tree.root_node; \
+        int res; \
+        \
+        *parent = NULL; \
+        *unbalanced = node; \
+        *is_left = 0; \
+        while (node) { \
+            if (node->balance) *unbalanced = node; \
+            res = compare(key, ((typename ## _node_t*) node)->key); \
+            if (res == 0) return (typename ## _node_t*) node; \
+            *parent = node; \
+            if ((*is_left = (res < 0))) { \
+                node = node->left; \
+            } else { \
+                node = node->right; \
+            } \
+        } \
+        return NULL; \
+    } \
+    \
+    static inline int \
+    typename ## _insert (typename ## _t *t, key_type key, value_type value, \
+            value_type *present_value, boolean overwrite_if_present) \
+    { \
+        avl_tree_t *tree = &t->tree; \
+        typename ## _node_t *node; \
+        avl_node_t *parent, *unbalanced; \
+        int is_left, failed = 0; \
+        \
+        OBJ_WRITE_LOCK(tree); \
+        if (tree->should_not_be_modified) { \
+            failed = EBUSY; \
+            goto DONE; \
+        } \
+        node = typename ## _lookup(t, key, &parent, &unbalanced, &is_left); \
+        if (node) { \
+            if (present_value) *present_value = node->value; \
+            if (overwrite_if_present) node->value = value; \
+            failed = EEXIST; \
+            goto DONE; \
+        } \
+        node = MEM_MONITOR_ALLOC(tree, sizeof(typename ## _node_t)); \
+        if (NULL == node) { \
+            failed = ENOMEM; \
+            goto DONE; \
+        } \
+        node->key = key; \
+        node->value = value; \
+        avl_tree_link_node(tree, &node->avl, node, \
+            parent, unbalanced, is_left); \
+    DONE: \
+        OBJ_WRITE_UNLOCK(tree); \
+        return failed; \
+    } \
+    \
+    static inline int \
+    typename ## _search (typename ## _t *t, key_type key, \
+            value_type *value) \
+    { \
+        avl_node_t *node; \
+        int res, failed = ENODATA; \
+        \
+        OBJ_READ_LOCK((&t->tree)); \
+        node = t->tree.root_node; \
+        while (node) { \
+            res = compare(key, ((typename ## _node_t*) node)->key); \
+            if (res == 0) { \
+                if (value) *value = ((typename ## _node_t*) node)->value; \
+                failed = 0; \
+                break; \
+            } \
+            node = (res < 0) ? node->left : node->right; \
+        } \
+        OBJ_READ_UNLOCK((&t->tree)); \
+        return failed; \
+    } \
+    \
+    static inline int \
+    typename ## _remove (typename ## _t *t, key_type key, \
+            value_type *removed_value) \
+    { \
+        avl_tree_t *tree = &t->tree; \
+        typename ## _node_t *node; \
+        avl_node_t *parent, *unbalanced; \
+        int is_left, failed = 0; \
+        \
+        OBJ_WRITE_LOCK(tree); \
+        if (tree->should_not_be_modified) { \
+            failed = EBUSY; \
+        } else { \
+            node = typename ## _lookup(t, key, \
+                        &parent, &unbalanced, &is_left); \
+            if (node) { \
+                if (removed_value) *removed_value = node->value; \
+                avl_tree_unlink_node(tree, &node->avl); \
+                mem_monitor_free(node); \
+            } else { \
+                failed = ENODATA; \
+            } \
+        } \
+        OBJ_WRITE_UNLOCK(tree); \
+        return failed; \
+    } \
+    \
+    static inline void \
+    typename ## _destroy (typename ## _t *t) \
+    { \
+        avl_tree_destroy(&t->tree, typename ## _free_node, NULL); \
+    }
+
+/*
+ * The typed index keeps its keys in one sorted array and the values
+ * in another, so a binary search touches nothing but the keys.
+ * 'keys' & 'values' can be read directly in ascending key order
+ * (index 0 to 'n' - 1) while holding the lock.  Sizing & expansion
+ * work as in the index object.
+ */
+#define DEFINE_TYPED_INDEX(typename, key_type, value_type, compare) \
+    \
+    typedef struct typename ## _s { \
+        MEM_MON_VARIABLES; \
+        LOCK_VARIABLES; \
+        int maximum_size; \
+        int expansion_size; \
+        int n; \
+        key_type *keys; \
+        value_type *values; \
+    } typename ## _t; \
+    \
+    static inline int \
+    typename ## _size (typename ## _t *idx) \
+    { return idx->n; } \
+    \
+    static inline int \
+    typename ## _init (typename ## _t *idx, \
+            boolean make_it_thread_safe, \
+            int maximum_size, \
+            int expansion_size, \
+            mem_monitor_t *parent_mem_monitor) \
+    { \
+        int failed = 0; \
+        \
+        if ((maximum_size <= 1) || (expansion_size < 0)) { \
+            return EINVAL; \
+        } \
+        MEM_MONITOR_SETUP(idx); \
+        LOCK_SETUP(idx); \
+        idx->maximum_size = maximum_size; \
+        idx->expansion_size = expansion_size; \
+        idx->n = 0; \
+        idx->keys = MEM_MONITOR_ALLOC(idx, maximum_size * sizeof(key_type)); \
+        idx->values = \
+            MEM_MONITOR_ALLOC(idx, maximum_size * sizeof(value_type)); \
+        if ((NULL == idx->keys) || (NULL == idx->values)) { \
+            MEM_MONITOR_FREE(idx->keys); \
+            MEM_MONITOR_FREE(idx->values); \
+            idx->keys = NULL; \
+            idx->values = NULL; \
+            failed = ENOMEM; \
+        } \
+        OBJ_WRITE_UNLOCK(idx); \
+        return failed; \
+    } \
+    \
+    static inline int \
+    typename ## _find_position (typename ## _t *idx, key_type key, \
+            int *insertion_point) \
+    { \
+        int lo = 0, hi = idx->n, mid, diff; \
+        \
+        while (lo < hi) { \
+            mid = (lo + hi) >> 1; \
+            diff = compare(key, idx->keys[mid]); \
+            if (diff == 0) return mid; \
+            if (diff < 0) { \
+                hi = mid; \
+            } else { \
+                lo = mid + 1; \
+            } \
+        } \
+        *insertion_point = lo; \
+        return -1; \
+    } \
+    \
+    static inline int \
+    typename ## _resize (typename ## _t *idx, int new_size) \
+    { \
+        key_type *keys; \
+        value_type *values; \
+        \
+        keys = MEM_MONITOR_ALLOC(idx, new_size * sizeof(key_type)); \
+        values = MEM_MONITOR_ALLOC(idx, new_size * sizeof(value_type)); \
+        if ((NULL == keys) || (NULL == values)) { \
+            MEM_MONITOR_FREE(keys); \
+            MEM_MONITOR_FREE(values); \
+            return ENOMEM; \
+        } \
+        memcpy(keys, idx->keys, idx->n * sizeof(key_type)); \
+        memcpy(values, idx->values, idx->n * sizeof(value_type)); \
+        MEM_MONITOR_FREE(idx->keys); \
+        MEM_MONITOR_FREE(idx->values); \
+        idx->keys = keys; \
+        idx->values = values; \
+        idx->maximum_size = new_size; \
+        return 0; \
+    } \
+    \
+    static inline int \
+    typename ## _insert (typename ## _t *idx, key_type key, \
+            value_type value, value_type *present_value, \
+            boolean overwrite_if_present) \
+    { \
+        int i, insertion_point = 0, failed = 0; \
+        \
+        OBJ_WRITE_LOCK(idx); \
+        i = typename ## _find_position(idx, key, &insertion_point); \
+        if (i >= 0) { \
+            if (present_value) *present_value = idx->values[i]; \
+            if (overwrite_if_present) idx->values[i] = value; \
+            failed = EEXIST; \
+            goto DONE; \
+        } \
+        if (idx->n >= idx->maximum_size) { \
+            if (idx->expansion_size <= 0) { \
+                failed = ENOSPC; \
+                goto DONE; \
+            } \
+            failed = typename ## _resize(idx, \
+                        idx->maximum_size + idx->expansion_size); \
+            if (failed) goto DONE; \
+        } \
+        i = insertion_point; \
+        memmove(&idx->keys[i + 1], &idx->keys[i], \
+            (idx->n - i) * sizeof(key_type)); \
+        memmove(&idx->values[i + 1], &idx->values[i], \
+            (idx->n - i) * sizeof(value_type)); \
+        idx->keys[i] = key; \
+        idx->values[i] = value; \
+        idx->n++; \
+    DONE: \
+        OBJ_WRITE_UNLOCK(idx); \
+        return failed; \
+    } \
+    \
+    static inline int \
+    typename ## _search (typename ## _t *idx, key_type key, \
+            value_type *value) \
+    { \
+        int i, dummy, failed = 0; \
+        \
+        OBJ_READ_LOCK(idx); \
+        i = typename ## _find_position(idx, key, &dummy); \
+        if (i >= 0) { \
+            if (value) *value = idx->values[i]; \
+        } else { \
+            failed = ENODATA; \
+        } \
+        OBJ_READ_UNLOCK(idx); \
+        return failed; \
+    } \
+    \
+    static inline int \
+    typename ## _remove (typename ## _t *idx, key_type key, \
+            value_type *removed_value) \
+    { \
+        int i, dummy, failed = 0; \
+        \
+        OBJ_WRITE_LOCK(idx); \
+        i = typename ## _find_position(idx, key, &dummy); \
+        if (i >= 0) { \
+            if (removed_value) *removed_value = idx->values[i]; \
+            idx->n--; \
+            memmove(&idx->keys[i], &idx->keys[i + 1], \
+                (idx->n - i) * sizeof(key_type)); \
+            memmove(&idx->values[i], &idx->values[i + 1], \
+                (idx->n - i) * sizeof(value_type)); \
+        } else { \
+            failed = ENODATA; \
+        } \
+        OBJ_WRITE_UNLOCK(idx); \
+        return failed; \
+    } \
+    \
+    static inline void \
+    typename ## _destroy (typename ## _t *idx) \
+    { \
+        OBJ_WRITE_LOCK(idx); \
+        MEM_MONITOR_FREE(idx->keys); \
+        MEM_MONITOR_FREE(idx->values); \
+        idx->keys = NULL; \
+        idx->values = NULL; \
+        idx->n = 0; \
+        OBJ_WRITE_UNLOCK(idx); \
+        LOCK_OBJ_DESTROY(idx); \
+        memset(idx, 0, sizeof(typename ## _t)); \
+    }
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif // __TYPED_OBJECTS_H__